@@ -0,0 +1,261 @@
+#pragma once
+
+// Непрерывные агрегаты, заданные в конфигурации.
+//
+// Агрегат - набор каналов (или все каналы), размер бакета и список функций.
+// При загрузке он компилируется в план: функции, которым нужны одни и те же
+// входные значения, делят один роллап по времени событий (count/sum/avg/
+// min/max - роллап самих значений), а count_above:X и count_below:X
+// превращаются в роллап индикатора "значение выше/ниже X", у которого берётся
+// сумма. Отсчёт при приёме обновляет каждый роллап плана за O(1), так что
+// новый отчёт не требует повторного чтения данных.
+//
+// Водяной знак агрегата - наименьший из водяных знаков его каналов: быстрый
+// канал не закрывает бакеты, пока медленный ещё может в них прийти. Закрытые
+// бакеты хранятся для исправлений в пределах допустимого опоздания, а не за
+// фиксированное число бакетов.
+//
+// Формат файла: строки "<имя> <каналы|*> <бакет в секундах> <функция>[,<функция>...]",
+// каналы - через запятую, '#' - комментарий. Например:
+//   room_a_max 1,2,3 900 max,avg
+//   hot_days * 86400 count_above:30
+
+#include "rollup.hpp"
+#include <set>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include <sstream>
+#include <fstream>
+#include <cstdint>
+#include <cstdlib>
+
+enum AggregateKind {
+    AGG_COUNT,
+    AGG_SUM,
+    AGG_AVG,
+    AGG_MIN,
+    AGG_MAX,
+    AGG_COUNT_ABOVE,
+    AGG_COUNT_BELOW
+};
+
+struct AggregateFunction {
+    std::string name; // Как в конфигурации: "max", "count_above:30"
+    AggregateKind kind;
+    double threshold;
+};
+
+struct AggregateDefinition {
+    std::string name;
+    bool all_channels = false;
+    std::set<uint32_t> channels;
+    int64_t bucket_ms = 0;
+    std::vector<AggregateFunction> functions;
+
+    bool Matches(uint32_t channel) const {
+        return all_channels || channels.count(channel) != 0;
+    }
+};
+
+// Разбор функции "<имя>[:<порог>]"
+inline bool parseAggregateFunction(const std::string& text, AggregateFunction& function) {
+    static const struct {
+        const char* name;
+        AggregateKind kind;
+        bool threshold;
+    } kinds[] = {
+        {"count", AGG_COUNT, false}, {"sum", AGG_SUM, false}, {"avg", AGG_AVG, false},
+        {"min", AGG_MIN, false}, {"max", AGG_MAX, false},
+        {"count_above", AGG_COUNT_ABOVE, true}, {"count_below", AGG_COUNT_BELOW, true}
+    };
+    size_t colon_pos = text.find(':');
+    std::string name = text.substr(0, colon_pos);
+    for (const auto& kind : kinds) {
+        if (name != kind.name || kind.threshold != (colon_pos != std::string::npos))
+            continue;
+        function = AggregateFunction{text, kind.kind, 0.0};
+        if (kind.threshold) {
+            char* end = nullptr;
+            std::string threshold = text.substr(colon_pos + 1);
+            function.threshold = std::strtod(threshold.c_str(), &end);
+            return !threshold.empty() && *end == '\0';
+        }
+        return true;
+    }
+    return false;
+}
+
+// Загрузка определений агрегатов; описания ошибочных строк добавляются в errors
+inline bool loadAggregates(const std::string& file_name, std::vector<AggregateDefinition>& definitions,
+                           std::string& errors) {
+    std::ifstream file(file_name);
+    if (!file.is_open()) {
+        errors += "Failed to open aggregate config: " + file_name + "\n";
+        return false;
+    }
+    std::string line;
+    int line_no = 0;
+    while (std::getline(file, line)) {
+        line_no++;
+        size_t hash_pos = line.find('#');
+        if (hash_pos != std::string::npos)
+            line.erase(hash_pos);
+        std::istringstream ss(line);
+        AggregateDefinition definition;
+        std::string channels, functions;
+        double bucket_sec = 0.0;
+        if (!(ss >> definition.name))
+            continue;
+        bool ok = static_cast<bool>(ss >> channels >> bucket_sec >> functions) && bucket_sec > 0.0;
+        definition.bucket_ms = (int64_t)(bucket_sec * 1000);
+        if (ok && channels == "*") {
+            definition.all_channels = true;
+        } else if (ok) {
+            std::istringstream list(channels);
+            std::string channel;
+            while (ok && std::getline(list, channel, ',')) {
+                ok = !channel.empty() && channel.find_first_not_of("0123456789") == std::string::npos;
+                if (ok)
+                    definition.channels.insert((uint32_t)std::stoul(channel));
+            }
+        }
+        std::istringstream list(functions);
+        std::string text;
+        while (ok && std::getline(list, text, ',')) {
+            AggregateFunction function;
+            ok = parseAggregateFunction(text, function);
+            definition.functions.push_back(function);
+        }
+        if (!ok || definition.functions.empty()) {
+            errors += file_name + ":" + std::to_string(line_no) + ": invalid aggregate '" + line + "'\n";
+            continue;
+        }
+        definitions.push_back(definition);
+    }
+    return true;
+}
+
+class ContinuousAggregate {
+public:
+    ContinuousAggregate(const AggregateDefinition& definition, int64_t allowed_lateness_ms)
+        : _definition(definition), _allowed_lateness_ms(allowed_lateness_ms) {
+        // Бакетов в пределах опоздания: столько открыто в обычной работе и столько
+        // закрытых хранится для исправлений
+        int64_t bucket_ms = std::max<int64_t>(1, _definition.bucket_ms);
+        size_t lateness_buckets = (size_t)(std::max<int64_t>(0, allowed_lateness_ms) / bucket_ms) + 1;
+        // План: роллап на каждый различный вход (значение или индикатор с порогом)
+        for (const auto& function : _definition.functions) {
+            Input input = InputOf(function);
+            size_t stream = 0;
+            while (stream < _streams.size() && !(_streams[stream]->input == input))
+                stream++;
+            if (stream == _streams.size()) {
+                // Интеграл по времени не ведётся (max_gap_ms = 0): в роллап идут отсчёты
+                // разных каналов, и отрезки между ними ничего не значат
+                _streams.emplace_back(new Stream{input, EventTimeRollup(bucket_ms, allowed_lateness_ms,
+                                                                        lateness_buckets,
+                                                                        lateness_buckets + MAX_OPEN_BUCKETS_DEFAULT,
+                                                                        0)});
+                _streams.back()->rollup.SetManualWatermark();
+            }
+            _function_streams.push_back(stream);
+        }
+    }
+
+    const AggregateDefinition& Definition() const {
+        return _definition;
+    }
+
+    void Add(uint32_t channel, int64_t time_ms, double value, uint8_t flags) {
+        for (auto& stream : _streams) {
+            double input = value;
+            if (stream->input.kind == AGG_COUNT_ABOVE)
+                input = (value > stream->input.threshold) ? 1.0 : 0.0;
+            else if (stream->input.kind == AGG_COUNT_BELOW)
+                input = (value < stream->input.threshold) ? 1.0 : 0.0;
+            stream->rollup.Add(time_ms, input, flags);
+        }
+
+        // Водяной знак канала и наименьший по каналам
+        auto it = _channel_ms.find(channel);
+        if (it == _channel_ms.end()) {
+            it = _channel_ms.emplace(channel, time_ms).first;
+            _channel_marks.insert(time_ms);
+        } else if (time_ms > it->second) {
+            _channel_marks.erase(_channel_marks.find(it->second));
+            _channel_marks.insert(time_ms);
+            it->second = time_ms;
+        }
+        AdvanceWatermark(*_channel_marks.begin() - _allowed_lateness_ms);
+    }
+
+    void AdvanceWatermark(int64_t watermark_ms) {
+        for (auto& stream : _streams)
+            stream->rollup.AdvanceWatermark(watermark_ms);
+    }
+
+    // Забрать закрытые и исправленные бакеты:
+    // f(номер функции, начало бакета, значение, исправление ли это)
+    template<class F>
+    void Flush(F f) {
+        for (size_t stream = 0; stream < _streams.size(); stream++) {
+            for (const auto& bucket : _streams[stream]->rollup.TakeFinalized())
+                Emit(stream, bucket, false, f);
+            for (const auto& bucket : _streams[stream]->rollup.TakeCorrections())
+                Emit(stream, bucket, true, f);
+        }
+    }
+
+private:
+    // Вход роллапа: сами значения (kind = AGG_AVG) или индикатор с порогом
+    struct Input {
+        AggregateKind kind;
+        double threshold;
+
+        bool operator==(const Input& other) const {
+            return kind == other.kind && threshold == other.threshold;
+        }
+    };
+
+    struct Stream {
+        Input input;
+        EventTimeRollup rollup;
+    };
+
+    static Input InputOf(const AggregateFunction& function) {
+        if (function.kind == AGG_COUNT_ABOVE || function.kind == AGG_COUNT_BELOW)
+            return Input{function.kind, function.threshold};
+        return Input{AGG_AVG, 0.0};
+    }
+
+    template<class F>
+    void Emit(size_t stream, const RollupBucket& bucket, bool correction, F& f) {
+        const Partial& partial = bucket.partial;
+        if (partial.count == 0)
+            return; // Только исключённые по флагам отсчёты
+        for (size_t i = 0; i < _definition.functions.size(); i++) {
+            if (_function_streams[i] != stream)
+                continue;
+            double value = 0.0;
+            switch (_definition.functions[i].kind) {
+            case AGG_COUNT: value = (double)partial.count; break;
+            case AGG_SUM: value = partial.sum; break;
+            case AGG_AVG: value = partial.Average(); break;
+            case AGG_MIN: value = partial.min; break;
+            case AGG_MAX: value = partial.max; break;
+            case AGG_COUNT_ABOVE:
+            case AGG_COUNT_BELOW: value = partial.sum; break;
+            }
+            f(i, bucket.start_ms, value, correction);
+        }
+    }
+
+    AggregateDefinition _definition;
+    int64_t _allowed_lateness_ms;
+    std::map<uint32_t, int64_t> _channel_ms; // Канал -> самое позднее время его отсчётов
+    std::multiset<int64_t> _channel_marks;   // Те же времена, для наименьшего
+    std::vector<std::unique_ptr<Stream>> _streams;
+    std::vector<size_t> _function_streams; // Функция -> роллап плана
+};
@@ -0,0 +1,162 @@
+#pragma once
+
+// Выравнивание нескольких рядов по времени за один потоковый проход.
+//
+// Ряды читаются курсорами (Valid/Time/Value/Next), отсортированными по
+// времени. Без сетки моменты вывода - объединение времён всех рядов: их
+// выдаёт k-путевое слияние через кучу курсоров. С сеткой - точки
+// from + n * grid_ms. В каждый момент значение ряда берётся либо последним
+// известным (LOCF), либо линейной интерполяцией между соседними отсчётами
+// (следующий отсчёт - текущая голова курсора, так что заглядывать вперёд
+// дальше не нужно). Поверх значений сразу считается операция над рядами.
+// В памяти - по одному предыдущему отсчёту на ряд, время O(N log k).
+
+#include <queue>
+#include <vector>
+#include <string>
+#include <limits>
+#include <cstdint>
+#include <algorithm>
+#include <functional>
+
+enum FillMode {
+    FILL_LOCF,   // Последнее известное значение
+    FILL_LINEAR  // Линейная интерполяция (без экстраполяции за крайние отсчёты)
+};
+
+enum SeriesOp {
+    SERIES_OP_NONE,
+    SERIES_OP_DIFF,   // Ряд 1 - ряд 2
+    SERIES_OP_RATIO,  // Ряд 1 / ряд 2
+    SERIES_OP_SPREAD  // Максимум - минимум по всем рядам
+};
+
+inline bool parseFillMode(const std::string& text, FillMode& mode) {
+    if (text == "locf")
+        mode = FILL_LOCF;
+    else if (text == "linear")
+        mode = FILL_LINEAR;
+    else
+        return false;
+    return true;
+}
+
+inline bool parseSeriesOp(const std::string& text, SeriesOp& op) {
+    if (text == "diff")
+        op = SERIES_OP_DIFF;
+    else if (text == "ratio")
+        op = SERIES_OP_RATIO;
+    else if (text == "spread")
+        op = SERIES_OP_SPREAD;
+    else
+        return false;
+    return true;
+}
+
+// Операция над значениями рядов в один момент; false - не все нужные значения известны
+inline bool applySeriesOp(SeriesOp op, const std::vector<double>& values, const std::vector<char>& known,
+                          double& result) {
+    switch (op) {
+    case SERIES_OP_NONE:
+        return false;
+    case SERIES_OP_DIFF:
+    case SERIES_OP_RATIO:
+        if (values.size() < 2 || !known[0] || !known[1])
+            return false;
+        if (op == SERIES_OP_DIFF) {
+            result = values[0] - values[1];
+            return true;
+        }
+        if (values[1] == 0.0)
+            return false;
+        result = values[0] / values[1];
+        return true;
+    case SERIES_OP_SPREAD: {
+        double lo = std::numeric_limits<double>::infinity();
+        double hi = -lo;
+        for (size_t i = 0; i < values.size(); i++) {
+            if (!known[i])
+                return false;
+            lo = std::min(lo, values[i]);
+            hi = std::max(hi, values[i]);
+        }
+        result = hi - lo;
+        return !values.empty();
+    }
+    }
+    return false;
+}
+
+// Выровненный обход рядов в [from_ms, to_ms]; grid_ms = 0 - без сетки.
+// f(time_ms, values, known) для каждого момента вывода.
+template<class Cursor, class F>
+void alignSeries(std::vector<Cursor>& cursors, int64_t from_ms, int64_t to_ms, int64_t grid_ms, FillMode fill, F f) {
+    size_t k = cursors.size();
+    std::vector<int64_t> prev_time(k, 0);
+    std::vector<double> prev_value(k, 0.0);
+    std::vector<char> has_prev(k, 0);
+    std::vector<double> values(k, 0.0);
+    std::vector<char> known(k, 0);
+
+    // Куча курсоров по времени головы (для моментов вывода без сетки)
+    auto later = [&](size_t a, size_t b) {
+        return cursors[a].Time() > cursors[b].Time();
+    };
+    std::priority_queue<size_t, std::vector<size_t>, decltype(later)> heap(later);
+    for (size_t i = 0; i < k; i++) {
+        if (cursors[i].Valid())
+            heap.push(i);
+    }
+
+    // Сдвинуть курсор i за все отсчёты не позже time_ms
+    auto advance = [&](size_t i, int64_t time_ms) {
+        while (cursors[i].Valid() && cursors[i].Time() <= time_ms) {
+            prev_time[i] = cursors[i].Time();
+            prev_value[i] = cursors[i].Value();
+            has_prev[i] = 1;
+            cursors[i].Next();
+        }
+    };
+
+    // Значения всех рядов в момент time_ms (курсоры уже сдвинуты за него)
+    auto emit = [&](int64_t time_ms) {
+        for (size_t i = 0; i < k; i++) {
+            known[i] = has_prev[i];
+            values[i] = prev_value[i];
+            if (fill == FILL_LINEAR && has_prev[i] && prev_time[i] != time_ms) {
+                known[i] = cursors[i].Valid();
+                if (known[i]) {
+                    double t = (double)(time_ms - prev_time[i]) / (double)(cursors[i].Time() - prev_time[i]);
+                    values[i] = prev_value[i] + (cursors[i].Value() - prev_value[i]) * t;
+                }
+            }
+        }
+        f(time_ms, values, known);
+    };
+
+    if (grid_ms > 0) {
+        for (int64_t time_ms = from_ms; time_ms <= to_ms; time_ms += grid_ms) {
+            for (size_t i = 0; i < k; i++)
+                advance(i, time_ms);
+            emit(time_ms);
+        }
+        return;
+    }
+
+    std::vector<size_t> moved;
+    while (!heap.empty()) {
+        int64_t time_ms = cursors[heap.top()].Time();
+        // Все курсоры с этим временем сдвигаются вместе, затем возвращаются в кучу
+        moved.clear();
+        while (!heap.empty() && cursors[heap.top()].Time() == time_ms) {
+            moved.push_back(heap.top());
+            heap.pop();
+        }
+        for (size_t i : moved) {
+            advance(i, time_ms);
+            if (cursors[i].Valid())
+                heap.push(i);
+        }
+        emit(time_ms);
+    }
+}
@@ -0,0 +1,188 @@
+#pragma once
+
+// Поиск аномалий в потоке средних за час с сезонной базовой линией.
+//
+// Базовая линия - среднее и дисперсия для каждого часа суток отдельно для
+// будних и выходных дней (48 слотов), с экспоненциальным забыванием: слот
+// помнит примерно ANOMALY_BASELINE_WINDOW последних наблюдений. Каждое новое
+// значение сравнивается со своим слотом (z-оценка), так что суточный пик не
+// считается аномалией, а отклонение ночью - считается. Дисперсия слота по
+// нескольким наблюдениям ненадёжна, поэтому она стягивается к общей по всем
+// слотам дисперсии отклонений от нормы. Одиночные выбросы
+// ловит порог по |z|, медленный устойчивый сдвиг (деградация оборудования) -
+// двусторонний CUSUM по z-оценкам. Состояние - несколько сотен байт на канал,
+// обновление O(1), история не читается. Состояние сохраняется в файл и
+// читается при запуске, так что выученная базовая линия переживает перезапуск.
+
+#include "log_format.hpp"
+#include <cmath>
+#include <string>
+#include <fstream>
+#include <cstdio>
+#include <cstdint>
+#include <algorithm>
+
+const int ANOMALY_SLOTS = 48;               // 24 часа x (будни, выходные)
+const int ANOMALY_BASELINE_WINDOW = 20;     // Память слота (наблюдений)
+const int ANOMALY_MIN_HISTORY = 3;          // Наблюдений в слоте до начала оценки
+const double ANOMALY_Z_THRESHOLD = 4.0;     // Порог |z| для выброса
+const double ANOMALY_MIN_STDDEV = 0.05;     // Нижняя граница разброса (единицы значения)
+const double CUSUM_SLACK = 0.5;             // Допуск CUSUM (в стандартных отклонениях)
+const double ANOMALY_POOLED_PRIOR = 5.0;    // Вес общей дисперсии (в наблюдениях слота)
+const int ANOMALY_POOLED_WINDOW = 200;      // Память общей дисперсии (наблюдений)
+const double CUSUM_THRESHOLD = 8.0;         // Порог срабатывания CUSUM
+const double CUSUM_MAX_STEP = 3.0;          // Ограничение вклада одного наблюдения в CUSUM
+
+enum AnomalyKind {
+    ANOMALY_NONE,
+    ANOMALY_SPIKE,      // Одиночное сильное отклонение
+    ANOMALY_SHIFT_UP,   // Устойчивый сдвиг вверх
+    ANOMALY_SHIFT_DOWN  // Устойчивый сдвиг вниз
+};
+
+inline const char* anomalyKindName(AnomalyKind kind) {
+    switch (kind) {
+    case ANOMALY_SPIKE: return "spike";
+    case ANOMALY_SHIFT_UP: return "shift_up";
+    case ANOMALY_SHIFT_DOWN: return "shift_down";
+    default: return "none";
+    }
+}
+
+// Оценка одного наблюдения
+struct AnomalyScore {
+    bool scored = false;  // В слоте было достаточно истории
+    double expected = 0.0;
+    double stddev = 0.0;
+    double z = 0.0;
+    AnomalyKind kind = ANOMALY_NONE;
+};
+
+class AnomalyDetector {
+public:
+    // Слот базовой линии для времени time_ms (по местному времени)
+    static int SlotOf(int64_t time_ms) {
+        std::tm tm = localTime((std::time_t)(time_ms / 1000));
+        bool weekend = (tm.tm_wday == 0 || tm.tm_wday == 6);
+        return (weekend ? 24 : 0) + tm.tm_hour;
+    }
+
+    // Оценить значение value за час, начинающийся в time_ms, и учесть его в базовой линии
+    AnomalyScore Observe(int64_t time_ms, double value) {
+        AnomalyScore score;
+        Slot& slot = _slots[SlotOf(time_ms)];
+        double learned = value;
+        if (slot.count >= ANOMALY_MIN_HISTORY) {
+            score.scored = true;
+            score.expected = slot.mean;
+            double var = (slot.count * (double)slot.var + ANOMALY_POOLED_PRIOR * _pooled_var) /
+                         (slot.count + ANOMALY_POOLED_PRIOR);
+            score.stddev = std::max(std::sqrt(var), ANOMALY_MIN_STDDEV);
+            score.z = (value - score.expected) / score.stddev;
+
+            // Выброс не должен портить базовую линию и сам по себе запускать CUSUM:
+            // в базовую линию он попадает обрезанным по порогу, в CUSUM - по CUSUM_MAX_STEP
+            double z = std::max(-ANOMALY_Z_THRESHOLD, std::min(ANOMALY_Z_THRESHOLD, score.z));
+            learned = score.expected + z * score.stddev;
+            double step = std::max(-CUSUM_MAX_STEP, std::min(CUSUM_MAX_STEP, score.z));
+            _cusum_high = std::max(0.0, _cusum_high + step - CUSUM_SLACK);
+            _cusum_low = std::max(0.0, _cusum_low - step - CUSUM_SLACK);
+            if (std::fabs(score.z) > ANOMALY_Z_THRESHOLD) {
+                score.kind = ANOMALY_SPIKE;
+            } else if (_cusum_high > CUSUM_THRESHOLD) {
+                score.kind = ANOMALY_SHIFT_UP;
+                _cusum_high = 0.0;
+            } else if (_cusum_low > CUSUM_THRESHOLD) {
+                score.kind = ANOMALY_SHIFT_DOWN;
+                _cusum_low = 0.0;
+            }
+        }
+        if (slot.count > 0) {
+            double residual = learned - slot.mean;
+            _pooled_count = std::min(_pooled_count + 1, ANOMALY_POOLED_WINDOW);
+            _pooled_var += (residual * residual - _pooled_var) / _pooled_count;
+        }
+
+        // Экспоненциально взвешенные среднее и дисперсия; первые наблюдения - точные
+        int n = std::min(slot.count + 1, ANOMALY_BASELINE_WINDOW);
+        double alpha = 1.0 / n;
+        double delta = learned - slot.mean;
+        slot.mean = (float)(slot.mean + alpha * delta);
+        slot.var = (float)((1.0 - alpha) * (slot.var + alpha * delta * delta));
+        slot.count = (uint8_t)std::min(slot.count + 1, 255);
+
+        _last = score;
+        if (score.kind != ANOMALY_NONE)
+            _detected++;
+        return score;
+    }
+
+    // Последняя оценка и текущие суммы CUSUM (для метрик)
+    const AnomalyScore& Last() const {
+        return _last;
+    }
+
+    double CusumHigh() const {
+        return _cusum_high;
+    }
+
+    double CusumLow() const {
+        return _cusum_low;
+    }
+
+    // Всего найдено аномалий
+    uint64_t Detected() const {
+        return _detected;
+    }
+
+    // Сохранение состояния (через временный файл, чтобы не оставить его наполовину записанным)
+    bool Save(const std::string& file_name) const {
+        std::string tmp_name = file_name + ".tmp";
+        {
+            std::ofstream file(tmp_name, std::ios::trunc);
+            if (!file.is_open())
+                return false;
+            file.precision(17);
+            file << "anomaly " << ANOMALY_SLOTS << " " << _cusum_high << " " << _cusum_low << " "
+                 << _pooled_var << " " << _pooled_count << " " << _detected << "\n";
+            for (const auto& slot : _slots)
+                file << slot.mean << " " << slot.var << " " << (int)slot.count << "\n";
+        }
+        return std::rename(tmp_name.c_str(), file_name.c_str()) == 0;
+    }
+
+    // Загрузка состояния; false, если файла нет или он испорчен (состояние не меняется)
+    bool Load(const std::string& file_name) {
+        std::ifstream file(file_name);
+        std::string magic;
+        int slots = 0;
+        AnomalyDetector loaded;
+        if (!(file >> magic >> slots) || magic != "anomaly" || slots != ANOMALY_SLOTS ||
+            !(file >> loaded._cusum_high >> loaded._cusum_low >> loaded._pooled_var >> loaded._pooled_count
+                   >> loaded._detected))
+            return false;
+        for (auto& slot : loaded._slots) {
+            int count = 0;
+            if (!(file >> slot.mean >> slot.var >> count) || count < 0 || count > 255)
+                return false;
+            slot.count = (uint8_t)count;
+        }
+        *this = loaded;
+        return true;
+    }
+
+private:
+    struct Slot {
+        float mean = 0.0f;
+        float var = 0.0f;
+        uint8_t count = 0;
+    };
+
+    Slot _slots[ANOMALY_SLOTS];
+    double _cusum_high = 0.0;
+    double _cusum_low = 0.0;
+    double _pooled_var = 0.0; // Общая дисперсия отклонений от нормы слота
+    int _pooled_count = 0;
+    AnomalyScore _last;
+    uint64_t _detected = 0;
+};
@@ -0,0 +1,147 @@
+#pragma once
+
+// Ограниченный по памяти шардированный LRU-кэш.
+//
+// Ключи распределяются по шардам по хэшу, у каждого шарда свой мьютекс и своя
+// доля лимита памяти, так что параллельные чтения разных блоков не конкурируют.
+// Значения отдаются как std::shared_ptr<const Value>: пока читатель держит
+// такой указатель, блок "закреплён" - вытеснение лишь убирает его из кэша,
+// но не освобождает память, которой пользуются.
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <vector>
+#include <cstdint>
+#include <unordered_map>
+
+// Счётчики кэша
+struct CacheStats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t inserts = 0;
+    uint64_t evictions = 0;
+    size_t usage = 0;     // Занято байт
+    size_t capacity = 0;  // Лимит в байтах
+};
+
+template<class Key, class Value, class Hash = std::hash<Key>>
+class ShardedLruCache {
+public:
+    typedef std::shared_ptr<const Value> Handle;
+
+    ShardedLruCache(size_t capacity_bytes, size_t shard_count = 16)
+        : _capacity(capacity_bytes), _hits(0), _misses(0), _inserts(0), _evictions(0) {
+        if (shard_count == 0)
+            shard_count = 1;
+        for (size_t i = 0; i < shard_count; i++) {
+            _shards.emplace_back(new Shard());
+            _shards.back()->capacity = capacity_bytes / shard_count;
+        }
+    }
+
+    // Найти значение; nullptr, если его нет в кэше
+    Handle Lookup(const Key& key) {
+        Shard& shard = ShardFor(key);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto it = shard.map.find(key);
+        if (it == shard.map.end()) {
+            _misses++;
+            return Handle();
+        }
+        _hits++;
+        shard.lru.splice(shard.lru.begin(), shard.lru, it->second.position);
+        return it->second.value;
+    }
+
+    // Положить значение размером charge байт; если ключ уже есть, возвращается старое значение
+    Handle Insert(const Key& key, Handle value, size_t charge) {
+        Shard& shard = ShardFor(key);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto it = shard.map.find(key);
+        if (it != shard.map.end())
+            return it->second.value;
+        // Значение больше доли шарда не кэшируем, но отдаём читателю
+        if (charge > shard.capacity)
+            return value;
+        shard.lru.push_front(key);
+        shard.map.emplace(key, Entry{value, charge, shard.lru.begin()});
+        shard.usage += charge;
+        _inserts++;
+        while (shard.usage > shard.capacity && !shard.lru.empty()) {
+            auto victim = shard.map.find(shard.lru.back());
+            shard.usage -= victim->second.charge;
+            shard.map.erase(victim);
+            shard.lru.pop_back();
+            _evictions++;
+        }
+        return value;
+    }
+
+    // Найти значение или загрузить его через loader(size_t& charge) -> Handle.
+    // Загрузка идёт без блокировки шарда; при гонке двух загрузчиков побеждает первый.
+    template<class Loader>
+    Handle GetOrLoad(const Key& key, Loader loader) {
+        Handle value = Lookup(key);
+        if (value)
+            return value;
+        size_t charge = 0;
+        value = loader(charge);
+        if (!value)
+            return value;
+        return Insert(key, value, charge);
+    }
+
+    // Удалить всё содержимое кэша
+    void Clear() {
+        for (auto& shard : _shards) {
+            std::lock_guard<std::mutex> lock(shard->mutex);
+            shard->map.clear();
+            shard->lru.clear();
+            shard->usage = 0;
+        }
+    }
+
+    CacheStats Stats() const {
+        CacheStats stats;
+        stats.hits = _hits;
+        stats.misses = _misses;
+        stats.inserts = _inserts;
+        stats.evictions = _evictions;
+        stats.capacity = _capacity;
+        for (auto& shard : _shards) {
+            std::lock_guard<std::mutex> lock(shard->mutex);
+            stats.usage += shard->usage;
+        }
+        return stats;
+    }
+
+private:
+    struct Entry {
+        Handle value;
+        size_t charge;
+        typename std::list<Key>::iterator position;
+    };
+
+    struct Shard {
+        std::mutex mutex;
+        std::list<Key> lru;  // В начале - недавно использованные
+        std::unordered_map<Key, Entry, Hash> map;
+        size_t usage = 0;
+        size_t capacity = 0;
+    };
+
+    Shard& ShardFor(const Key& key) {
+        // Старшие биты хэша - чтобы не коррелировать с бакетами unordered_map
+        uint64_t h = (uint64_t)Hash()(key) * 0x9E3779B97F4A7C15ull;
+        return *_shards[(h >> 32) % _shards.size()];
+    }
+
+    std::vector<std::unique_ptr<Shard>> _shards;
+    size_t _capacity;
+    std::atomic<uint64_t> _hits;
+    std::atomic<uint64_t> _misses;
+    std::atomic<uint64_t> _inserts;
+    std::atomic<uint64_t> _evictions;
+};
@@ -0,0 +1,155 @@
+#pragma once
+
+// Кэш частичных агрегатов по выровненным интервалам времени (бакетам).
+//
+// Каждый отсчёт один раз добавляется в агрегат своего бакета. Закрытые бакеты
+// больше не меняются и переиспользуются всеми последующими запросами, новые
+// отсчёты попадают только в открытый (последний) бакет. Скользящий запрос
+// "за последние N" объединяет N / bucket_ms готовых агрегатов вместо разбора
+// всех отсчётов окна, т.е. стоит O(новых данных), а не O(окна).
+//
+// Окно выравнивается по бакетам: в него входят все бакеты, пересекающиеся с
+// (now - window, now], поэтому левая граница может захватить до одного бакета.
+
+#include "quality.hpp"
+#include <map>
+#include <limits>
+#include <cstdint>
+#include <algorithm>
+
+const int64_t BUCKET_MS_DEFAULT = 60 * 1000; // Размер бакета по умолчанию (1 минута)
+
+// Начало интервала длины step_ms, в который попадает time_ms
+inline int64_t alignTime(int64_t time_ms, int64_t step_ms) {
+    int64_t r = time_ms % step_ms;
+    return time_ms - (r < 0 ? r + step_ms : r);
+}
+
+// Частичный агрегат: объединяется с другими без доступа к исходным отсчётам.
+// flag_counts - число отсчётов с каждым флагом качества, в том числе
+// исключённых из count/sum/min/max. covered_ms и интегралы набираются
+// отрезками между соседними отсчётами (см. EventTimeRollup) и дают среднее,
+// взвешенное по времени, не смещённое к периодам частых отсчётов.
+struct Partial {
+    uint64_t count = 0;
+    double sum = 0.0;
+    double min = std::numeric_limits<double>::infinity();
+    double max = -std::numeric_limits<double>::infinity();
+    uint64_t flag_counts[QUALITY_FLAG_COUNT] = {};
+    int64_t covered_ms = 0;     // Время, покрытое отрезками между отсчётами
+    double integral = 0.0;      // Интеграл по трапециям (значение * мс)
+    double step_integral = 0.0; // Интеграл ступенчатой функции (значение держится до следующего отсчёта)
+
+    void Add(double value) {
+        count++;
+        sum += value;
+        min = std::min(min, value);
+        max = std::max(max, value);
+    }
+
+    // Отсчёт с флагами: флаги учитываются всегда, значение - если среди них нет exclude_mask
+    void Add(double value, uint8_t flags, uint8_t exclude_mask = QUALITY_EXCLUDE_DEFAULT) {
+        for (int f = 0; f < QUALITY_FLAG_COUNT; f++) {
+            if (flags & (1 << f))
+                flag_counts[f]++;
+        }
+        if (!(flags & exclude_mask))
+            Add(value);
+    }
+
+    // То же для values[begin, end) со столбцом флагов: маска отбора строится
+    // сразу для 64 отсчётов, полностью отобранные слова складываются без ветвлений
+    void AddMasked(const double* values, const FlagColumn& flags, size_t begin, size_t end,
+                   uint8_t exclude_mask = QUALITY_EXCLUDE_DEFAULT) {
+        for (int f = 0; f < QUALITY_FLAG_COUNT; f++)
+            flag_counts[f] += flags.Count(f, begin, end);
+        for (size_t word = begin / 64; word * 64 < end; word++) {
+            uint64_t keep = ~flags.AnyWord(word, exclude_mask) & wordRangeMask(word, begin, end);
+            const double* chunk = values + word * 64;
+            if (keep == ~0ULL) {
+                double chunk_sum = 0.0, chunk_min = min, chunk_max = max;
+                for (int i = 0; i < 64; i++) {
+                    chunk_sum += chunk[i];
+                    chunk_min = std::min(chunk_min, chunk[i]);
+                    chunk_max = std::max(chunk_max, chunk[i]);
+                }
+                count += 64;
+                sum += chunk_sum;
+                min = chunk_min;
+                max = chunk_max;
+                continue;
+            }
+            for (; keep != 0; keep &= keep - 1)
+                Add(chunk[__builtin_ctzll(keep)]);
+        }
+    }
+
+    void Merge(const Partial& other) {
+        count += other.count;
+        sum += other.sum;
+        min = std::min(min, other.min);
+        max = std::max(max, other.max);
+        for (int f = 0; f < QUALITY_FLAG_COUNT; f++)
+            flag_counts[f] += other.flag_counts[f];
+        covered_ms += other.covered_ms;
+        integral += other.integral;
+        step_integral += other.step_integral;
+    }
+
+    // Отрезок длительностью duration_ms с интегралами по трапеции и ступенькой
+    void AddSegment(int64_t duration_ms, double trapezoid, double step) {
+        covered_ms += duration_ms;
+        integral += trapezoid;
+        step_integral += step;
+    }
+
+    double Average() const {
+        return (count > 0) ? (sum / count) : 0.0;
+    }
+
+    // Среднее, взвешенное по времени; без отрезков - обычное среднее
+    double TimeWeightedAverage() const {
+        return (covered_ms > 0) ? (integral / covered_ms) : Average();
+    }
+};
+
+class BucketCache {
+public:
+    explicit BucketCache(int64_t bucket_ms = BUCKET_MS_DEFAULT)
+        : _bucket_ms(std::max<int64_t>(1, bucket_ms)) {}
+
+    int64_t BucketMs() const {
+        return _bucket_ms;
+    }
+
+    // Начало бакета, в который попадает time_ms
+    int64_t BucketStart(int64_t time_ms) const {
+        return alignTime(time_ms, _bucket_ms);
+    }
+
+    void Add(int64_t time_ms, double value) {
+        _buckets[BucketStart(time_ms)].Add(value);
+    }
+
+    // Агрегат бакетов, пересекающихся с окном (now_ms - window_ms, now_ms]
+    Partial Window(int64_t now_ms, int64_t window_ms) const {
+        Partial result;
+        auto it = _buckets.lower_bound(BucketStart(now_ms - window_ms));
+        for (; it != _buckets.end() && it->first <= now_ms; ++it)
+            result.Merge(it->second);
+        return result;
+    }
+
+    // Забыть бакеты, целиком лежащие раньше time_ms
+    void DropBefore(int64_t time_ms) {
+        _buckets.erase(_buckets.begin(), _buckets.lower_bound(BucketStart(time_ms)));
+    }
+
+    size_t Size() const {
+        return _buckets.size();
+    }
+
+private:
+    int64_t _bucket_ms;
+    std::map<int64_t, Partial> _buckets; // Начало бакета -> агрегат
+};
@@ -0,0 +1,150 @@
+#pragma once
+
+// Калибровка и перевод единиц по каналам.
+//
+// Для каждого канала задаётся полином p(x) = c0 + c1*x + c2*x^2 + c3*x^3 от
+// сырого значения (градусы или отсчёты АЦП) и единица, в которой получается
+// результат. Перевод единиц в градусы Цельсия линеен, поэтому он сразу
+// вносится в коэффициенты, и на отсчёт остаётся один полином.
+//
+// Калибровка применяется к пачке отсчётов одного чтения: коэффициенты
+// раскладываются в столбцы по степеням, и схема Горнера идёт по всей пачке
+// независимыми для каждого элемента операциями, которые компилятор
+// векторизует.
+//
+// Таблица неизменяема; новая версия из файла конфигурации подменяет старую
+// атомарно, не останавливая приём данных.
+//
+// Формат файла: строки "<канал> <C|F|K> <c0> [c1] [c2] [c3]", '#' - комментарий.
+// Например, "2 F -40 0.1" - канал 2 шлёт отсчёты АЦП, 0.1 °F на отсчёт от -40 °F.
+
+#include <array>
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+#include <sstream>
+#include <fstream>
+#include <cstdint>
+#include <unordered_map>
+
+const int CALIBRATION_MAX_DEGREE = 3;
+
+// Коэффициенты полинома по возрастанию степени
+typedef std::array<double, CALIBRATION_MAX_DEGREE + 1> CalibrationPoly;
+
+// Тождественное преобразование (канал без калибровки)
+inline CalibrationPoly identityPoly() {
+    CalibrationPoly poly = {};
+    poly[1] = 1.0;
+    return poly;
+}
+
+// Внести перевод единицы unit в градусы Цельсия в коэффициенты полинома
+inline bool foldUnit(const std::string& unit, CalibrationPoly& poly) {
+    double scale = 1.0, shift = 0.0;
+    if (unit == "C") {
+        return true;
+    } else if (unit == "F") {
+        scale = 5.0 / 9.0;
+        shift = -32.0 * 5.0 / 9.0;
+    } else if (unit == "K") {
+        shift = -273.15;
+    } else {
+        return false;
+    }
+    for (auto& c : poly)
+        c *= scale;
+    poly[0] += shift;
+    return true;
+}
+
+class CalibrationTable {
+public:
+    // Загрузка таблицы из файла; описания ошибочных строк добавляются в errors,
+    // nullptr - если файл не открылся
+    static std::shared_ptr<const CalibrationTable> Load(const std::string& file_name, std::string& errors) {
+        auto table = std::make_shared<CalibrationTable>();
+        std::ifstream file(file_name);
+        if (!file.is_open()) {
+            errors += "Failed to open calibration file: " + file_name + "\n";
+            return nullptr;
+        }
+        std::string line;
+        int line_no = 0;
+        while (std::getline(file, line)) {
+            line_no++;
+            size_t hash_pos = line.find('#');
+            if (hash_pos != std::string::npos)
+                line.erase(hash_pos);
+            if (line.find_first_not_of(" \t\r") == std::string::npos)
+                continue;
+
+            std::istringstream ss(line);
+            uint32_t channel = 0;
+            std::string unit;
+            CalibrationPoly poly = {};
+            int degree = -1;
+            double c = 0.0;
+            ss >> channel >> unit;
+            while (!ss.fail() && degree < CALIBRATION_MAX_DEGREE && ss >> c)
+                poly[++degree] = c;
+            if (degree < 0 || !foldUnit(unit, poly) || !(ss >> std::ws).eof()) {
+                errors += file_name + ":" + std::to_string(line_no) + ": invalid calibration '" + line + "'\n";
+                continue;
+            }
+            table->_polys[channel] = poly;
+        }
+        return table;
+    }
+
+    // Полином канала
+    const CalibrationPoly& Poly(uint32_t channel) const {
+        auto it = _polys.find(channel);
+        return (it != _polys.end()) ? it->second : _identity;
+    }
+
+    // Есть ли у канала своя калибровка
+    bool Has(uint32_t channel) const {
+        return _polys.count(channel) != 0;
+    }
+
+    bool Empty() const {
+        return _polys.empty();
+    }
+
+    // Откалибровать пачку: out[i] = p_channel[i](raw[i]); out может совпадать с raw
+    void Apply(const uint32_t* channels, const double* raw, double* out, size_t n) const {
+        if (_polys.empty()) {
+            if (out != raw)
+                std::copy(raw, raw + n, out);
+            return;
+        }
+        // Столбцы коэффициентов по степеням; поиск канала кэшируется для серий одного канала
+        std::vector<double> coeffs((CALIBRATION_MAX_DEGREE + 1) * n);
+        const CalibrationPoly* poly = nullptr;
+        uint32_t last_channel = 0;
+        for (size_t i = 0; i < n; i++) {
+            if (!poly || channels[i] != last_channel) {
+                poly = &Poly(channels[i]);
+                last_channel = channels[i];
+            }
+            for (int d = 0; d <= CALIBRATION_MAX_DEGREE; d++)
+                coeffs[d * n + i] = (*poly)[d];
+        }
+        // Схема Горнера по всей пачке
+        std::vector<double> x(raw, raw + n);
+        const double* top = &coeffs[CALIBRATION_MAX_DEGREE * n];
+        for (size_t i = 0; i < n; i++)
+            out[i] = top[i];
+        for (int d = CALIBRATION_MAX_DEGREE - 1; d >= 0; d--) {
+            const double* c = &coeffs[d * n];
+            for (size_t i = 0; i < n; i++)
+                out[i] = out[i] * x[i] + c[i];
+        }
+    }
+
+private:
+    std::unordered_map<uint32_t, CalibrationPoly> _polys;
+    CalibrationPoly _identity = identityPoly();
+};
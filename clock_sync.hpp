@@ -0,0 +1,92 @@
+#pragma once
+
+// Оценка расхождения часов устройства и хоста.
+//
+// Устройство присылает собственное время, хост - время прихода строки, которое
+// зашумлено задержками USB и планировщика. Зависимость host = offset + skew * device
+// оценивается онлайн взвешенной линейной регрессией с экспоненциальным
+// забыванием: на каждый отсчёт O(1) операций и пять сумм состояния. Для
+// точности суммы считаются относительно первой пары времён. Скачок часов
+// устройства (перезагрузка, перевод) больше CLOCK_RESET_MS сбрасывает оценку.
+
+#include <cmath>
+#include <cstdint>
+
+const double CLOCK_FORGETTING_DEFAULT = 0.999;  // Вес прошлого на каждом отсчёте (~1000 отсчётов памяти)
+const int64_t CLOCK_RESET_MS = 5 * 1000;        // Невязка, после которой оценка начинается заново
+const double CLOCK_MIN_SPAN_MS = 1000.0;        // Минимальный разброс времени для оценки наклона
+
+class ClockSync {
+public:
+    explicit ClockSync(double forgetting = CLOCK_FORGETTING_DEFAULT)
+        : _forgetting(forgetting) {
+        Reset();
+    }
+
+    void Reset() {
+        _samples = 0;
+        _s = _sx = _sy = _sxx = _sxy = 0.0;
+        _device0 = _host0 = 0;
+        _skew = 1.0;
+        _offset = 0.0;
+    }
+
+    // Учесть пару (время устройства, время прихода на хост)
+    void Update(int64_t device_ms, int64_t host_ms) {
+        if (_samples > 0 && std::fabs(Residual(device_ms, host_ms)) > CLOCK_RESET_MS)
+            Reset();
+        if (_samples == 0) {
+            _device0 = device_ms;
+            _host0 = host_ms;
+        }
+        double x = (double)(device_ms - _device0);
+        double y = (double)(host_ms - _host0);
+        _s = _forgetting * _s + 1.0;
+        _sx = _forgetting * _sx + x;
+        _sy = _forgetting * _sy + y;
+        _sxx = _forgetting * _sxx + x * x;
+        _sxy = _forgetting * _sxy + x * y;
+        _samples++;
+
+        // Наклон оцениваем, только когда время устройства заметно разошлось
+        double var_x = _sxx / _s - (_sx / _s) * (_sx / _s);
+        if (var_x > CLOCK_MIN_SPAN_MS * CLOCK_MIN_SPAN_MS)
+            _skew = (_sxy / _s - (_sx / _s) * (_sy / _s)) / var_x;
+        _offset = _sy / _s - _skew * _sx / _s;
+    }
+
+    // Время устройства -> время хоста
+    int64_t ToHost(int64_t device_ms) const {
+        if (_samples == 0)
+            return device_ms;
+        return _host0 + (int64_t)std::llround(_offset + _skew * (double)(device_ms - _device0));
+    }
+
+    // Отклонение хода часов устройства от хоста в миллионных долях
+    // (положительное - часы устройства спешат)
+    double SkewPpm() const {
+        return (1.0 / _skew - 1.0) * 1e6;
+    }
+
+    // Смещение host - device в миллисекундах в центре окна оценки
+    double OffsetMs() const {
+        double mean_x = (_s > 0.0) ? _sx / _s : 0.0;
+        return (double)(_host0 - _device0) + _offset + (_skew - 1.0) * mean_x;
+    }
+
+    uint64_t Samples() const {
+        return _samples;
+    }
+
+private:
+    double Residual(int64_t device_ms, int64_t host_ms) const {
+        return (double)(host_ms - ToHost(device_ms));
+    }
+
+    double _forgetting;
+    uint64_t _samples;
+    double _s, _sx, _sy, _sxx, _sxy;  // Взвешенные суммы относительно (_device0, _host0)
+    int64_t _device0, _host0;
+    double _skew;
+    double _offset;
+};
@@ -0,0 +1,298 @@
+#pragma once
+
+// Потоковые ковариации и корреляции внутри групп каналов.
+//
+// Отсчёты каждого канала группы усредняются по общим бакетам выравнивания
+// (роллап по времени событий), так что каналы с разной частотой и сдвигом
+// опроса сравниваются в одни и те же моменты. Закрытый бакет выравнивания
+// добавляет средние каналов в достаточные статистики каждой пары, где есть
+// оба значения: число, суммы, суммы квадратов и произведений. Статистики
+// копятся по бакетам статистики (по умолчанию час), объединяются простым
+// сложением и дописываются в файл "corr_<группа>.moments", так что ковариации
+// и корреляции за любой диапазон считаются по нескольким строкам файла без
+// чтения отсчётов.
+//
+// Формат файла групп: строки "<имя> <каналы через запятую> <бакет выравнивания в секундах>
+// [<бакет статистики в секундах>]", '#' - комментарий. Например:
+//   room_a 1,2,3 60
+//   freezers 7,8 300 86400
+
+#include "rollup.hpp"
+#include <map>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <sstream>
+#include <fstream>
+#include <limits>
+#include <cstdint>
+#include <algorithm>
+
+const int64_t CORRELATION_STATS_MS_DEFAULT = 60 * 60 * 1000; // Бакет статистики по умолчанию (час)
+
+// Достаточные статистики пары рядов (x, y)
+struct PairMoments {
+    uint64_t n = 0;
+    double sx = 0.0;
+    double sy = 0.0;
+    double sxx = 0.0;
+    double syy = 0.0;
+    double sxy = 0.0;
+
+    void Add(double x, double y) {
+        n++;
+        sx += x;
+        sy += y;
+        sxx += x * x;
+        syy += y * y;
+        sxy += x * y;
+    }
+
+    void Merge(const PairMoments& other) {
+        n += other.n;
+        sx += other.sx;
+        sy += other.sy;
+        sxx += other.sxx;
+        syy += other.syy;
+        sxy += other.sxy;
+    }
+
+    // Выборочная ковариация; 0 - меньше двух общих точек
+    double Covariance() const {
+        return (n > 1) ? (sxy - sx * sy / n) / (n - 1) : 0.0;
+    }
+
+    // Корреляция Пирсона; NaN - меньше двух общих точек или один из рядов постоянен
+    double Correlation() const {
+        if (n < 2)
+            return std::nan("");
+        double vx = sxx - sx * sx / n;
+        double vy = syy - sy * sy / n;
+        if (vx <= 0.0 || vy <= 0.0)
+            return std::nan("");
+        return std::max(-1.0, std::min(1.0, (sxy - sx * sy / n) / std::sqrt(vx * vy)));
+    }
+};
+
+// Пары каналов группы из k каналов - верхний треугольник матрицы по строкам
+inline size_t pairCount(size_t k) {
+    return k * (k - 1) / 2;
+}
+
+inline size_t pairIndex(size_t i, size_t j, size_t k) {
+    if (i > j)
+        std::swap(i, j);
+    return i * k - i * (i + 1) / 2 + (j - i - 1);
+}
+
+struct CorrelationGroupDefinition {
+    std::string name;
+    std::vector<uint32_t> channels;
+    int64_t align_ms = 0;
+    int64_t stats_ms = CORRELATION_STATS_MS_DEFAULT;
+};
+
+// Загрузка групп; описания ошибочных строк добавляются в errors
+inline bool loadCorrelationGroups(const std::string& file_name, std::vector<CorrelationGroupDefinition>& groups,
+                                  std::string& errors) {
+    std::ifstream file(file_name);
+    if (!file.is_open()) {
+        errors += "Failed to open correlation config: " + file_name + "\n";
+        return false;
+    }
+    std::string line;
+    int line_no = 0;
+    while (std::getline(file, line)) {
+        line_no++;
+        size_t hash_pos = line.find('#');
+        if (hash_pos != std::string::npos)
+            line.erase(hash_pos);
+        std::istringstream ss(line);
+        CorrelationGroupDefinition group;
+        std::string channels;
+        double align_sec = 0.0, stats_sec = 0.0;
+        if (!(ss >> group.name))
+            continue;
+        bool ok = static_cast<bool>(ss >> channels >> align_sec) && align_sec > 0.0;
+        group.align_ms = (int64_t)(align_sec * 1000);
+        if (ss >> stats_sec)
+            group.stats_ms = (int64_t)(stats_sec * 1000);
+        ok = ok && group.stats_ms >= group.align_ms;
+        std::istringstream list(channels);
+        std::string channel;
+        while (ok && std::getline(list, channel, ',')) {
+            ok = !channel.empty() && channel.find_first_not_of("0123456789") == std::string::npos;
+            if (ok)
+                group.channels.push_back((uint32_t)std::stoul(channel));
+        }
+        if (!ok || group.channels.size() < 2) {
+            errors += file_name + ":" + std::to_string(line_no) + ": invalid correlation group '" + line + "'\n";
+            continue;
+        }
+        groups.push_back(group);
+    }
+    return true;
+}
+
+// Статистики пар группы за один бакет статистики
+struct MomentsBucket {
+    int64_t start_ms = 0;
+    std::vector<PairMoments> pairs;
+};
+
+inline std::string momentsFileName(const std::string& group_name) {
+    return "corr_" + group_name + ".moments";
+}
+
+// Дописать бакеты в файл статистик: строки "<начало> <k> <каналы...> <n sx sy sxx syy sxy>..."
+inline bool appendMoments(const std::string& file_name, const std::vector<uint32_t>& channels,
+                          const std::vector<MomentsBucket>& buckets) {
+    if (buckets.empty())
+        return true;
+    std::ofstream file(file_name, std::ios::app);
+    if (!file.is_open())
+        return false;
+    file.precision(17);
+    for (const auto& bucket : buckets) {
+        file << bucket.start_ms << ' ' << channels.size();
+        for (uint32_t channel : channels)
+            file << ' ' << channel;
+        for (const auto& pair : bucket.pairs)
+            file << ' ' << pair.n << ' ' << pair.sx << ' ' << pair.sy << ' ' << pair.sxx << ' ' << pair.syy
+                 << ' ' << pair.sxy;
+        file << '\n';
+    }
+    return true;
+}
+
+// Объединить статистики бакетов с началом в [from_ms, to_ms]. Учитываются строки
+// с тем же составом каналов, что и у последней подходящей строки (группа могла
+// меняться). false - файла нет.
+inline bool loadMoments(const std::string& file_name, int64_t from_ms, int64_t to_ms,
+                        std::vector<uint32_t>& channels, std::vector<PairMoments>& merged, size_t& buckets) {
+    std::ifstream file(file_name);
+    if (!file.is_open())
+        return false;
+    std::vector<MomentsBucket> selected;
+    std::vector<std::vector<uint32_t>> selected_channels;
+    std::string line;
+    while (std::getline(file, line)) {
+        std::istringstream ss(line);
+        MomentsBucket bucket;
+        size_t k = 0;
+        if (!(ss >> bucket.start_ms >> k) || k < 2 || bucket.start_ms < from_ms || bucket.start_ms > to_ms)
+            continue;
+        std::vector<uint32_t> line_channels(k);
+        for (auto& channel : line_channels)
+            ss >> channel;
+        bucket.pairs.resize(pairCount(k));
+        for (auto& pair : bucket.pairs)
+            ss >> pair.n >> pair.sx >> pair.sy >> pair.sxx >> pair.syy >> pair.sxy;
+        if (!ss)
+            continue;
+        selected.push_back(bucket);
+        selected_channels.push_back(line_channels);
+    }
+
+    channels.clear();
+    merged.clear();
+    buckets = 0;
+    if (selected.empty())
+        return true;
+    channels = selected_channels.back();
+    merged.resize(pairCount(channels.size()));
+    for (size_t b = 0; b < selected.size(); b++) {
+        if (selected_channels[b] != channels)
+            continue;
+        for (size_t p = 0; p < merged.size(); p++)
+            merged[p].Merge(selected[b].pairs[p]);
+        buckets++;
+    }
+    return true;
+}
+
+class CorrelationGroup {
+public:
+    CorrelationGroup(const CorrelationGroupDefinition& definition, int64_t allowed_lateness_ms)
+        : _definition(definition) {
+        for (size_t c = 0; c < _definition.channels.size(); c++)
+            _rollups.emplace_back(_definition.align_ms, allowed_lateness_ms);
+    }
+
+    const CorrelationGroupDefinition& Definition() const {
+        return _definition;
+    }
+
+    // Номер канала в группе; -1 - канал в группу не входит
+    int IndexOf(uint32_t channel) const {
+        auto it = std::find(_definition.channels.begin(), _definition.channels.end(), channel);
+        return (it == _definition.channels.end()) ? -1 : (int)(it - _definition.channels.begin());
+    }
+
+    void Add(int index, int64_t time_ms, double value, uint8_t flags) {
+        _rollups[index].Add(time_ms, value, flags);
+    }
+
+    // Закрыть бакеты выравнивания до watermark_ms и учесть их в статистиках пар.
+    // Исправления опоздавшими отсчётами в статистики не попадают. Бакет учитывается,
+    // когда его закрыли роллапы всех каналов: роллап держит бакет за водяным знаком
+    // открытым, пока интеграл не дошёл до его конца.
+    void AdvanceWatermark(int64_t watermark_ms) {
+        size_t k = _definition.channels.size();
+        int64_t ready_ms = watermark_ms;
+        for (size_t c = 0; c < k; c++) {
+            _rollups[c].AdvanceWatermark(watermark_ms);
+            for (const auto& bucket : _rollups[c].TakeFinalized()) {
+                // Бакет, уже учтённый в статистиках, второй раз не учитывается
+                if (bucket.partial.count == 0 || bucket.start_ms <= _processed_ms)
+                    continue;
+                auto& means = _pending[bucket.start_ms];
+                means.resize(k, std::nan(""));
+                means[c] = bucket.partial.Average();
+            }
+            _rollups[c].TakeCorrections();
+            ready_ms = std::min(ready_ms, _rollups[c].FinalizedThrough());
+        }
+
+        while (!_pending.empty() && _pending.begin()->first + _definition.align_ms <= ready_ms) {
+            const auto& means = _pending.begin()->second;
+            auto& pairs = _open[alignTime(_pending.begin()->first, _definition.stats_ms)];
+            pairs.resize(pairCount(k));
+            for (size_t i = 0; i < k; i++) {
+                for (size_t j = i + 1; j < k; j++) {
+                    if (!std::isnan(means[i]) && !std::isnan(means[j]))
+                        pairs[pairIndex(i, j, k)].Add(means[i], means[j]);
+                }
+            }
+            _processed_ms = _pending.begin()->first;
+            _pending.erase(_pending.begin());
+        }
+
+        while (!_open.empty() && _open.begin()->first + _definition.stats_ms <= ready_ms) {
+            _closed.push_back(MomentsBucket{_open.begin()->first, _open.begin()->second});
+            _last = _closed.back();
+            _open.erase(_open.begin());
+        }
+    }
+
+    // Забрать закрытые бакеты статистики
+    std::vector<MomentsBucket> TakeClosed() {
+        std::vector<MomentsBucket> result;
+        result.swap(_closed);
+        return result;
+    }
+
+    // Последний закрытый бакет статистики (пары пусты, если его ещё нет)
+    const MomentsBucket& Last() const {
+        return _last;
+    }
+
+private:
+    CorrelationGroupDefinition _definition;
+    std::vector<EventTimeRollup> _rollups;               // Выравнивание по каналам группы
+    std::map<int64_t, std::vector<double>> _pending;     // Бакет выравнивания -> средние каналов (NaN - нет)
+    int64_t _processed_ms = std::numeric_limits<int64_t>::min(); // Последний учтённый бакет выравнивания
+    std::map<int64_t, std::vector<PairMoments>> _open;   // Открытые бакеты статистики
+    std::vector<MomentsBucket> _closed;
+    MomentsBucket _last;
+};
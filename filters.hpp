@@ -0,0 +1,192 @@
+#pragma once
+
+// Потоковые фильтры выбросов по каналам.
+//
+// Проверка диапазона отсекает физически невозможные значения ("-999", 85.0 у
+// DS18B20 при включении, если он вне рабочего диапазона). Фильтр Хампеля
+// сравнивает отсчёт с медианой последних window отсчётов канала и отбрасывает
+// его, если отклонение больше k * 1.4826 * MAD (медианы абсолютных отклонений).
+// Медианы поддерживаются двумя мультимножествами (O(log w) на отсчёт), MAD -
+// такой же бегущей медианой отклонений, вычисленных при поступлении отсчётов.
+// Память на канал фиксирована и пропорциональна window.
+//
+// Формат файла: строки "<канал|*> range <min> <max>" и
+// "<канал|*> hampel <window> <k> [<мин. отклонение>]", '#' - комментарий.
+
+#include <set>
+#include <map>
+#include <deque>
+#include <cmath>
+#include <string>
+#include <iterator>
+#include <algorithm>
+#include <sstream>
+#include <fstream>
+#include <cstdint>
+
+const double HAMPEL_K_DEFAULT = 3.0;          // Порог в единицах MAD
+const double HAMPEL_MIN_DEVIATION = 0.5;      // Минимальный порог отклонения (для почти постоянного сигнала)
+const size_t HAMPEL_MIN_SAMPLES = 3;          // Сколько отсчётов нужно до начала отбраковки
+const double MAD_SCALE = 1.4826;              // MAD -> стандартное отклонение для нормального шума
+
+// Бегущая медиана последних window значений
+class RunningMedian {
+public:
+    explicit RunningMedian(size_t window)
+        : _window(window < 1 ? 1 : window) {}
+
+    void Push(double value) {
+        if (_fifo.size() == _window) {
+            Erase(_fifo.front());
+            _fifo.pop_front();
+        }
+        _fifo.push_back(value);
+        if (_low.empty() || value <= *_low.rbegin())
+            _low.insert(value);
+        else
+            _high.insert(value);
+        Rebalance();
+    }
+
+    double Median() const {
+        if (_low.empty())
+            return 0.0;
+        if (_low.size() > _high.size())
+            return *_low.rbegin();
+        return (*_low.rbegin() + *_high.begin()) / 2.0;
+    }
+
+    size_t Size() const {
+        return _fifo.size();
+    }
+
+private:
+    void Erase(double value) {
+        if (!_low.empty() && value <= *_low.rbegin())
+            _low.erase(_low.find(value));
+        else
+            _high.erase(_high.find(value));
+        Rebalance();
+    }
+
+    // Нижняя половина равна верхней или больше её на один элемент
+    void Rebalance() {
+        if (_low.size() > _high.size() + 1) {
+            auto it = std::prev(_low.end());
+            _high.insert(*it);
+            _low.erase(it);
+        } else if (_high.size() > _low.size()) {
+            _low.insert(*_high.begin());
+            _high.erase(_high.begin());
+        }
+    }
+
+    size_t _window;
+    std::deque<double> _fifo;
+    std::multiset<double> _low;   // Меньшая половина
+    std::multiset<double> _high;  // Большая половина
+};
+
+// Настройки фильтров канала
+struct FilterSettings {
+    bool range = false;
+    double min = 0.0;
+    double max = 0.0;
+    size_t hampel_window = 0;  // 0 - фильтр Хампеля выключен
+    double hampel_k = HAMPEL_K_DEFAULT;
+    double hampel_min_deviation = HAMPEL_MIN_DEVIATION;
+};
+
+// Настройки фильтров всех каналов ("*" - для каналов без своих настроек)
+class FilterConfig {
+public:
+    bool Load(const std::string& file_name, std::string& errors) {
+        std::ifstream file(file_name);
+        if (!file.is_open()) {
+            errors += "Failed to open filter config: " + file_name + "\n";
+            return false;
+        }
+        std::string line;
+        int line_no = 0;
+        while (std::getline(file, line)) {
+            line_no++;
+            size_t hash_pos = line.find('#');
+            if (hash_pos != std::string::npos)
+                line.erase(hash_pos);
+            std::istringstream ss(line);
+            std::string channel, kind;
+            if (!(ss >> channel))
+                continue;
+            if (channel != "*" && channel.find_first_not_of("0123456789") != std::string::npos) {
+                errors += file_name + ":" + std::to_string(line_no) + ": invalid channel '" + channel + "'\n";
+                continue;
+            }
+            FilterSettings& settings = (channel == "*") ? _all : _channels[(uint32_t)std::stoul(channel)];
+            if (channel == "*")
+                _has_all = true;
+            bool ok = false;
+            if (ss >> kind) {
+                if (kind == "range") {
+                    ok = static_cast<bool>(ss >> settings.min >> settings.max);
+                    settings.range = ok;
+                } else if (kind == "hampel") {
+                    ok = static_cast<bool>(ss >> settings.hampel_window >> settings.hampel_k);
+                    double min_deviation = 0.0;
+                    if (ok && ss >> min_deviation)
+                        settings.hampel_min_deviation = min_deviation;
+                }
+            }
+            if (!ok)
+                errors += file_name + ":" + std::to_string(line_no) + ": invalid filter '" + line + "'\n";
+        }
+        return true;
+    }
+
+    // Настройки канала; nullptr - канал не фильтруется
+    const FilterSettings* For(uint32_t channel) const {
+        auto it = _channels.find(channel);
+        if (it != _channels.end())
+            return &it->second;
+        return _has_all ? &_all : nullptr;
+    }
+
+private:
+    std::map<uint32_t, FilterSettings> _channels;
+    FilterSettings _all;
+    bool _has_all = false;
+};
+
+// Состояние фильтров одного канала
+class SampleFilter {
+public:
+    explicit SampleFilter(const FilterSettings& settings)
+        : _settings(settings), _median(settings.hampel_window), _deviation(settings.hampel_window) {}
+
+    // false - отсчёт признан выбросом
+    bool Accept(double value) {
+        if (!std::isfinite(value))
+            return false;
+        if (_settings.range && (value < _settings.min || value > _settings.max))
+            return false;
+        if (_settings.hampel_window == 0)
+            return true;
+
+        // Отсчёт сравнивается с окном предыдущих, а затем сам входит в окно,
+        // чтобы медиана успевала за реальным скачком уровня
+        bool accept = true;
+        double median = _median.Median();
+        if (_median.Size() >= HAMPEL_MIN_SAMPLES) {
+            double threshold = std::max(_settings.hampel_k * MAD_SCALE * _deviation.Median(),
+                                        _settings.hampel_min_deviation);
+            accept = std::fabs(value - median) <= threshold;
+        }
+        _median.Push(value);
+        _deviation.Push(std::fabs(value - _median.Median()));
+        return accept;
+    }
+
+private:
+    FilterSettings _settings;
+    RunningMedian _median;
+    RunningMedian _deviation;
+};
@@ -0,0 +1,288 @@
+#pragma once
+
+// Прогноз по методу Хольта-Винтерса (аддитивный) и правила предупреждений
+// о предсказанном выходе за границу.
+//
+// Модель обновляется одним закрытым бакетом за O(1): уровень, тренд и
+// сезонная поправка для времени суток бакета. Первые сутки только копят
+// наблюдения, по ним задаются начальные уровень и сезонность. Пропущенные
+// бакеты продлевают уровень трендом; пропуск длиннее сезона сбрасывает модель.
+// Прогноз на h бакетов вперёд - уровень + h * тренд + сезонная поправка, его
+// интервал строится по дисперсии ошибок прогноза на шаг вперёд с обычным для
+// аддитивной модели ростом по горизонту. Состояние сохраняется в файл, так что
+// прогноз можно запросить без процесса приёма и без чтения истории.
+//
+// Формат файла правил: строки "<каналы|*> above|below <граница> <горизонт в секундах>",
+// каналы - через запятую, '#' - комментарий. Например:
+//   3,4 above 8 7200
+//   * below -25 3600
+
+#include "log_format.hpp"
+#include <set>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <sstream>
+#include <fstream>
+#include <cstdint>
+#include <cstdlib>
+#include <algorithm>
+
+const int64_t FORECAST_BUCKET_MS_DEFAULT = 15 * 60 * 1000; // Бакет модели (15 минут)
+const int64_t FORECAST_SEASON_MS = 24 * 60 * 60 * 1000LL;  // Сезон - сутки
+const double HOLT_WINTERS_ALPHA = 0.3;   // Сглаживание уровня
+const double HOLT_WINTERS_BETA = 0.05;   // Сглаживание тренда
+const double HOLT_WINTERS_GAMMA = 0.1;   // Сглаживание сезонности
+const int FORECAST_ERROR_WINDOW = 200;   // Память дисперсии ошибок (бакетов)
+const double FORECAST_INTERVAL_Z = 1.96; // Интервал прогноза 95%
+
+// Прогноз на один бакет вперёд и его интервал
+struct Forecast {
+    double value = 0.0;
+    double low = 0.0;
+    double high = 0.0;
+};
+
+class HoltWinters {
+public:
+    explicit HoltWinters(int64_t bucket_ms = FORECAST_BUCKET_MS_DEFAULT)
+        : _bucket_ms(std::max<int64_t>(1, bucket_ms)) {
+        _seasons.resize((size_t)std::max<int64_t>(1, FORECAST_SEASON_MS / _bucket_ms));
+        Reset();
+    }
+
+    int64_t BucketMs() const {
+        return _bucket_ms;
+    }
+
+    // Модель набрала сезон наблюдений и может прогнозировать
+    bool Ready() const {
+        return _ready;
+    }
+
+    // Начало последнего учтённого бакета
+    int64_t LastBucket() const {
+        return _last_ms;
+    }
+
+    // Среднее закрытого бакета, начинающегося в start_ms; бакеты - по возрастанию
+    void Add(int64_t start_ms, double value) {
+        if (_observed > 0 && start_ms <= _last_ms)
+            return;
+        int64_t steps = (_observed > 0) ? (start_ms - _last_ms) / _bucket_ms : 0;
+        if (steps > (int64_t)_seasons.size())
+            Reset();
+
+        size_t slot = SlotOf(start_ms);
+        if (!_ready) {
+            if (_observed == 0)
+                _first_ms = start_ms;
+            _seasons[slot] = value;
+            _last_ms = start_ms;
+            _observed++;
+            if (start_ms + _bucket_ms - _first_ms >= FORECAST_SEASON_MS)
+                Initialize();
+            return;
+        }
+
+        for (int64_t i = 1; i < steps; i++)
+            _level += _trend;
+        double error = value - (_level + _trend + _seasons[slot]);
+        _error_count = std::min(_error_count + 1, FORECAST_ERROR_WINDOW);
+        _error_var += (error * error - _error_var) / _error_count;
+
+        double level = HOLT_WINTERS_ALPHA * (value - _seasons[slot]) + (1.0 - HOLT_WINTERS_ALPHA) * (_level + _trend);
+        _trend = HOLT_WINTERS_BETA * (level - _level) + (1.0 - HOLT_WINTERS_BETA) * _trend;
+        _seasons[slot] = HOLT_WINTERS_GAMMA * (value - level) + (1.0 - HOLT_WINTERS_GAMMA) * _seasons[slot];
+        _level = level;
+        _last_ms = start_ms;
+        _observed++;
+    }
+
+    // Прогноз на steps бакетов после последнего учтённого:
+    // f(начало бакета, прогноз); f возвращает false, чтобы остановиться
+    template<class F>
+    void Project(int64_t steps, F f) const {
+        if (!_ready)
+            return;
+        double spread = 0.0; // Сумма квадратов вкладов прошлых ошибок в ошибку на шаге h
+        for (int64_t h = 1; h <= steps; h++) {
+            if (h > 1) {
+                int64_t j = h - 1;
+                double c = HOLT_WINTERS_ALPHA * (1.0 + j * HOLT_WINTERS_BETA) +
+                           ((j % (int64_t)_seasons.size() == 0) ? HOLT_WINTERS_GAMMA : 0.0);
+                spread += c * c;
+            }
+            int64_t start_ms = _last_ms + h * _bucket_ms;
+            Forecast forecast;
+            forecast.value = _level + h * _trend + _seasons[SlotOf(start_ms)];
+            double half = FORECAST_INTERVAL_Z * std::sqrt(_error_var * (1.0 + spread));
+            forecast.low = forecast.value - half;
+            forecast.high = forecast.value + half;
+            if (!f(start_ms, forecast))
+                return;
+        }
+    }
+
+    // Прогноз на бакет, в который попадает время last + horizon_ms
+    bool ProjectAt(int64_t horizon_ms, Forecast& result) const {
+        int64_t steps = std::max<int64_t>(1, (horizon_ms + _bucket_ms - 1) / _bucket_ms);
+        bool found = false;
+        Project(steps, [&](int64_t, const Forecast& forecast) {
+            result = forecast;
+            found = true;
+            return true;
+        });
+        return found;
+    }
+
+    // Сохранение состояния: "holt-winters <бакет> <сезонов> <последний бакет> <уровень> <тренд>
+    // <дисперсия ошибок> <ошибок> <наблюдений> <первый бакет> <готова>", затем сезонные поправки
+    bool Save(const std::string& file_name) const {
+        std::string tmp_name = file_name + ".tmp";
+        {
+            std::ofstream file(tmp_name, std::ios::trunc);
+            if (!file.is_open())
+                return false;
+            file.precision(17);
+            file << "holt-winters " << _bucket_ms << " " << _seasons.size() << " " << _last_ms << " "
+                 << _level << " " << _trend << " " << _error_var << " " << _error_count << " "
+                 << _observed << " " << _first_ms << " " << (_ready ? 1 : 0) << "\n";
+            for (size_t i = 0; i < _seasons.size(); i++)
+                file << _seasons[i] << ((i + 1 < _seasons.size()) ? " " : "\n");
+        }
+        return std::rename(tmp_name.c_str(), file_name.c_str()) == 0;
+    }
+
+    // Загрузка состояния (вместе с размером бакета); false, если файла нет или он испорчен
+    bool Load(const std::string& file_name) {
+        std::ifstream file(file_name);
+        std::string magic;
+        int64_t bucket_ms = 0;
+        size_t season_count = 0;
+        if (!(file >> magic >> bucket_ms >> season_count) || magic != "holt-winters" || bucket_ms <= 0)
+            return false;
+        HoltWinters loaded(bucket_ms);
+        int ready = 0;
+        if (season_count != loaded._seasons.size() ||
+            !(file >> loaded._last_ms >> loaded._level >> loaded._trend >> loaded._error_var
+                   >> loaded._error_count >> loaded._observed >> loaded._first_ms >> ready))
+            return false;
+        // До конца первого сезона ненаблюдённые слоты - "nan", его разбирает только strtod
+        std::string token;
+        for (auto& season : loaded._seasons) {
+            if (!(file >> token))
+                return false;
+            season = std::strtod(token.c_str(), nullptr);
+        }
+        loaded._ready = (ready != 0);
+        *this = loaded;
+        return true;
+    }
+
+private:
+    // Сезонный слот бакета по местному времени суток
+    size_t SlotOf(int64_t start_ms) const {
+        std::tm tm = localTime((std::time_t)(start_ms / 1000));
+        int64_t ms_of_day = ((tm.tm_hour * 60 + tm.tm_min) * 60 + tm.tm_sec) * 1000LL + start_ms % 1000;
+        return (size_t)(ms_of_day / _bucket_ms) % _seasons.size();
+    }
+
+    void Reset() {
+        std::fill(_seasons.begin(), _seasons.end(), std::nan(""));
+        _level = _trend = _error_var = 0.0;
+        _error_count = 0;
+        _observed = 0;
+        _first_ms = _last_ms = 0;
+        _ready = false;
+    }
+
+    // Начальные уровень и сезонность по первому сезону наблюдений
+    void Initialize() {
+        double sum = 0.0;
+        size_t count = 0;
+        for (double season : _seasons) {
+            if (!std::isnan(season)) {
+                sum += season;
+                count++;
+            }
+        }
+        _level = (count > 0) ? sum / count : 0.0;
+        for (auto& season : _seasons)
+            season = std::isnan(season) ? 0.0 : season - _level;
+        _ready = true;
+    }
+
+    int64_t _bucket_ms;
+    std::vector<double> _seasons; // Сезонные поправки по слотам суток
+    double _level;
+    double _trend;
+    double _error_var;            // Дисперсия ошибок прогноза на шаг вперёд
+    int _error_count;
+    uint64_t _observed;
+    int64_t _first_ms;
+    int64_t _last_ms;
+    bool _ready;
+};
+
+// Правило: предупредить, если прогноз на горизонте выйдет за границу
+struct ForecastAlertRule {
+    bool all_channels = false;
+    std::set<uint32_t> channels;
+    bool above = true;
+    double limit = 0.0;
+    int64_t horizon_ms = 0;
+
+    bool Matches(uint32_t channel) const {
+        return all_channels || channels.count(channel) != 0;
+    }
+
+    bool Breached(double value) const {
+        return above ? value > limit : value < limit;
+    }
+};
+
+// Загрузка правил предупреждений; описания ошибочных строк добавляются в errors
+inline bool loadForecastAlerts(const std::string& file_name, std::vector<ForecastAlertRule>& rules,
+                               std::string& errors) {
+    std::ifstream file(file_name);
+    if (!file.is_open()) {
+        errors += "Failed to open forecast alert config: " + file_name + "\n";
+        return false;
+    }
+    std::string line;
+    int line_no = 0;
+    while (std::getline(file, line)) {
+        line_no++;
+        size_t hash_pos = line.find('#');
+        if (hash_pos != std::string::npos)
+            line.erase(hash_pos);
+        std::istringstream ss(line);
+        ForecastAlertRule rule;
+        std::string channels, direction;
+        double horizon_sec = 0.0;
+        if (!(ss >> channels))
+            continue;
+        bool ok = static_cast<bool>(ss >> direction >> rule.limit >> horizon_sec) && horizon_sec > 0.0 &&
+                  (direction == "above" || direction == "below");
+        rule.above = (direction == "above");
+        rule.horizon_ms = (int64_t)(horizon_sec * 1000);
+        if (ok && channels == "*") {
+            rule.all_channels = true;
+        } else if (ok) {
+            std::istringstream list(channels);
+            std::string channel;
+            while (ok && std::getline(list, channel, ',')) {
+                ok = !channel.empty() && channel.find_first_not_of("0123456789") == std::string::npos;
+                if (ok)
+                    rule.channels.insert((uint32_t)std::stoul(channel));
+            }
+        }
+        if (!ok) {
+            errors += file_name + ":" + std::to_string(line_no) + ": invalid forecast alert '" + line + "'\n";
+            continue;
+        }
+        rules.push_back(rule);
+    }
+    return true;
+}
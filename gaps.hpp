@@ -0,0 +1,236 @@
+#pragma once
+
+// Индекс пробелов (пропусков данных) канала.
+//
+// Ожидаемый период отсчётов задаётся явно или оценивается медианой последних
+// интервалов между отсчётами. Интервал длиннее GAP_PERIOD_FACTOR периодов
+// считается пробелом [последний отсчёт + период, следующий отсчёт): временем,
+// когда отсчёт ожидался, но не пришёл. Пока канал молчит (в том числе когда
+// чтение порта возвращается пустым по таймауту), пробел открыт и тянется до
+// текущего времени хоста.
+//
+// Пробелы хранятся в map по началу, поэтому проверка момента и поиск
+// пробелов диапазона стоят O(log n) плюс число найденных пробелов. Закрытые
+// пробелы дописываются в файл рядом с логом ("<лог>.gaps", строки
+// "<начало в мс> <конец в мс>"), так что отчёты о покрытии за месяцы
+// читают небольшой индекс вместо всех отсчётов.
+//
+// Опоздавшие отсчёты (старше последнего) пробелы не закрывают.
+//
+// После перезапуска индекс продолжается с последних отсчётов лога на диске
+// (Resume, для логов фиксированной ширины), так что простой на время
+// перезапуска тоже становится пробелом.
+// Открытый пробел при закрытии дописывается в файл до последнего момента
+// наблюдения; после перезапуска тот же пробел (с тем же началом) дописывается
+// ещё раз до первого нового отсчёта, и при загрузке поздняя запись заменяет
+// раннюю.
+
+#include "filters.hpp"
+#include "log_format.hpp"
+#include <map>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <cstdint>
+#include <algorithm>
+
+const double GAP_PERIOD_FACTOR = 3.0;  // Во сколько раз интервал больше периода, чтобы считаться пробелом
+const size_t GAP_PERIOD_WINDOW = 15;   // Число интервалов для оценки периода
+const int64_t GAP_MIN_PERIOD_MS = 100; // Нижняя граница оценки периода
+const size_t GAP_RESUME_BYTES = 4096;  // Хвост лога, по которому индекс продолжается после перезапуска
+
+// Пробел [start_ms, end_ms)
+struct GapInterval {
+    int64_t start_ms;
+    int64_t end_ms;
+};
+
+// Файл пробелов лога
+inline std::string gapFileName(const std::string& log_file_name) {
+    return log_file_name + ".gaps";
+}
+
+// Время отсчётов из хвоста лога фиксированной ширины (последние max_bytes байт) в порядке строк
+inline std::vector<int64_t> logTailTimes(const std::string& log_file_name, size_t max_bytes = GAP_RESUME_BYTES) {
+    std::vector<int64_t> times;
+    std::ifstream file(log_file_name, std::ios::binary);
+    if (!file.is_open())
+        return times;
+    file.seekg(0, std::ios::end);
+    std::streamoff size = file.tellg();
+    std::streamoff begin = std::max<std::streamoff>(0, size - (std::streamoff)max_bytes);
+    file.seekg(begin);
+    std::string line;
+    if (begin > 0)
+        std::getline(file, line); // Первая строка может быть обрезана
+    while (std::getline(file, line)) {
+        int64_t time_ms = 0;
+        if (parseTimestamp(line, time_ms))
+            times.push_back(time_ms);
+    }
+    return times;
+}
+
+// Дописать пробелы в файл
+inline bool appendGaps(const std::string& file_name, const std::vector<GapInterval>& gaps) {
+    if (gaps.empty())
+        return true;
+    std::ofstream file(file_name, std::ios::app);
+    if (!file.is_open())
+        return false;
+    for (const auto& gap : gaps)
+        file << gap.start_ms << ' ' << gap.end_ms << '\n';
+    return true;
+}
+
+class GapIndex {
+public:
+    // expected_period_ms = 0 - период оценивается по интервалам между отсчётами
+    explicit GapIndex(int64_t expected_period_ms = 0)
+        : _fixed_period_ms(expected_period_ms), _intervals(GAP_PERIOD_WINDOW) {}
+
+    // Загрузить пробелы из файла
+    bool Load(const std::string& file_name) {
+        std::ifstream file(file_name);
+        if (!file.is_open())
+            return false;
+        int64_t start = 0, end = 0;
+        while (file >> start >> end) {
+            if (end > start)
+                _gaps[start] = end;
+        }
+        return true;
+    }
+
+    // Ожидаемый период отсчётов; 0 - ещё неизвестен
+    int64_t ExpectedPeriod() const {
+        if (_fixed_period_ms > 0)
+            return _fixed_period_ms;
+        if (_intervals.Size() < HAMPEL_MIN_SAMPLES)
+            return 0;
+        return std::max<int64_t>(GAP_MIN_PERIOD_MS, (int64_t)_intervals.Median());
+    }
+
+    // Учесть отсчёт с временем time_ms; true - отсчёт закрыл пробел
+    bool Observe(int64_t time_ms) {
+        if (_has_last && time_ms <= _last_ms)
+            return false;
+        bool closed = false;
+        if (_has_last) {
+            int64_t period = ExpectedPeriod();
+            int64_t interval = time_ms - _last_ms;
+            if (period > 0 && interval > GAP_PERIOD_FACTOR * period) {
+                _gaps[_last_ms + period] = time_ms;
+                _new.push_back(GapInterval{_last_ms + period, time_ms});
+                closed = true;
+            } else {
+                _intervals.Push((double)interval); // Пробелы не искажают оценку периода
+            }
+        }
+        _last_ms = time_ms;
+        _now_ms = std::max(_now_ms, time_ms);
+        _has_last = true;
+        return closed;
+    }
+
+    // Продолжить индекс с отсчётов, уже записанных на диск (до первого Observe):
+    // по ним оценивается период, последний из них - начало возможного пробела.
+    // Пробелы между ними уже есть в файле и заново не записываются.
+    void Resume(const std::vector<int64_t>& times) {
+        for (int64_t time_ms : times) {
+            if (_has_last && time_ms <= _last_ms)
+                continue;
+            if (_has_last) {
+                int64_t period = ExpectedPeriod();
+                int64_t interval = time_ms - _last_ms;
+                if (period <= 0 || interval <= GAP_PERIOD_FACTOR * period)
+                    _intervals.Push((double)interval);
+            }
+            _last_ms = time_ms;
+            _now_ms = std::max(_now_ms, time_ms);
+            _has_last = true;
+        }
+    }
+
+    // Время хоста, до которого канал наблюдался (в том числе без отсчётов)
+    void Silence(int64_t now_ms) {
+        _now_ms = std::max(_now_ms, now_ms);
+    }
+
+    // Открытый пробел: канал молчит дольше GAP_PERIOD_FACTOR периодов
+    bool OpenGap(GapInterval& gap) const {
+        int64_t period = ExpectedPeriod();
+        if (!_has_last || period <= 0 || _now_ms - _last_ms <= GAP_PERIOD_FACTOR * period)
+            return false;
+        gap = GapInterval{_last_ms + period, _now_ms};
+        return true;
+    }
+
+    // Пробелы, пересекающие [from_ms, to_ms), включая открытый
+    std::vector<GapInterval> Overlapping(int64_t from_ms, int64_t to_ms) const {
+        std::vector<GapInterval> result;
+        auto it = _gaps.upper_bound(from_ms);
+        if (it != _gaps.begin() && std::prev(it)->second > from_ms)
+            --it;
+        for (; it != _gaps.end() && it->first < to_ms; ++it)
+            result.push_back(GapInterval{it->first, it->second});
+        GapInterval open;
+        if (OpenGap(open) && open.start_ms < to_ms && open.end_ms > from_ms)
+            result.push_back(open);
+        return result;
+    }
+
+    // Попадает ли момент в пробел
+    bool InGap(int64_t time_ms) const {
+        return !Overlapping(time_ms, time_ms + 1).empty();
+    }
+
+    // Суммарная длительность пробелов внутри [from_ms, to_ms)
+    int64_t MissingMs(int64_t from_ms, int64_t to_ms) const {
+        int64_t missing = 0;
+        for (const auto& gap : Overlapping(from_ms, to_ms))
+            missing += std::min(gap.end_ms, to_ms) - std::max(gap.start_ms, from_ms);
+        return missing;
+    }
+
+    // Доля [from_ms, to_ms), покрытая данными
+    double Coverage(int64_t from_ms, int64_t to_ms) const {
+        if (to_ms <= from_ms)
+            return 1.0;
+        return 1.0 - (double)MissingMs(from_ms, to_ms) / (double)(to_ms - from_ms);
+    }
+
+    // Отдать открытый пробел на запись как есть (при закрытии)
+    void FlushOpen() {
+        GapInterval open;
+        if (OpenGap(open))
+            _new.push_back(open);
+    }
+
+    // Забрать пробелы, закрытые с прошлого вызова (для записи на диск)
+    std::vector<GapInterval> TakeClosed() {
+        std::vector<GapInterval> result;
+        result.swap(_new);
+        return result;
+    }
+
+    // Забыть пробелы, закончившиеся раньше time_ms
+    void DropBefore(int64_t time_ms) {
+        auto it = _gaps.begin();
+        while (it != _gaps.end() && it->second <= time_ms)
+            it = _gaps.erase(it);
+    }
+
+    size_t Size() const {
+        return _gaps.size();
+    }
+
+private:
+    int64_t _fixed_period_ms;
+    RunningMedian _intervals;
+    bool _has_last = false;
+    int64_t _last_ms = 0;
+    int64_t _now_ms = 0;
+    std::map<int64_t, int64_t> _gaps; // Начало пробела -> конец
+    std::vector<GapInterval> _new;
+};
@@ -0,0 +1,360 @@
+#pragma once
+
+// Чтение истории из логов фиксированной ширины поблочно.
+//
+// Лог делится на блоки по записям разреженного индекса (или, если индекса нет,
+// по INDEX_EVERY_DEFAULT строк). Блок читается и разбирается целиком в
+// столбцы времени и значений; разобранные блоки хранятся в общем BlockCache,
+// так что повторные запросы к тем же дням не разбирают текст заново.
+// Агрегаты по диапазону берут целые закрытые блоки из сводок "<log>.stats"
+// и разбирают только крайние блоки.
+
+#include "log_format.hpp"
+#include "block_cache.hpp"
+#include "bucket_cache.hpp"
+#include <string>
+#include <vector>
+#include <fstream>
+#include <functional>
+
+// Разобранный блок лога: столбцы времени (мс) и значений
+struct DecodedBlock {
+    std::vector<int64_t> times;
+    std::vector<double> values;
+    uint64_t consumed = 0; // Байт разобрано (до конца последней полной строки)
+
+    size_t MemoryUsage() const {
+        return sizeof(*this) + times.capacity() * sizeof(int64_t) + values.capacity() * sizeof(double);
+    }
+};
+
+// Ключ блока: файл и байтовый диапазон блока в нём.
+// Последний блок растёт вместе с файлом, поэтому конец диапазона входит в ключ.
+struct BlockKey {
+    uint64_t file_id;
+    uint64_t begin;
+    uint64_t end;
+
+    bool operator==(const BlockKey& other) const {
+        return file_id == other.file_id && begin == other.begin && end == other.end;
+    }
+};
+
+struct BlockKeyHash {
+    size_t operator()(const BlockKey& key) const {
+        uint64_t h = key.file_id;
+        h = (h ^ key.begin) * 0x100000001B3ull;
+        h = (h ^ key.end) * 0x100000001B3ull;
+        return (size_t)h;
+    }
+};
+
+typedef ShardedLruCache<BlockKey, DecodedBlock, BlockKeyHash> BlockCache;
+
+const size_t BLOCK_CACHE_DEFAULT_MB = 64;
+
+// Бинарный поиск первой строки со временем >= time_ms в логе фиксированной ширины
+// (используется, если разреженного индекса нет)
+inline uint64_t bisectFixedLog(std::ifstream& log, uint64_t file_size, int64_t time_ms) {
+    uint64_t lo = 0, hi = file_size / FIXED_LINE_SIZE;
+    char buf[FIXED_LINE_SIZE];
+    while (lo < hi) {
+        uint64_t mid = lo + (hi - lo) / 2;
+        log.seekg(mid * FIXED_LINE_SIZE);
+        log.read(buf, FIXED_LINE_SIZE);
+        int64_t line_time = 0;
+        double value = 0.0;
+        if (parseFixedLine(buf, FIXED_LINE_WIDTH, line_time, value) && line_time < time_ms) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    log.clear();
+    return lo * FIXED_LINE_SIZE;
+}
+
+// Лог, открытый для чтения истории. Объект не потокобезопасен (свой файловый поток),
+// а кэш блоков может разделяться между несколькими такими объектами.
+class HistoryLog {
+public:
+    HistoryLog(const std::string& file_name, BlockCache* cache = nullptr)
+        : _file_name(file_name), _cache(cache), _file_size(0), _has_index(false) {
+        _file_id = std::hash<std::string>()(file_name);
+        _log.open(file_name, std::ios::binary);
+        Refresh();
+    }
+
+    bool IsOpen() const {
+        return _log.is_open();
+    }
+
+    const std::string& FileName() const {
+        return _file_name;
+    }
+
+    uint64_t FileSize() const {
+        return _file_size;
+    }
+
+    // Перечитать размер файла и индекс (лог мог дописаться)
+    void Refresh() {
+        if (!IsOpen())
+            return;
+        _log.clear();
+        _log.seekg(0, std::ios::end);
+        _file_size = (uint64_t)_log.tellg();
+        _has_index = loadSparseIndex(_file_name, _index);
+        _boundaries.clear();
+        _stats.clear();
+        if (_has_index) {
+            for (const auto& entry : _index) {
+                if (entry.offset < _file_size)
+                    _boundaries.push_back(entry.offset);
+            }
+            if (_boundaries.empty() || _boundaries.front() != 0)
+                _boundaries.insert(_boundaries.begin(), 0);
+            loadBlockStats(_file_name, _stats);
+        } else {
+            for (uint64_t offset = 0; offset < _file_size; offset += INDEX_EVERY_DEFAULT * FIXED_LINE_SIZE)
+                _boundaries.push_back(offset);
+        }
+    }
+
+    // Смещение, с которого нужно начинать чтение, чтобы не пропустить время >= time_ms
+    uint64_t SeekOffset(int64_t time_ms) {
+        if (_has_index)
+            return seekOffset(_index, time_ms);
+        return bisectFixedLog(_log, _file_size, time_ms);
+    }
+
+    // Обойти отсчёты со временем в [from_ms, to_ms] в порядке файла: f(time_ms, value)
+    template<class F>
+    void ReadRange(int64_t from_ms, int64_t to_ms, F f) {
+        ReadRange(from_ms, to_ms, f, [](size_t) { return true; });
+    }
+
+    // То же по кускам: после разбора каждого блока вызывается checkpoint(байт блока),
+    // false - прекратить обход (отмена или бюджет запроса)
+    template<class F, class C>
+    bool ReadRange(int64_t from_ms, int64_t to_ms, F f, C checkpoint) {
+        if (!IsOpen() || _boundaries.empty())
+            return true;
+        for (size_t block = BlockOf(SeekOffset(from_ms)); block < _boundaries.size(); block++) {
+            auto decoded = Block(block);
+            if (!checkpoint(decoded->MemoryUsage()))
+                return false;
+            const auto& times = decoded->times;
+            size_t i = std::lower_bound(times.begin(), times.end(), from_ms) - times.begin();
+            for (; i < times.size(); i++) {
+                if (times[i] > to_ms)
+                    return true;
+                f(times[i], decoded->values[i]);
+            }
+        }
+        return true;
+    }
+
+    // Агрегат отсчётов со временем в [from_ms, to_ms]: закрытые блоки, целиком
+    // попавшие в диапазон, берутся из сводок, остальные разбираются
+    Partial Aggregate(int64_t from_ms, int64_t to_ms) {
+        Partial result;
+        Aggregate(from_ms, to_ms, result, [](size_t) { return true; });
+        return result;
+    }
+
+    // То же по кускам, как ReadRange с checkpoint; false - агрегат прерван и неполон
+    template<class C>
+    bool Aggregate(int64_t from_ms, int64_t to_ms, Partial& result, C checkpoint) {
+        if (!IsOpen() || _boundaries.empty())
+            return true;
+        for (size_t block = BlockOf(SeekOffset(from_ms)); block < _boundaries.size(); block++) {
+            const BlockStats* stats = Stats(block);
+            if (stats && stats->first_ms > to_ms)
+                break;
+            if (stats && stats->first_ms >= from_ms && stats->last_ms <= to_ms) {
+                result.Merge(PartialOf(*stats));
+                continue;
+            }
+            auto decoded = Block(block);
+            if (!checkpoint(decoded->MemoryUsage()))
+                return false;
+            const auto& times = decoded->times;
+            size_t i = std::lower_bound(times.begin(), times.end(), from_ms) - times.begin();
+            for (; i < times.size() && times[i] <= to_ms; i++)
+                result.Add(decoded->values[i]);
+            if (i < times.size())
+                break;
+        }
+        return true;
+    }
+
+    // Минимум и максимум значений в [from_ms, to_ms] с запасом - по сводкам
+    // затронутых блоков, без разбора текста. false - у какого-то из блоков
+    // сводки нет (последний, ещё растущий блок), границы неизвестны.
+    bool Bounds(int64_t from_ms, int64_t to_ms, double& min, double& max) {
+        Partial bounds;
+        if (!IsOpen() || _boundaries.empty())
+            return false;
+        for (size_t block = BlockOf(SeekOffset(from_ms)); block < _boundaries.size(); block++) {
+            const BlockStats* stats = Stats(block);
+            if (!stats)
+                return false;
+            if (stats->first_ms > to_ms)
+                break;
+            if (stats->last_ms >= from_ms)
+                bounds.Merge(PartialOf(*stats));
+        }
+        min = bounds.min;
+        max = bounds.max;
+        return true;
+    }
+
+    // Сводка закрытого блока block или nullptr, если её нет
+    const BlockStats* Stats(size_t block) const {
+        if (block + 1 >= _boundaries.size())
+            return nullptr;
+        auto it = std::lower_bound(_stats.begin(), _stats.end(), _boundaries[block],
+            [](const BlockStats& s, uint64_t offset) { return s.offset < offset; });
+        if (it == _stats.end() || it->offset != _boundaries[block])
+            return nullptr;
+        return &*it;
+    }
+
+    // Обойти строки, дописанные в лог начиная с offset: f(time_ms, value).
+    // offset сдвигается за последнюю полную строку, так что следующий вызов
+    // прочитает только новые данные.
+    template<class F>
+    void ReadAppended(uint64_t& offset, F f) {
+        if (!IsOpen() || offset >= _file_size)
+            return;
+        auto decoded = DecodeBlock(offset, _file_size);
+        for (size_t i = 0; i < decoded->times.size(); i++)
+            f(decoded->times[i], decoded->values[i]);
+        offset += decoded->consumed;
+    }
+
+    // Разобранный блок с номером block (через кэш, если он задан)
+    BlockCache::Handle Block(size_t block) {
+        uint64_t begin = _boundaries[block];
+        uint64_t end = (block + 1 < _boundaries.size()) ? _boundaries[block + 1] : _file_size;
+        auto loader = [&](size_t& charge) {
+            auto decoded = DecodeBlock(begin, end);
+            charge = decoded->MemoryUsage();
+            return BlockCache::Handle(decoded);
+        };
+        if (!_cache) {
+            size_t charge = 0;
+            return loader(charge);
+        }
+        return _cache->GetOrLoad(BlockKey{_file_id, begin, end}, loader);
+    }
+
+    size_t BlockCount() const {
+        return _boundaries.size();
+    }
+
+    // Номер блока, содержащего смещение offset
+    size_t BlockOf(uint64_t offset) const {
+        return std::upper_bound(_boundaries.begin(), _boundaries.end(), offset) - _boundaries.begin() - 1;
+    }
+
+private:
+    static Partial PartialOf(const BlockStats& stats) {
+        Partial partial;
+        partial.count = stats.count;
+        partial.sum = stats.sum;
+        partial.min = stats.min;
+        partial.max = stats.max;
+        return partial;
+    }
+
+    std::shared_ptr<DecodedBlock> DecodeBlock(uint64_t begin, uint64_t end) {
+        auto decoded = std::make_shared<DecodedBlock>();
+        std::string buf(end - begin, '\0');
+        _log.clear();
+        _log.seekg(begin);
+        _log.read(&buf[0], buf.size());
+        buf.resize((size_t)_log.gcount());
+
+        decoded->times.reserve(buf.size() / FIXED_LINE_SIZE + 1);
+        decoded->values.reserve(buf.size() / FIXED_LINE_SIZE + 1);
+        size_t pos = 0;
+        while (pos < buf.size()) {
+            size_t eol = buf.find('\n', pos);
+            if (eol == std::string::npos)
+                break; // Недописанная строка в конце файла
+            int64_t time_ms = 0;
+            double value = 0.0;
+            if (parseFixedLine(buf.data() + pos, eol - pos, time_ms, value)) {
+                decoded->times.push_back(time_ms);
+                decoded->values.push_back(value);
+            }
+            pos = eol + 1;
+        }
+        decoded->consumed = pos;
+        return decoded;
+    }
+
+    std::string _file_name;
+    BlockCache* _cache;
+    uint64_t _file_id;
+    std::ifstream _log;
+    uint64_t _file_size;
+    bool _has_index;
+    std::vector<IndexEntry> _index;
+    std::vector<uint64_t> _boundaries; // Начала блоков
+    std::vector<BlockStats> _stats;    // Сводки закрытых блоков по возрастанию смещения
+};
+
+// Чтение отсчётов лога со временем в [from_ms, to_ms] по одному, в порядке файла.
+// В памяти держится только текущий разобранный блок, поэтому несколько курсоров
+// можно сливать, не читая логи целиком.
+class HistoryCursor {
+public:
+    HistoryCursor(HistoryLog& log, int64_t from_ms, int64_t to_ms)
+        : _log(&log), _to_ms(to_ms), _block(0), _pos(0) {
+        if (!log.IsOpen() || log.BlockCount() == 0)
+            return;
+        _block = log.BlockOf(log.SeekOffset(from_ms));
+        _decoded = log.Block(_block);
+        const auto& times = _decoded->times;
+        _pos = std::lower_bound(times.begin(), times.end(), from_ms) - times.begin();
+        SkipExhausted();
+    }
+
+    bool Valid() const {
+        return _decoded && Time() <= _to_ms;
+    }
+
+    int64_t Time() const {
+        return _decoded->times[_pos];
+    }
+
+    double Value() const {
+        return _decoded->values[_pos];
+    }
+
+    void Next() {
+        _pos++;
+        SkipExhausted();
+    }
+
+private:
+    void SkipExhausted() {
+        while (_decoded && _pos >= _decoded->times.size()) {
+            if (++_block >= _log->BlockCount()) {
+                _decoded.reset();
+                return;
+            }
+            _decoded = _log->Block(_block);
+            _pos = 0;
+        }
+    }
+
+    HistoryLog* _log;
+    int64_t _to_ms;
+    size_t _block;
+    size_t _pos;
+    BlockCache::Handle _decoded;
+};
@@ -0,0 +1,169 @@
+#pragma once
+
+// Источники входных данных main: последовательный порт, stdin, FIFO и
+// обычные файлы.
+//
+// Порт читается через cplib::SerialPort: устройство пишет значение одной
+// записью, поэтому каждое чтение - законченное сообщение, даже без перевода
+// строки. Остальные источники - потоки байт (pipe от socat или ssh, повтор
+// записанного вывода, файл для замера производительности): они читаются
+// через дескриптор большими блоками, строка может быть разрезана между
+// чтениями, и LineFramer отдаёт на разбор только целые строки, оставляя
+// хвост до следующего чтения. Конец потока (EOF) - конец работы.
+
+#include "my_serial.hpp"
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstring>
+
+#if !defined (WIN32)
+#	include <cerrno>       // errno
+#	include <fcntl.h>      // open
+#	include <unistd.h>     // read, close
+#	include <poll.h>       // poll
+#	include <sys/stat.h>   // stat, S_ISCHR
+#endif
+
+const size_t INPUT_BUFFER_SIZE = 256 * 1024;  // Блок чтения потока (pipe отдаёт до 64 КБ за раз)
+const size_t INPUT_LINE_MAX = 64 * 1024;      // Хвост без перевода строки длиннее - отдаётся как есть
+
+enum InputStatus {
+    INPUT_DATA,
+    INPUT_TIMEOUT,  // За таймаут ничего не пришло
+    INPUT_END,      // Конец потока
+    INPUT_ERROR
+};
+
+class InputSource {
+public:
+    virtual ~InputSource() {}
+
+    virtual bool IsOpen() const = 0;
+
+    // Прочитать то, что есть (ждать не дольше timeout секунд) в data
+    virtual InputStatus Read(std::string& data, double timeout) = 0;
+
+    // Каждое чтение - законченное сообщение (последовательный порт)
+    virtual bool MessagePerRead() const = 0;
+};
+
+class SerialSource : public InputSource {
+public:
+    explicit SerialSource(const std::string& name)
+        : _port(name, cplib::SerialPort::BAUDRATE_115200), _timeout(-1.0) {}
+
+    bool IsOpen() const override {
+        return _port.IsOpen();
+    }
+
+    InputStatus Read(std::string& data, double timeout) override {
+        if (timeout != _timeout) {
+            _port.SetTimeout(timeout);
+            _timeout = timeout;
+        }
+        data.clear();
+        if (_port.Read(data) != cplib::SerialPort::RE_OK)
+            return INPUT_ERROR;
+        return data.empty() ? INPUT_TIMEOUT : INPUT_DATA;
+    }
+
+    bool MessagePerRead() const override {
+        return true;
+    }
+
+private:
+    cplib::SerialPort _port;
+    double _timeout;
+};
+
+#if !defined (WIN32)
+// stdin, FIFO или обычный файл
+class FdSource : public InputSource {
+public:
+    // FIFO открывается как обычно: open ждёт, пока в канал не начнёт писать хоть кто-то
+    explicit FdSource(const std::string& name)
+        : _fd(name == "-" ? STDIN_FILENO : open(name.c_str(), O_RDONLY)), _owned(name != "-"),
+          _buffer(INPUT_BUFFER_SIZE) {}
+
+    ~FdSource() override {
+        if (_owned && _fd >= 0)
+            close(_fd);
+    }
+
+    bool IsOpen() const override {
+        return _fd >= 0;
+    }
+
+    InputStatus Read(std::string& data, double timeout) override {
+        data.clear();
+        pollfd descriptor = {_fd, POLLIN, 0};
+        int ready = poll(&descriptor, 1, (int)(timeout * 1e3));
+        if (ready == 0 || (ready < 0 && errno == EINTR))
+            return INPUT_TIMEOUT;
+        if (ready < 0)
+            return INPUT_ERROR;
+        ssize_t size = read(_fd, _buffer.data(), _buffer.size());
+        if (size < 0)
+            return (errno == EINTR || errno == EAGAIN) ? INPUT_TIMEOUT : INPUT_ERROR;
+        if (size == 0)
+            return INPUT_END;
+        data.assign(_buffer.data(), (size_t)size);
+        return INPUT_DATA;
+    }
+
+    bool MessagePerRead() const override {
+        return false;
+    }
+
+private:
+    int _fd;
+    bool _owned;
+    std::vector<char> _buffer;
+};
+#endif
+
+// Источник по имени: "-" - stdin, символьное устройство - последовательный порт,
+// остальное (FIFO, файл) - поток байт
+inline std::unique_ptr<InputSource> openInputSource(const std::string& name) {
+#if defined (WIN32)
+    return std::unique_ptr<InputSource>(new SerialSource(name));
+#else
+    struct stat st;
+    if (name != "-" && stat(name.c_str(), &st) == 0 && S_ISCHR(st.st_mode))
+        return std::unique_ptr<InputSource>(new SerialSource(name));
+    return std::unique_ptr<InputSource>(new FdSource(name));
+#endif
+}
+
+// Нарезка потока на целые строки
+class LineFramer {
+public:
+    // Добавить прочитанные данные; в lines - целые строки, готовые к разбору (может быть пусто)
+    void Push(const std::string& data, std::string& lines) {
+        lines.clear();
+        size_t last = data.rfind('\n');
+        if (last == std::string::npos) {
+            _tail += data;
+            if (_tail.size() > INPUT_LINE_MAX)
+                Flush(lines);
+            return;
+        }
+        if (_tail.empty()) {
+            lines.assign(data, 0, last + 1);
+        } else {
+            lines.swap(_tail);
+            lines.append(data, 0, last + 1);
+        }
+        _tail.assign(data, last + 1, std::string::npos);
+    }
+
+    // Отдать остаток без перевода строки (конец потока или законченное сообщение)
+    void Flush(std::string& lines) {
+        lines.swap(_tail);
+        _tail.clear();
+    }
+
+private:
+    std::string _tail;
+};
@@ -0,0 +1,304 @@
+#pragma once
+
+// Табло последних значений: для каждого канала - последнее принятое значение,
+// его время, флаги качества и номер версии.
+//
+// Табло - массив слотов фиксированного размера; слот канала находится
+// открытой адресацией и закрепляется за каналом при первом отсчёте. Слот
+// защищён последовательной блокировкой (seqlock): писатель делает номер
+// нечётным, пишет поля и делает его чётным, читатель копирует поля и
+// повторяет чтение, если номер был нечётным или изменился. Читатели ничего не
+// пишут, поэтому снимок всех каналов не мешает приёму и не ждёт его.
+//
+// Массив лежит в памяти процесса или в разделяемой памяти POSIX
+// (shm_open), и тогда табло читают другие процессы ("query --latest").
+// Давность значения считается при чтении по времени отсчёта; сегмент не
+// удаляется при остановке приёма, так что читатели видят последние значения
+// с растущей давностью.
+//
+// Табло читают без блокировок и во время перенастройки: размещение табло
+// публикуется атомарным указателем, а прежние размещения не освобождаются,
+// пока жив объект табло. Возврат к табло в памяти процесса очищает его слоты
+// на месте, повторное подключение к тому же сегменту берёт уже
+// отображённый, так что память не растёт с числом перенастроек.
+
+#include <new>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+
+#if !defined (WIN32)
+#	include <fcntl.h>      // O_CREAT, O_RDWR
+#	include <unistd.h>     // ftruncate, close
+#	include <sys/mman.h>   // shm_open, mmap
+#	include <sys/stat.h>   // fstat
+#endif
+
+const uint32_t LATEST_BOARD_SLOTS = 4096;           // Каналов на табло
+const uint64_t LATEST_BOARD_MAGIC = 0x4c54535442524431ULL; // "LTSTBRD1"
+const uint32_t LATEST_BOARD_VERSION = 1;
+const uint32_t LATEST_BOARD_EMPTY = 0xFFFFFFFFu;    // Слот не занят
+const char* const LATEST_BOARD_SHM_DEFAULT = "/templog_latest";
+const int LATEST_READ_ATTEMPTS = 1000;              // Попыток чтения слота, пока его пишут
+
+// Последнее значение канала (копия слота)
+struct LatestValue {
+    uint32_t channel = 0;
+    uint8_t flags = 0;
+    int64_t time_ms = 0;
+    double value = 0.0;
+    uint32_t sequence = 0; // Номер версии: растёт на 2 при каждом обновлении
+};
+
+// Слот занимает свою строку кэша, чтобы обновления соседних каналов не мешали друг другу.
+// Поля - атомарные без блокировок, так что слоты годятся и для разделяемой памяти.
+struct alignas(64) LatestSlot {
+    std::atomic<uint32_t> sequence;
+    std::atomic<uint32_t> channel;
+    std::atomic<int64_t> time_ms;
+    std::atomic<double> value;
+    std::atomic<uint32_t> flags;
+
+    LatestSlot() : sequence(0), channel(LATEST_BOARD_EMPTY), time_ms(0), value(0.0), flags(0) {}
+};
+
+static_assert(std::atomic<uint32_t>::is_always_lock_free && std::atomic<int64_t>::is_always_lock_free &&
+              std::atomic<double>::is_always_lock_free, "latest board slots must be lock-free");
+
+// Размещение табло: заголовок и слоты (magic пишется последним)
+struct LatestBoardMemory {
+    std::atomic<uint64_t> magic;
+    uint32_t version;
+    uint32_t capacity;
+    LatestSlot slots[LATEST_BOARD_SLOTS];
+
+    LatestBoardMemory() : magic(0), version(LATEST_BOARD_VERSION), capacity(LATEST_BOARD_SLOTS) {}
+};
+
+class LatestBoard {
+public:
+    LatestBoard() : _own(new LatestBoardMemory()), _memory(_own), _writable(true) {
+        _own->magic.store(LATEST_BOARD_MAGIC, std::memory_order_release);
+    }
+
+    ~LatestBoard() {
+#if !defined (WIN32)
+        for (const auto& mapping : _mappings)
+            munmap(mapping.memory, sizeof(LatestBoardMemory));
+#endif
+        delete _own;
+    }
+
+    LatestBoard(const LatestBoard&) = delete;
+    LatestBoard& operator=(const LatestBoard&) = delete;
+
+    // Перенести табло в сегмент разделяемой памяти name (создаётся или пересоздаётся);
+    // вызывается до приёма данных, прежние значения не переносятся
+    bool CreateShared(const std::string& name, std::string& errors) {
+#if defined (WIN32)
+        errors += "Shared latest board is not supported on this platform\n";
+        return false;
+#else
+        LatestBoardMemory* memory = Mapped(name, true);
+        if (memory) {
+            Clear(*memory);
+        } else {
+            int fd = shm_open(name.c_str(), O_CREAT | O_RDWR, 0644);
+            if (fd < 0 || ftruncate(fd, sizeof(LatestBoardMemory)) != 0) {
+                errors += "Failed to create shared memory '" + name + "': " + std::strerror(errno) + "\n";
+                if (fd >= 0)
+                    close(fd);
+                return false;
+            }
+            void* address = mmap(nullptr, sizeof(LatestBoardMemory), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            close(fd);
+            if (address == MAP_FAILED) {
+                errors += "Failed to map shared memory '" + name + "': " + std::strerror(errno) + "\n";
+                return false;
+            }
+            // Содержимое сегмента от прежнего запуска сбрасывается; пока идёт сброс, magic нулевой
+            memory = static_cast<LatestBoardMemory*>(address);
+            memory->magic.store(0, std::memory_order_release);
+            new (memory) LatestBoardMemory();
+            memory->magic.store(LATEST_BOARD_MAGIC, std::memory_order_release);
+            _mappings.push_back(Mapping{name, memory, true});
+        }
+        _writable = true;
+        _memory.store(memory, std::memory_order_release);
+        return true;
+#endif
+    }
+
+    // Открыть табло другого процесса только для чтения
+    bool OpenShared(const std::string& name, std::string& errors) {
+#if defined (WIN32)
+        errors += "Shared latest board is not supported on this platform\n";
+        return false;
+#else
+        LatestBoardMemory* memory = Mapped(name, false);
+        if (!memory) {
+            int fd = shm_open(name.c_str(), O_RDONLY, 0);
+            if (fd < 0) {
+                errors += "Failed to open shared memory '" + name + "': " + std::strerror(errno) + "\n";
+                return false;
+            }
+            struct stat st;
+            if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(LatestBoardMemory)) {
+                errors += "Shared memory '" + name + "' is not a latest board\n";
+                close(fd);
+                return false;
+            }
+            void* address = mmap(nullptr, sizeof(LatestBoardMemory), PROT_READ, MAP_SHARED, fd, 0);
+            close(fd);
+            if (address == MAP_FAILED) {
+                errors += "Failed to map shared memory '" + name + "': " + std::strerror(errno) + "\n";
+                return false;
+            }
+            memory = static_cast<LatestBoardMemory*>(address);
+            if (memory->magic.load(std::memory_order_acquire) != LATEST_BOARD_MAGIC ||
+                memory->version != LATEST_BOARD_VERSION || memory->capacity != LATEST_BOARD_SLOTS) {
+                errors += "Shared memory '" + name + "' is not a latest board\n";
+                munmap(address, sizeof(LatestBoardMemory));
+                return false;
+            }
+            _mappings.push_back(Mapping{name, memory, false});
+        }
+        _writable = false;
+        _memory.store(memory, std::memory_order_release);
+        return true;
+#endif
+    }
+
+    // Вернуться к пустому табло в памяти процесса (сегменты остаются отображёнными)
+    void Reset() {
+        Clear(*_own);
+        _writable = true;
+        _memory.store(_own, std::memory_order_release);
+    }
+
+    // Обновить значение канала; более старый отсчёт, чем уже записанный, пропускается.
+    // false - табло заполнено или открыто только для чтения.
+    bool Update(uint32_t channel, int64_t time_ms, double value, uint8_t flags) {
+        LatestSlot* slot = _writable ? Find(channel, true) : nullptr;
+        if (!slot)
+            return false;
+
+        // Писателей канала может быть несколько: нечётный номер - заодно и блокировка
+        uint32_t sequence = slot->sequence.load(std::memory_order_relaxed);
+        while ((sequence & 1) ||
+               !slot->sequence.compare_exchange_weak(sequence, sequence + 1, std::memory_order_acquire,
+                                                     std::memory_order_relaxed)) {
+            sequence = slot->sequence.load(std::memory_order_relaxed);
+        }
+        std::atomic_thread_fence(std::memory_order_release);
+        if (sequence == 0 || time_ms >= slot->time_ms.load(std::memory_order_relaxed)) {
+            slot->time_ms.store(time_ms, std::memory_order_relaxed);
+            slot->value.store(value, std::memory_order_relaxed);
+            slot->flags.store(flags, std::memory_order_relaxed);
+        }
+        slot->sequence.store(sequence + 2, std::memory_order_release);
+        return true;
+    }
+
+    // Значение канала; false - значений по каналу ещё не было
+    bool Read(uint32_t channel, LatestValue& result) const {
+        const LatestSlot* slot = const_cast<LatestBoard*>(this)->Find(channel, false);
+        return slot && ReadSlot(*slot, result);
+    }
+
+    // Снимок всех каналов табло (в порядке слотов)
+    void Snapshot(std::vector<LatestValue>& result) const {
+        result.clear();
+        LatestValue value;
+        for (const auto& slot : _memory.load(std::memory_order_acquire)->slots) {
+            if (ReadSlot(slot, value))
+                result.push_back(value);
+        }
+    }
+
+private:
+    // Слот канала открытой адресацией; create - занять свободный слот
+    LatestSlot* Find(uint32_t channel, bool create) {
+        if (channel == LATEST_BOARD_EMPTY)
+            return nullptr;
+        LatestBoardMemory* memory = _memory.load(std::memory_order_acquire);
+        uint32_t start = (uint32_t)((channel * 0x9E3779B1u) % LATEST_BOARD_SLOTS);
+        for (uint32_t probe = 0; probe < LATEST_BOARD_SLOTS; probe++) {
+            LatestSlot& slot = memory->slots[(start + probe) % LATEST_BOARD_SLOTS];
+            uint32_t owner = slot.channel.load(std::memory_order_acquire);
+            if (owner == channel)
+                return &slot;
+            if (owner != LATEST_BOARD_EMPTY)
+                continue;
+            if (!create)
+                return nullptr;
+            if (slot.channel.compare_exchange_strong(owner, channel, std::memory_order_acq_rel) ||
+                owner == channel)
+                return &slot;
+        }
+        return nullptr;
+    }
+
+    static bool ReadSlot(const LatestSlot& slot, LatestValue& result) {
+        uint32_t channel = slot.channel.load(std::memory_order_acquire);
+        if (channel == LATEST_BOARD_EMPTY)
+            return false;
+        // Писатель в другом процессе мог упасть посреди записи: попытки ограничены
+        for (int attempt = 0; attempt < LATEST_READ_ATTEMPTS; attempt++) {
+            uint32_t before = slot.sequence.load(std::memory_order_acquire);
+            if (before == 0)
+                return false; // Слот занят, но значение ещё не записано
+            if (before & 1)
+                continue;
+            result.channel = channel;
+            result.time_ms = slot.time_ms.load(std::memory_order_relaxed);
+            result.value = slot.value.load(std::memory_order_relaxed);
+            result.flags = (uint8_t)slot.flags.load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (slot.sequence.load(std::memory_order_relaxed) == before) {
+                result.sequence = before;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    struct Mapping {
+        std::string name;
+        LatestBoardMemory* memory;
+        bool writable;
+    };
+
+    // Уже отображённый сегмент name
+    LatestBoardMemory* Mapped(const std::string& name, bool writable) const {
+        for (const auto& mapping : _mappings) {
+            if (mapping.name == name && mapping.writable == writable)
+                return mapping.memory;
+        }
+        return nullptr;
+    }
+
+    // Освободить все слоты на месте; читатель, заставший слот посреди очистки,
+    // видит изменившийся номер версии и повторяет чтение
+    static void Clear(LatestBoardMemory& memory) {
+        for (auto& slot : memory.slots) {
+            if (slot.channel.load(std::memory_order_relaxed) == LATEST_BOARD_EMPTY)
+                continue;
+            slot.sequence.store(slot.sequence.load(std::memory_order_relaxed) | 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            slot.time_ms.store(0, std::memory_order_relaxed);
+            slot.value.store(0.0, std::memory_order_relaxed);
+            slot.flags.store(0, std::memory_order_relaxed);
+            slot.channel.store(LATEST_BOARD_EMPTY, std::memory_order_relaxed);
+            slot.sequence.store(0, std::memory_order_release);
+        }
+    }
+
+    LatestBoardMemory* _own;                    // Табло в памяти процесса
+    std::atomic<LatestBoardMemory*> _memory;    // Текущее размещение (своё или сегмент)
+    std::vector<Mapping> _mappings;             // Отображённые сегменты, до разрушения табло
+    bool _writable;
+};
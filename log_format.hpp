@@ -0,0 +1,236 @@
+#pragma once
+
+// Текстовый формат логов с фиксированной шириной полей и разреженный индекс к нему.
+//
+// Каждая строка имеет вид "YYYY-MM-DD HH:MM:SS.mmm:   23.400\n" и ровно
+// FIXED_LINE_SIZE байт, поэтому строку с номером k можно найти по смещению
+// k * FIXED_LINE_SIZE, а сам файл сортируется и режется по байтам.
+// Время пишется в UTC: у местного времени час перевода часов назад
+// повторяется, и строки этого часа нарушили бы порядок файла, на котором
+// держатся индекс и бинарный поиск.
+// Рядом с логом лежит файл "<log>.idx" с записями "<время в мс> <смещение>"
+// для каждой index_every-й строки: поиск по времени - один бинарный поиск по
+// индексу и одно позиционирование в логе.
+// Для каждого закрытого блока между соседними записями индекса в "<log>.stats"
+// пишется сводка (число строк, сумма, минимум, максимум): запросы по целым
+// блокам берут её вместо разбора текста.
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iomanip>
+#include <algorithm>
+#include <chrono>
+#include <ctime>
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+
+const size_t TIMESTAMP_WIDTH = 23;                              // "YYYY-MM-DD HH:MM:SS.mmm"
+const size_t VALUE_WIDTH = 10;                                  // "%10.3f"
+const size_t FIXED_LINE_WIDTH = TIMESTAMP_WIDTH + 2 + VALUE_WIDTH; // без '\n'
+const size_t FIXED_LINE_SIZE = FIXED_LINE_WIDTH + 1;            // вместе с '\n'
+const int INDEX_EVERY_DEFAULT = 1024;                           // Шаг разреженного индекса (в строках)
+
+// Запись разреженного индекса: время строки и её смещение в файле
+struct IndexEntry {
+    int64_t time_ms;
+    uint64_t offset;
+};
+
+// Текущее время в миллисекундах от эпохи
+inline int64_t currentTimeMs() {
+    using namespace std::chrono;
+    return duration_cast<milliseconds>(system_clock::now().time_since_epoch()).count();
+}
+
+inline std::tm localTime(std::time_t t) {
+    std::tm tm = {};
+#ifdef _WIN32
+    localtime_s(&tm, &t);
+#else
+    localtime_r(&t, &tm);
+#endif
+    return tm;
+}
+
+inline std::tm utcTime(std::time_t t) {
+    std::tm tm = {};
+#ifdef _WIN32
+    gmtime_s(&tm, &t);
+#else
+    gmtime_r(&t, &tm);
+#endif
+    return tm;
+}
+
+// Обратное к utcTime: поля tm - время UTC
+inline std::time_t utcTimeToEpoch(std::tm& tm) {
+#ifdef _WIN32
+    return _mkgmtime(&tm);
+#else
+    return timegm(&tm);
+#endif
+}
+
+// Время UTC в формате "YYYY-MM-DD HH:MM:SS.mmm" с ведущими нулями
+inline std::string formatTimestamp(int64_t time_ms) {
+    int64_t sec = time_ms / 1000;
+    int ms = (int)(time_ms % 1000);
+    if (ms < 0) {
+        ms += 1000;
+        sec -= 1;
+    }
+    std::tm tm = utcTime((std::time_t)sec);
+    // Буфер - с запасом на худший случай полей int (иначе -Wformat-truncation);
+    // в лог идут первые TIMESTAMP_WIDTH символов
+    char buf[64];
+    snprintf(buf, sizeof(buf), "%04d-%02d-%02d %02d:%02d:%02d.%03d",
+             tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday,
+             tm.tm_hour, tm.tm_min, tm.tm_sec, ms);
+    return std::string(buf, TIMESTAMP_WIDTH);
+}
+
+// Значение ровно VALUE_WIDTH символов; слишком большие числа - в экспоненциальной записи
+inline std::string formatValue(double value) {
+    char buf[64];
+    int n = snprintf(buf, sizeof(buf), "%10.3f", value);
+    if (n != (int)VALUE_WIDTH)
+        n = snprintf(buf, sizeof(buf), "%10.3e", value);
+    if (n != (int)VALUE_WIDTH)
+        n = snprintf(buf, sizeof(buf), "%10.2e", value);
+    return std::string(buf, VALUE_WIDTH);
+}
+
+// Строка лога фиксированной ширины (без '\n')
+inline std::string formatFixedLine(int64_t time_ms, double value) {
+    return formatTimestamp(time_ms) + ": " + formatValue(value);
+}
+
+// Разбор двух цифр/четырёх цифр по фиксированным позициям
+inline bool parseDigits(const char* p, int count, int& out) {
+    out = 0;
+    for (int i = 0; i < count; i++) {
+        if (p[i] < '0' || p[i] > '9')
+            return false;
+        out = out * 10 + (p[i] - '0');
+    }
+    return true;
+}
+
+// Разбор времени UTC "YYYY-MM-DD HH:MM:SS[.mmm]" в миллисекунды от эпохи
+inline bool parseTimestamp(const char* p, size_t n, int64_t& time_ms) {
+    if (n < 19)
+        return false;
+    std::tm tm = {};
+    int ms = 0;
+    if (!parseDigits(p, 4, tm.tm_year) || !parseDigits(p + 5, 2, tm.tm_mon) ||
+        !parseDigits(p + 8, 2, tm.tm_mday) || !parseDigits(p + 11, 2, tm.tm_hour) ||
+        !parseDigits(p + 14, 2, tm.tm_min) || !parseDigits(p + 17, 2, tm.tm_sec))
+        return false;
+    if (n >= TIMESTAMP_WIDTH && p[19] == '.' && !parseDigits(p + 20, 3, ms))
+        return false;
+    tm.tm_year -= 1900;
+    tm.tm_mon -= 1;
+    std::time_t t = utcTimeToEpoch(tm);
+    if (t == (std::time_t)-1)
+        return false;
+    time_ms = (int64_t)t * 1000 + ms;
+    return true;
+}
+
+inline bool parseTimestamp(const std::string& str, int64_t& time_ms) {
+    return parseTimestamp(str.data(), str.size(), time_ms);
+}
+
+// Разбор строки лога фиксированной ширины (с '\n' или без)
+inline bool parseFixedLine(const char* p, size_t n, int64_t& time_ms, double& value) {
+    if (n < FIXED_LINE_WIDTH || p[TIMESTAMP_WIDTH] != ':')
+        return false;
+    if (!parseTimestamp(p, TIMESTAMP_WIDTH, time_ms))
+        return false;
+    char buf[VALUE_WIDTH + 1];
+    std::copy(p + TIMESTAMP_WIDTH + 2, p + FIXED_LINE_WIDTH, buf);
+    buf[VALUE_WIDTH] = '\0';
+    char* end = nullptr;
+    value = std::strtod(buf, &end);
+    return end != buf;
+}
+
+// Имя файла разреженного индекса для лога
+inline std::string indexFileName(const std::string& log_file_name) {
+    return log_file_name + ".idx";
+}
+
+inline void appendIndexEntry(std::ofstream& index_file, const IndexEntry& entry) {
+    index_file << entry.time_ms << " " << entry.offset << "\n";
+}
+
+// Загрузка разреженного индекса; false, если индекса нет
+inline bool loadSparseIndex(const std::string& log_file_name, std::vector<IndexEntry>& index) {
+    index.clear();
+    std::ifstream index_file(indexFileName(log_file_name));
+    if (!index_file.is_open())
+        return false;
+    IndexEntry entry;
+    while (index_file >> entry.time_ms >> entry.offset)
+        index.push_back(entry);
+    return true;
+}
+
+// Смещение, с которого нужно читать лог, чтобы не пропустить строки со временем >= time_ms
+inline uint64_t seekOffset(const std::vector<IndexEntry>& index, int64_t time_ms) {
+    auto it = std::lower_bound(index.begin(), index.end(), time_ms,
+        [](const IndexEntry& e, int64_t t) { return e.time_ms < t; });
+    if (it == index.begin())
+        return 0;
+    return (it - 1)->offset;
+}
+
+// Сводка блока лога (зональная карта): блок начинается со смещения offset
+// и продолжается до следующей записи индекса
+struct BlockStats {
+    uint64_t offset = 0;
+    int64_t first_ms = 0;
+    int64_t last_ms = 0;
+    uint64_t count = 0;
+    double sum = 0.0;
+    double min = 0.0;
+    double max = 0.0;
+
+    void Add(int64_t time_ms, double value) {
+        if (count == 0) {
+            first_ms = time_ms;
+            min = max = value;
+        }
+        last_ms = time_ms;
+        count++;
+        sum += value;
+        min = std::min(min, value);
+        max = std::max(max, value);
+    }
+};
+
+// Имя файла сводок блоков для лога
+inline std::string statsFileName(const std::string& log_file_name) {
+    return log_file_name + ".stats";
+}
+
+// Строка сводки: "<смещение> <первое время> <последнее время> <число> <сумма> <мин> <макс>"
+inline void appendBlockStats(std::ofstream& stats_file, const BlockStats& stats) {
+    stats_file << stats.offset << " " << stats.first_ms << " " << stats.last_ms << " " << stats.count << " "
+               << std::setprecision(17) << stats.sum << " " << stats.min << " " << stats.max << "\n";
+}
+
+// Загрузка сводок блоков; false, если файла сводок нет
+inline bool loadBlockStats(const std::string& log_file_name, std::vector<BlockStats>& blocks) {
+    blocks.clear();
+    std::ifstream stats_file(statsFileName(log_file_name));
+    if (!stats_file.is_open())
+        return false;
+    BlockStats stats;
+    while (stats_file >> stats.offset >> stats.first_ms >> stats.last_ms >> stats.count
+                      >> stats.sum >> stats.min >> stats.max)
+        blocks.push_back(stats);
+    return true;
+}
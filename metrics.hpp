@@ -0,0 +1,62 @@
+#pragma once
+
+// Метрики процесса в текстовом формате Prometheus.
+//
+// Значения хранятся в общем реестре по полному имени (с метками) и
+// периодически выгружаются в файл; запись идёт через временный файл и
+// rename, так что читатель никогда не видит файл наполовину.
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <fstream>
+#include <cstdio>
+#include <cstdint>
+
+class MetricsRegistry {
+public:
+    void Set(const std::string& name, double value) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _values[name] = value;
+    }
+
+    void Add(const std::string& name, double delta) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _values[name] += delta;
+    }
+
+    double Get(const std::string& name) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto it = _values.find(name);
+        return (it != _values.end()) ? it->second : 0.0;
+    }
+
+    bool WriteToFile(const std::string& file_name) {
+        std::string tmp_name = file_name + ".tmp";
+        {
+            std::ofstream file(tmp_name, std::ios::trunc);
+            if (!file.is_open())
+                return false;
+            file.precision(15);
+            std::lock_guard<std::mutex> lock(_mutex);
+            for (const auto& entry : _values)
+                file << entry.first << " " << entry.second << "\n";
+        }
+        return std::rename(tmp_name.c_str(), file_name.c_str()) == 0;
+    }
+
+private:
+    std::mutex _mutex;
+    std::map<std::string, double> _values;
+};
+
+// Общий реестр метрик процесса
+inline MetricsRegistry& metrics() {
+    static MetricsRegistry registry;
+    return registry;
+}
+
+// Имя метрики с меткой канала: name{channel="N"}
+inline std::string channelMetric(const std::string& name, uint32_t channel) {
+    return name + "{channel=\"" + std::to_string(channel) + "\"}";
+}
@@ -530,13 +530,14 @@ namespace cplib
 		// Читаем из порта строку
 		// Ограничение чтения - таймаут, либо символ \n
 		int Read(std::string& str, double timeout = SERIAL_PORT_DEFAULT_TIMEOUT) {
-			int ret = RE_OK;
-			str.reserve(255);
+			// Читаем во временный буфер: запись в str.c_str() за пределы size()
+			// затиралась бы нулями при последующем resize()
+			char buf[MY_PORT_READ_BUF];
 			size_t rd = 0;
-			ret = Read((void*)str.c_str(),str.capacity(),&rd);
-            if (ret != RE_OK)
-                return ret;
-			str.resize(rd);
+			int ret = Read(buf, sizeof(buf), &rd);
+			if (ret != RE_OK)
+				return ret;
+			str.assign(buf, rd);
 			return ret;
 		}
 
@@ -0,0 +1,294 @@
+// Модуль Python "templog": чтение логов фиксированной ширины средствами C++.
+//
+// Log.read() разбирает блоки лога (через общий кэш блоков) прямо в два
+// непрерывных столбца - время в мс (int64) и значение (float64) - и отдаёт их
+// объектами с буферным протоколом: numpy.asarray(column) и memoryview(column)
+// смотрят в память столбца без копирования. Log.aggregate() считает агрегат
+// диапазона по сводкам блоков и разбирает только крайние блоки, rank() - те же
+// ранжирующие запросы, что и "query --top".
+//
+//   import templog, numpy as np
+//   log = templog.open("log_temp_1.log")
+//   times, values = log.read("2026-01-01 00:00:00", "2026-01-31 23:59:59")
+//   v = np.asarray(values)
+//
+// Границы диапазона - строки UTC "YYYY-MM-DD HH:MM:SS[.mmm]" (правая без миллисекунд
+// включает всю секунду) или целые миллисекунды от эпохи.
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include "log_format.hpp"
+#include "history.hpp"
+#include "topk.hpp"
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Столбец: владеет вектором значений и отдаёт его через буферный протокол
+struct ColumnObject {
+    PyObject_HEAD
+    std::vector<int64_t>* times;  // Ровно один из двух векторов не пуст
+    std::vector<double>* values;
+    Py_ssize_t shape;
+    Py_ssize_t stride;
+};
+
+static void columnDealloc(ColumnObject* self) {
+    delete self->times;
+    delete self->values;
+    Py_TYPE(self)->tp_free((PyObject*)self);
+}
+
+static int columnGetBuffer(ColumnObject* self, Py_buffer* view, int flags) {
+    if (flags & PyBUF_WRITABLE) {
+        PyErr_SetString(PyExc_BufferError, "templog columns are read-only");
+        return -1;
+    }
+    view->obj = (PyObject*)self;
+    Py_INCREF(self);
+    view->buf = self->times ? (void*)self->times->data() : (void*)self->values->data();
+    view->itemsize = self->stride;
+    view->len = self->shape * self->stride;
+    view->readonly = 1;
+    view->ndim = 1;
+    view->format = (flags & PyBUF_FORMAT) ? (char*)(self->times ? "q" : "d") : nullptr;
+    view->shape = (flags & PyBUF_ND) ? &self->shape : nullptr;
+    view->strides = (flags & PyBUF_STRIDES) ? &self->stride : nullptr;
+    view->suboffsets = nullptr;
+    view->internal = nullptr;
+    return 0;
+}
+
+static Py_ssize_t columnLength(ColumnObject* self) {
+    return self->shape;
+}
+
+static PyBufferProcs column_buffer = {(getbufferproc)columnGetBuffer, nullptr};
+
+static PySequenceMethods column_sequence = {(lenfunc)columnLength};
+
+static PyTypeObject ColumnType = {PyVarObject_HEAD_INIT(nullptr, 0) "templog.Column"};
+
+static PyObject* newColumn(std::vector<int64_t>* times, std::vector<double>* values) {
+    ColumnObject* column = PyObject_New(ColumnObject, &ColumnType);
+    if (!column) {
+        delete times;
+        delete values;
+        return nullptr;
+    }
+    column->times = times;
+    column->values = values;
+    column->shape = (Py_ssize_t)(times ? times->size() : values->size());
+    column->stride = times ? (Py_ssize_t)sizeof(int64_t) : (Py_ssize_t)sizeof(double);
+    return (PyObject*)column;
+}
+
+// Открытый лог: свой файловый поток и кэш блоков; вызовы из разных потоков
+// Python сериализуются мьютексом, GIL на время чтения отпускается
+struct LogObject {
+    PyObject_HEAD
+    BlockCache* cache;
+    HistoryLog* log;
+    std::mutex* mutex;
+};
+
+static void logDealloc(LogObject* self) {
+    delete self->log;
+    delete self->cache;
+    delete self->mutex;
+    Py_TYPE(self)->tp_free((PyObject*)self);
+}
+
+static PyTypeObject LogType = {PyVarObject_HEAD_INIT(nullptr, 0) "templog.Log"};
+
+// Граница диапазона: строка времени или миллисекунды; upper - правая граница
+static bool parseBound(PyObject* object, bool upper, int64_t& time_ms) {
+    if (PyLong_Check(object)) {
+        time_ms = PyLong_AsLongLong(object);
+        return !PyErr_Occurred();
+    }
+    if (PyUnicode_Check(object)) {
+        Py_ssize_t size = 0;
+        const char* text = PyUnicode_AsUTF8AndSize(object, &size);
+        if (text && parseTimestamp(text, (size_t)size, time_ms)) {
+            if (upper && (size_t)size < TIMESTAMP_WIDTH)
+                time_ms += 999;
+            return true;
+        }
+    }
+    PyErr_SetString(PyExc_ValueError, "time must be \"YYYY-MM-DD HH:MM:SS[.mmm]\" or milliseconds since epoch");
+    return false;
+}
+
+static PyObject* templogOpen(PyObject*, PyObject* args, PyObject* kwargs) {
+    static const char* keywords[] = {"path", "cache_mb", nullptr};
+    const char* path = nullptr;
+    Py_ssize_t cache_mb = (Py_ssize_t)BLOCK_CACHE_DEFAULT_MB;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s|n", (char**)keywords, &path, &cache_mb))
+        return nullptr;
+    LogObject* self = PyObject_New(LogObject, &LogType);
+    if (!self)
+        return nullptr;
+    self->cache = new BlockCache((size_t)std::max<Py_ssize_t>(1, cache_mb) * 1024 * 1024);
+    self->log = new HistoryLog(path, self->cache);
+    self->mutex = new std::mutex();
+    if (!self->log->IsOpen()) {
+        Py_DECREF(self);
+        PyErr_Format(PyExc_OSError, "Failed to open log file: %s", path);
+        return nullptr;
+    }
+    return (PyObject*)self;
+}
+
+static PyObject* logRead(LogObject* self, PyObject* args) {
+    PyObject* from = nullptr;
+    PyObject* to = nullptr;
+    int64_t from_ms = 0, to_ms = 0;
+    if (!PyArg_ParseTuple(args, "OO", &from, &to) || !parseBound(from, false, from_ms) || !parseBound(to, true, to_ms))
+        return nullptr;
+    auto* times = new std::vector<int64_t>();
+    auto* values = new std::vector<double>();
+    Py_BEGIN_ALLOW_THREADS
+    {
+        std::lock_guard<std::mutex> lock(*self->mutex);
+        self->log->Refresh();
+        uint64_t begin = self->log->SeekOffset(from_ms);
+        size_t estimate = (size_t)((self->log->FileSize() - std::min(begin, self->log->FileSize())) / FIXED_LINE_SIZE);
+        times->reserve(estimate);
+        values->reserve(estimate);
+        self->log->ReadRange(from_ms, to_ms, [&](int64_t time_ms, double value) {
+            times->push_back(time_ms);
+            values->push_back(value);
+        });
+    }
+    Py_END_ALLOW_THREADS
+    PyObject* times_column = newColumn(times, nullptr);
+    PyObject* values_column = newColumn(nullptr, values);
+    if (!times_column || !values_column) {
+        Py_XDECREF(times_column);
+        Py_XDECREF(values_column);
+        return nullptr;
+    }
+    return Py_BuildValue("(NN)", times_column, values_column);
+}
+
+static PyObject* logAggregate(LogObject* self, PyObject* args) {
+    PyObject* from = nullptr;
+    PyObject* to = nullptr;
+    int64_t from_ms = 0, to_ms = 0;
+    if (!PyArg_ParseTuple(args, "OO", &from, &to) || !parseBound(from, false, from_ms) || !parseBound(to, true, to_ms))
+        return nullptr;
+    Partial partial;
+    Py_BEGIN_ALLOW_THREADS
+    {
+        std::lock_guard<std::mutex> lock(*self->mutex);
+        self->log->Refresh();
+        partial = self->log->Aggregate(from_ms, to_ms);
+    }
+    Py_END_ALLOW_THREADS
+    if (partial.count == 0)
+        return Py_BuildValue("{s:K,s:d,s:O,s:O,s:O}", "count", 0ULL, "sum", 0.0, "min", Py_None, "max", Py_None,
+                             "avg", Py_None);
+    return Py_BuildValue("{s:K,s:d,s:d,s:d,s:d}", "count", (unsigned long long)partial.count, "sum", partial.sum,
+                         "min", partial.min, "max", partial.max, "avg", partial.Average());
+}
+
+static PyObject* logFileName(LogObject* self, void*) {
+    return PyUnicode_FromString(self->log->FileName().c_str());
+}
+
+static PyMethodDef log_methods[] = {
+    {"read", (PyCFunction)logRead, METH_VARARGS,
+     "read(from, to) -> (times, values): columns of int64 ms and float64, zero-copy via the buffer protocol"},
+    {"aggregate", (PyCFunction)logAggregate, METH_VARARGS,
+     "aggregate(from, to) -> dict(count, sum, min, max, avg), whole blocks from their summaries"},
+    {nullptr, nullptr, 0, nullptr}
+};
+
+static PyGetSetDef log_getset[] = {
+    {"file_name", (getter)logFileName, nullptr, "log file name", nullptr},
+    {nullptr, nullptr, nullptr, nullptr, nullptr}
+};
+
+static PyObject* templogRank(PyObject*, PyObject* args, PyObject* kwargs) {
+    static const char* keywords[] = {"files", "from_time", "to_time", "k", "by", "bottom", "threads", nullptr};
+    PyObject* files_object = nullptr;
+    PyObject* from = nullptr;
+    PyObject* to = nullptr;
+    Py_ssize_t k = 10;
+    const char* by = "avg";
+    int bottom = 0;
+    Py_ssize_t threads = 1;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OOO|nspn", (char**)keywords, &files_object, &from, &to, &k, &by,
+                                     &bottom, &threads))
+        return nullptr;
+    RankQuery query;
+    int64_t from_ms = 0, to_ms = 0;
+    if (!parseBound(from, false, from_ms) || !parseBound(to, true, to_ms))
+        return nullptr;
+    if (!parseRankBy(by, query.by)) {
+        PyErr_SetString(PyExc_ValueError, "by must be 'avg', 'min' or 'max'");
+        return nullptr;
+    }
+    query.k = (size_t)std::max<Py_ssize_t>(0, k);
+    query.bottom = bottom != 0;
+    query.threads = (size_t)std::max<Py_ssize_t>(1, threads);
+
+    std::vector<std::string> files;
+    PyObject* sequence = PySequence_Fast(files_object, "files must be a sequence of paths");
+    if (!sequence)
+        return nullptr;
+    for (Py_ssize_t i = 0; i < PySequence_Fast_GET_SIZE(sequence); i++) {
+        const char* file = PyUnicode_AsUTF8(PySequence_Fast_GET_ITEM(sequence, i));
+        if (!file) {
+            Py_DECREF(sequence);
+            return nullptr;
+        }
+        files.push_back(file);
+    }
+    Py_DECREF(sequence);
+
+    std::vector<RankedLog> ranked;
+    Py_BEGIN_ALLOW_THREADS
+    BlockCache cache(BLOCK_CACHE_DEFAULT_MB * 1024 * 1024);
+    ranked = rankLogs(files, from_ms, to_ms, query, &cache);
+    Py_END_ALLOW_THREADS
+    PyObject* result = PyList_New((Py_ssize_t)ranked.size());
+    if (!result)
+        return nullptr;
+    for (size_t i = 0; i < ranked.size(); i++) {
+        PyList_SET_ITEM(result, (Py_ssize_t)i, Py_BuildValue("(sdK)", ranked[i].file_name.c_str(), ranked[i].value,
+                                                             (unsigned long long)ranked[i].count));
+    }
+    return result;
+}
+
+static PyMethodDef templog_methods[] = {
+    {"open", (PyCFunction)(void (*)(void))templogOpen, METH_VARARGS | METH_KEYWORDS,
+     "open(path, cache_mb=64) -> Log: fixed-width log opened read-only"},
+    {"rank", (PyCFunction)(void (*)(void))templogRank, METH_VARARGS | METH_KEYWORDS,
+     "rank(files, from_time, to_time, k=10, by='avg', bottom=False, threads=1) -> [(file, value, count)]"},
+    {nullptr, nullptr, 0, nullptr}
+};
+
+static PyModuleDef templog_module = {PyModuleDef_HEAD_INIT, "templog", "Read temp-logger logs from Python", -1,
+                                     templog_methods};
+
+PyMODINIT_FUNC PyInit_templog() {
+    ColumnType.tp_basicsize = sizeof(ColumnObject);
+    ColumnType.tp_flags = Py_TPFLAGS_DEFAULT;
+    ColumnType.tp_doc = "Read-only column of a templog series (buffer protocol)";
+    ColumnType.tp_dealloc = (destructor)columnDealloc;
+    ColumnType.tp_as_buffer = &column_buffer;
+    ColumnType.tp_as_sequence = &column_sequence;
+    LogType.tp_basicsize = sizeof(LogObject);
+    LogType.tp_flags = Py_TPFLAGS_DEFAULT;
+    LogType.tp_doc = "Fixed-width log opened read-only";
+    LogType.tp_dealloc = (destructor)logDealloc;
+    LogType.tp_methods = log_methods;
+    LogType.tp_getset = log_getset;
+    if (PyType_Ready(&ColumnType) < 0 || PyType_Ready(&LogType) < 0)
+        return nullptr;
+    return PyModule_Create(&templog_module);
+}
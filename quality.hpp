@@ -0,0 +1,95 @@
+#pragma once
+
+// Флаги качества отсчётов и их упакованный столбец.
+//
+// Флаги отсчёта - биты QualityFlag. В столбце они хранятся битовыми
+// плоскостями: для каждого флага свой массив слов по 64 отсчёта, т.е.
+// QUALITY_FLAG_COUNT бит (меньше байта) на отсчёт. Маска отбора для 64
+// отсчётов сразу получается одной операцией OR/AND над словами плоскостей,
+// а число отсчётов с флагом - подсчётом единичных битов.
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+// Флаги качества отсчёта
+enum QualityFlag : uint8_t {
+    QUALITY_REJECTED = 0x01,    // Отбракован фильтром выбросов (хранится, но не входит в агрегаты)
+    QUALITY_CALIBRATED = 0x02,  // К значению применена калибровка канала
+    QUALITY_LATE = 0x04,        // Пришёл после закрытия своего бакета (исправление роллапа)
+    QUALITY_DEVICE_TIME = 0x08, // Время пересчитано из часов устройства
+    QUALITY_GAP = 0x10          // Первый отсчёт после пробела (см. gaps.hpp)
+};
+
+const int QUALITY_FLAG_COUNT = 5;
+const char* const QUALITY_FLAG_NAMES[QUALITY_FLAG_COUNT] = {"rejected", "calibrated", "late", "device_time", "gap"};
+
+// Флаги, отсчёты с которыми по умолчанию не входят в агрегаты
+const uint8_t QUALITY_EXCLUDE_DEFAULT = QUALITY_REJECTED;
+
+// Биты слова word, соответствующие позициям [begin, end)
+inline uint64_t wordRangeMask(size_t word, size_t begin, size_t end) {
+    size_t first = word * 64;
+    uint64_t mask = ~0ULL;
+    if (begin > first)
+        mask &= ~0ULL << (begin - first);
+    if (end < first + 64)
+        mask &= (end > first) ? (~0ULL >> (64 - (end - first))) : 0;
+    return mask;
+}
+
+// Столбец флагов: битовая плоскость на каждый флаг
+class FlagColumn {
+public:
+    void PushBack(uint8_t flags) {
+        if (_size % 64 == 0) {
+            for (auto& plane : _planes)
+                plane.push_back(0);
+        }
+        for (int f = 0; f < QUALITY_FLAG_COUNT; f++) {
+            if (flags & (1 << f))
+                _planes[f].back() |= 1ULL << (_size % 64);
+        }
+        _size++;
+    }
+
+    uint8_t Get(size_t i) const {
+        uint8_t flags = 0;
+        for (int f = 0; f < QUALITY_FLAG_COUNT; f++) {
+            if (_planes[f][i / 64] & (1ULL << (i % 64)))
+                flags |= (uint8_t)(1 << f);
+        }
+        return flags;
+    }
+
+    void Reserve(size_t size) {
+        for (auto& plane : _planes)
+            plane.reserve((size + 63) / 64);
+    }
+
+    size_t Size() const {
+        return _size;
+    }
+
+    // Слово word маски отсчётов, у которых есть хотя бы один флаг из mask
+    uint64_t AnyWord(size_t word, uint8_t mask) const {
+        uint64_t bits = 0;
+        for (int f = 0; f < QUALITY_FLAG_COUNT; f++) {
+            if (mask & (1 << f))
+                bits |= _planes[f][word];
+        }
+        return bits;
+    }
+
+    // Число отсчётов с флагом номер flag среди позиций [begin, end)
+    uint64_t Count(int flag, size_t begin, size_t end) const {
+        uint64_t count = 0;
+        for (size_t word = begin / 64; word * 64 < end; word++)
+            count += __builtin_popcountll(_planes[flag][word] & wordRangeMask(word, begin, end));
+        return count;
+    }
+
+private:
+    size_t _size = 0;
+    std::vector<uint64_t> _planes[QUALITY_FLAG_COUNT];
+};
@@ -0,0 +1,467 @@
+#include "log_format.hpp"
+#include "history.hpp"
+#include "bucket_cache.hpp"
+#include "gaps.hpp"
+#include "align.hpp"
+#include "topk.hpp"
+#include "forecast.hpp"
+#include "correlation.hpp"
+#include "latest_board.hpp"
+#include "query_lang.hpp"
+#include <memory>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <algorithm>
+
+// Диапазон времени запроса
+struct TimeRange {
+    int64_t from_ms;
+    int64_t to_ms;
+};
+
+// Разбор границ диапазона; правая граница без миллисекунд включает всю секунду
+bool parseRange(const std::string& from, const std::string& to, TimeRange& range) {
+    if (!parseTimestamp(from, range.from_ms) || !parseTimestamp(to, range.to_ms))
+        return false;
+    if (to.size() < TIMESTAMP_WIDTH)
+        range.to_ms += 999;
+    return true;
+}
+
+void printUsage(const char* name) {
+    std::cout << "Usage: " << name << " [--avg | --gaps] [--cache-mb <mb>] [--stats] <log> <from> <to> [<from> <to> ...]" << std::endl;
+    std::cout << "       " << name << " --watch <sec> [--window <sec>] [--bucket <sec>] <log>" << std::endl;
+    std::cout << "       " << name << " --align <log> --align <log> [...] [--grid <sec>] [--fill locf|linear]"
+              << " [--op diff|ratio|spread] <from> <to>" << std::endl;
+    std::cout << "       " << name << " --top <k> | --bottom <k> [--by avg|min|max] [--threads <n>] [--stats]"
+              << " <from> <to> <log> [<log> ...]" << std::endl;
+    std::cout << "       " << name << " --forecast <state> <horizon sec>" << std::endl;
+    std::cout << "       " << name << " --correlation <group> [--covariance] <from> <to>" << std::endl;
+    std::cout << "       " << name << " --latest [<shared memory name>]" << std::endl;
+    std::cout << "       " << name << " [--cache-mb <mb>] [--stats] --sql \"SELECT avg(value) FROM channels WHERE ..."
+              << " GROUP BY time(1h), channel\"" << std::endl;
+    std::cout << "  time format: \"YYYY-MM-DD HH:MM:SS\" (UTC, as in fixed-width logs)" << std::endl;
+}
+
+// Скользящий запрос "среднее за последние window_ms", повторяемый каждые period_sec.
+// Закрытые бакеты считаются один раз, на каждом шаге читаются только дописанные строки.
+int watchWindow(HistoryLog& log, double period_sec, int64_t window_ms, int64_t bucket_ms) {
+    BucketCache buckets(bucket_ms);
+    uint64_t offset = log.SeekOffset(buckets.BucketStart(currentTimeMs() - window_ms));
+
+    for (;;) {
+        log.Refresh();
+        log.ReadAppended(offset, [&](int64_t time_ms, double value) {
+            buckets.Add(time_ms, value);
+        });
+
+        int64_t now_ms = currentTimeMs();
+        buckets.DropBefore(now_ms - window_ms);
+        Partial window = buckets.Window(now_ms, window_ms);
+        std::cout << formatTimestamp(now_ms) << ": count " << window.count
+                  << ", avg " << window.Average();
+        if (window.count > 0) {
+            std::cout << ", min " << window.min << ", max " << window.max;
+        }
+        std::cout << std::endl;
+
+        std::this_thread::sleep_for(std::chrono::milliseconds((int64_t)(period_sec * 1e3)));
+    }
+    return 0;
+}
+
+// Выровненный по времени вывод нескольких логов: "<время>: <v1> <v2> ... [<операция>]",
+// неизвестное значение - "-"
+int alignLogs(const std::vector<std::string>& files, const TimeRange& range, int64_t grid_ms, FillMode fill,
+              SeriesOp op, BlockCache& cache) {
+    std::vector<std::unique_ptr<HistoryLog>> logs;
+    std::vector<HistoryCursor> cursors;
+    for (const auto& file : files) {
+        logs.emplace_back(new HistoryLog(file, &cache));
+        if (!logs.back()->IsOpen()) {
+            std::cout << "Failed to open log file: " << file << std::endl;
+            return -2;
+        }
+        cursors.emplace_back(*logs.back(), range.from_ms, range.to_ms);
+    }
+
+    alignSeries(cursors, range.from_ms, range.to_ms, grid_ms, fill,
+                [&](int64_t time_ms, const std::vector<double>& values, const std::vector<char>& known) {
+        std::cout << formatTimestamp(time_ms) << ':';
+        for (size_t i = 0; i < values.size(); i++) {
+            std::cout << ' ' << (known[i] ? formatValue(values[i]) : std::string(VALUE_WIDTH - 1, ' ') + "-");
+        }
+        double result = 0.0;
+        if (op != SERIES_OP_NONE) {
+            bool ok = applySeriesOp(op, values, known, result);
+            std::cout << " | " << (ok ? formatValue(result) : std::string(VALUE_WIDTH - 1, ' ') + "-");
+        }
+        std::cout << '\n';
+    });
+    return 0;
+}
+
+// Ранжирование логов каналов (обычно логов роллапов): "<место>. <лог>: <значение> (n=<отсчётов>)"
+int rankLogFiles(const std::vector<std::string>& files, const TimeRange& range, const RankQuery& query,
+                 bool print_stats, BlockCache& cache) {
+    RankStats stats;
+    auto ranked = rankLogs(files, range.from_ms, range.to_ms, query, &cache, &stats);
+    for (size_t i = 0; i < ranked.size(); i++) {
+        std::cout << i + 1 << ". " << ranked[i].file_name << ": " << ranked[i].value
+                  << " (n=" << ranked[i].count << ")\n";
+    }
+    if (print_stats) {
+        std::cerr << "logs: scanned " << stats.scanned << ", pruned " << stats.pruned
+                  << ", missing " << stats.missing << std::endl;
+    }
+    return 0;
+}
+
+// Прогноз по сохранённой модели канала на horizon_ms после её последнего бакета:
+// "<начало бакета>: <прогноз> [<нижняя граница>, <верхняя граница>]"
+int printForecast(const std::string& state_file, int64_t horizon_ms) {
+    HoltWinters model;
+    if (!model.Load(state_file)) {
+        std::cout << "Failed to load forecast state: " << state_file << std::endl;
+        return -2;
+    }
+    if (!model.Ready()) {
+        std::cout << "Forecast model is still learning its first season" << std::endl;
+        return 0;
+    }
+    int64_t steps = std::max<int64_t>(1, (horizon_ms + model.BucketMs() - 1) / model.BucketMs());
+    model.Project(steps, [&](int64_t start_ms, const Forecast& forecast) {
+        std::cout << formatTimestamp(start_ms) << ": " << formatValue(forecast.value)
+                  << " [" << formatValue(forecast.low) << ", " << formatValue(forecast.high) << "]\n";
+        return true;
+    });
+    return 0;
+}
+
+// Матрица корреляций (или ковариаций) группы за диапазон по файлу статистик;
+// "-" - у пары меньше двух общих точек или постоянный ряд
+int printCorrelation(const std::string& group, const TimeRange& range, bool covariance) {
+    std::vector<uint32_t> channels;
+    std::vector<PairMoments> pairs;
+    size_t buckets = 0;
+    if (!loadMoments(momentsFileName(group), range.from_ms, range.to_ms, channels, pairs, buckets)) {
+        std::cout << "Failed to open correlation statistics: " << momentsFileName(group) << std::endl;
+        return -2;
+    }
+    size_t k = channels.size();
+    std::cout << std::string(VALUE_WIDTH, ' ');
+    for (uint32_t channel : channels) {
+        std::string name = std::to_string(channel);
+        std::cout << ' ' << std::string(VALUE_WIDTH - std::min(VALUE_WIDTH, name.size()), ' ') << name;
+    }
+    std::cout << '\n';
+    for (size_t i = 0; i < k; i++) {
+        std::string name = std::to_string(channels[i]);
+        std::cout << std::string(VALUE_WIDTH - std::min(VALUE_WIDTH, name.size()), ' ') << name;
+        for (size_t j = 0; j < k; j++) {
+            double value = 1.0;
+            if (i != j) {
+                const PairMoments& pair = pairs[pairIndex(i, j, k)];
+                value = covariance ? (pair.n > 1 ? pair.Covariance() : std::nan("")) : pair.Correlation();
+            } else if (covariance) {
+                value = std::nan(""); // Дисперсии каналов по отдельности не хранятся
+            }
+            std::cout << ' ' << (std::isnan(value) ? std::string(VALUE_WIDTH - 1, ' ') + "-" : formatValue(value));
+        }
+        std::cout << '\n';
+    }
+    std::cout << "buckets " << buckets << std::endl;
+    return 0;
+}
+
+// Табло последних значений из разделяемой памяти процесса приёма:
+// "<канал>: <время> <значение> age <давность> s [<флаги качества>]"
+int printLatest(const std::string& shm_name) {
+    LatestBoard board;
+    std::string errors;
+    if (!board.OpenShared(shm_name, errors)) {
+        std::cout << errors;
+        return -2;
+    }
+    std::vector<LatestValue> values;
+    board.Snapshot(values);
+    int64_t now_ms = currentTimeMs();
+    std::sort(values.begin(), values.end(), [](const LatestValue& a, const LatestValue& b) {
+        return a.channel < b.channel;
+    });
+    for (const auto& value : values) {
+        std::cout << value.channel << ": " << formatTimestamp(value.time_ms) << ' ' << formatValue(value.value)
+                  << " age " << (now_ms - value.time_ms) / 1000.0 << " s";
+        for (int f = 0; f < QUALITY_FLAG_COUNT; f++) {
+            if (value.flags & (1 << f))
+                std::cout << ' ' << QUALITY_FLAG_NAMES[f];
+        }
+        std::cout << '\n';
+    }
+    return 0;
+}
+
+// Запрос на языке запросов (query_lang.hpp): строка заголовка и строки
+// "[<бакет>] [<канал>] <значения агрегатов...>"; для EXPLAIN - план и счётчики блоков
+int runSql(const std::string& text, bool print_stats, BlockCache& cache) {
+    QueryPlan plan;
+    std::string error;
+    if (!parseQuery(text, plan, error)) {
+        std::cout << "Query error: " << error << std::endl;
+        return -1;
+    }
+    // Запрос идёт рядом с приёмом: процессор и диск - после него
+    lowerThreadPriority();
+    QueryCounters counters;
+    auto rows = runQuery(plan, &cache, &counters);
+    if (plan.explain) {
+        std::cout << describePlan(plan, &counters) << "rows " << rows.size() << std::endl;
+        return 0;
+    }
+
+    if (plan.bucket_ms > 0)
+        std::cout << std::left << std::setw(TIMESTAMP_WIDTH) << "time" << ' ';
+    if (plan.by_channel)
+        std::cout << "channel ";
+    for (size_t c = 0; c < plan.columns.size(); c++) {
+        std::cout << std::right << std::setw(VALUE_WIDTH) << plan.columns[c];
+        if (plan.approximate)
+            std::cout << ' ' << std::setw(VALUE_WIDTH) << "+-error";
+        std::cout << (c + 1 < plan.columns.size() ? " " : "");
+    }
+    std::cout << '\n';
+    for (const auto& row : rows) {
+        if (plan.bucket_ms > 0)
+            std::cout << formatTimestamp(row.bucket_ms) << ' ';
+        if (plan.by_channel)
+            std::cout << std::right << std::setw(7) << row.channel << ' ';
+        for (size_t c = 0; c < plan.aggregates.size(); c++) {
+            double value = queryValue(plan.aggregates[c], row);
+            if (plan.aggregates[c] == QUERY_COUNT && row.estimate.pending.count == 0)
+                std::cout << std::right << std::setw(VALUE_WIDTH) << row.partial.count;
+            else
+                std::cout << formatValue(value);
+            if (plan.approximate)
+                std::cout << ' ' << formatValue(queryError(plan.aggregates[c], row));
+            std::cout << (c + 1 < plan.aggregates.size() ? " " : "");
+        }
+        std::cout << '\n';
+    }
+    if (print_stats)
+        std::cerr << describePlan(plan, &counters);
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    bool print_avg = false;
+    bool print_gaps = false;
+    bool print_stats = false;
+    size_t cache_mb = BLOCK_CACHE_DEFAULT_MB;
+    double watch_sec = 0.0;
+    int64_t window_ms = 24 * 60 * 60 * 1000LL;
+    int64_t bucket_ms = BUCKET_MS_DEFAULT;
+    std::vector<std::string> positional;
+    std::vector<std::string> align_files;
+    int64_t grid_ms = 0;
+    FillMode fill = FILL_LOCF;
+    SeriesOp op = SERIES_OP_NONE;
+    std::string forecast_state;
+    std::string correlation_group;
+    bool covariance = false;
+    bool rank = false;
+    bool latest = false;
+    std::string sql;
+    RankQuery rank_query;
+    rank_query.threads = std::max(1u, std::thread::hardware_concurrency());
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--avg") {
+            print_avg = true;
+        } else if (arg == "--gaps") {
+            print_gaps = true;
+        } else if (arg == "--stats") {
+            print_stats = true;
+        } else if (arg == "--cache-mb" && i + 1 < argc) {
+            cache_mb = (size_t)std::atol(argv[++i]);
+        } else if (arg == "--watch" && i + 1 < argc) {
+            watch_sec = std::atof(argv[++i]);
+        } else if (arg == "--window" && i + 1 < argc) {
+            window_ms = (int64_t)(std::atof(argv[++i]) * 1e3);
+        } else if (arg == "--bucket" && i + 1 < argc) {
+            bucket_ms = (int64_t)(std::atof(argv[++i]) * 1e3);
+        } else if (arg == "--align" && i + 1 < argc) {
+            align_files.push_back(argv[++i]);
+        } else if (arg == "--grid" && i + 1 < argc) {
+            grid_ms = (int64_t)(std::atof(argv[++i]) * 1e3);
+        } else if (arg == "--fill" && i + 1 < argc) {
+            if (!parseFillMode(argv[++i], fill)) {
+                printUsage(argv[0]);
+                return -1;
+            }
+        } else if (arg == "--op" && i + 1 < argc) {
+            if (!parseSeriesOp(argv[++i], op)) {
+                printUsage(argv[0]);
+                return -1;
+            }
+        } else if ((arg == "--top" || arg == "--bottom") && i + 1 < argc) {
+            rank = true;
+            rank_query.bottom = (arg == "--bottom");
+            rank_query.k = (size_t)std::atol(argv[++i]);
+        } else if (arg == "--by" && i + 1 < argc) {
+            if (!parseRankBy(argv[++i], rank_query.by)) {
+                printUsage(argv[0]);
+                return -1;
+            }
+        } else if (arg == "--correlation" && i + 1 < argc) {
+            correlation_group = argv[++i];
+        } else if (arg == "--covariance") {
+            covariance = true;
+        } else if (arg == "--forecast" && i + 1 < argc) {
+            forecast_state = argv[++i];
+        } else if (arg == "--sql" && i + 1 < argc) {
+            sql = argv[++i];
+        } else if (arg == "--latest") {
+            latest = true;
+        } else if (arg == "--threads" && i + 1 < argc) {
+            rank_query.threads = (size_t)std::max(1L, std::atol(argv[++i]));
+        } else {
+            positional.push_back(arg);
+        }
+    }
+
+    if (watch_sec > 0.0 && positional.size() == 1) {
+        HistoryLog log(positional[0]);
+        if (!log.IsOpen()) {
+            std::cout << "Failed to open log file: " << positional[0] << std::endl;
+            return -2;
+        }
+        return watchWindow(log, watch_sec, window_ms, bucket_ms);
+    }
+
+    if (!align_files.empty()) {
+        TimeRange range;
+        if (positional.size() != 2 || !parseRange(positional[0], positional[1], range)) {
+            printUsage(argv[0]);
+            return -1;
+        }
+        BlockCache cache(cache_mb * 1024 * 1024);
+        return alignLogs(align_files, range, grid_ms, fill, op, cache);
+    }
+
+    if (!sql.empty()) {
+        if (!positional.empty()) {
+            printUsage(argv[0]);
+            return -1;
+        }
+        BlockCache cache(cache_mb * 1024 * 1024);
+        return runSql(sql, print_stats, cache);
+    }
+
+    if (latest) {
+        if (positional.size() > 1) {
+            printUsage(argv[0]);
+            return -1;
+        }
+        return printLatest(positional.empty() ? LATEST_BOARD_SHM_DEFAULT : positional[0]);
+    }
+
+    if (!forecast_state.empty()) {
+        if (positional.size() != 1) {
+            printUsage(argv[0]);
+            return -1;
+        }
+        return printForecast(forecast_state, (int64_t)(std::atof(positional[0].c_str()) * 1e3));
+    }
+
+    if (!correlation_group.empty()) {
+        TimeRange range;
+        if (positional.size() != 2 || !parseRange(positional[0], positional[1], range)) {
+            printUsage(argv[0]);
+            return -1;
+        }
+        return printCorrelation(correlation_group, range, covariance);
+    }
+
+    if (rank) {
+        TimeRange range;
+        if (positional.size() < 3 || !parseRange(positional[0], positional[1], range)) {
+            printUsage(argv[0]);
+            return -1;
+        }
+        BlockCache cache(cache_mb * 1024 * 1024);
+        std::vector<std::string> files(positional.begin() + 2, positional.end());
+        return rankLogFiles(files, range, rank_query, print_stats, cache);
+    }
+
+    if (positional.size() < 3 || positional.size() % 2 != 1) {
+        printUsage(argv[0]);
+        return -1;
+    }
+
+    std::vector<TimeRange> ranges;
+    for (size_t i = 1; i + 1 < positional.size(); i += 2) {
+        TimeRange range;
+        if (!parseRange(positional[i], positional[i + 1], range)) {
+            std::cout << "Failed to parse time range" << std::endl;
+            return -1;
+        }
+        ranges.push_back(range);
+    }
+
+    // Пробелы и покрытие читаются только из индекса пробелов, без самого лога
+    if (print_gaps) {
+        GapIndex gaps;
+        if (!gaps.Load(gapFileName(positional[0]))) {
+            std::cout << "Failed to open gap index: " << gapFileName(positional[0]) << std::endl;
+            return -2;
+        }
+        for (const auto& range : ranges) {
+            for (const auto& gap : gaps.Overlapping(range.from_ms, range.to_ms + 1)) {
+                std::cout << formatTimestamp(gap.start_ms) << " - " << formatTimestamp(gap.end_ms)
+                          << ": " << (gap.end_ms - gap.start_ms) / 1000.0 << " s\n";
+            }
+            std::cout << formatTimestamp(range.from_ms) << " - " << formatTimestamp(range.to_ms)
+                      << ": coverage " << gaps.Coverage(range.from_ms, range.to_ms + 1) << '\n';
+        }
+        return 0;
+    }
+
+    BlockCache cache(cache_mb * 1024 * 1024);
+    HistoryLog log(positional[0], &cache);
+    if (!log.IsOpen()) {
+        std::cout << "Failed to open log file: " << positional[0] << std::endl;
+        return -2;
+    }
+
+    for (const auto& range : ranges) {
+        if (print_avg) {
+            size_t count = 0;
+            double sum = 0.0;
+            log.ReadRange(range.from_ms, range.to_ms, [&](int64_t, double value) {
+                sum += value;
+                count++;
+            });
+            std::cout << formatTimestamp(range.from_ms) << " - " << formatTimestamp(range.to_ms)
+                      << ": count " << count << ", avg " << (count > 0 ? sum / count : 0.0) << '\n';
+        } else {
+            log.ReadRange(range.from_ms, range.to_ms, [&](int64_t time_ms, double value) {
+                std::cout << formatFixedLine(time_ms, value) << '\n';
+            });
+        }
+    }
+
+    if (print_stats) {
+        CacheStats stats = cache.Stats();
+        std::cerr << "block cache: hits " << stats.hits << ", misses " << stats.misses
+                  << ", evictions " << stats.evictions << ", usage " << stats.usage
+                  << "/" << stats.capacity << " bytes" << std::endl;
+    }
+
+    return 0;
+}
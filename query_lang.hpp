@@ -0,0 +1,885 @@
+#pragma once
+
+// Язык запросов к логам каналов:
+//
+//   [EXPLAIN] SELECT <агрегат>(value) [, ...] FROM <источник>[(<каналы>)]
+//     [WHERE <условие> [AND <условие> ...]] [GROUP BY time(<шаг>) [, channel]]
+//     [APPROXIMATE [ERROR <погрешность>[%]] [TIMEOUT <шаг>]]
+//
+// Агрегаты - avg, min, max, sum, count (count(*) тоже можно). Источник -
+// уровень хранения: channels (отсчёты, логи log_temp*), hour или day
+// (роллапы log_avg_temp_hour*/log_avg_temp_day*); без списка каналов берутся
+// все логи источника в текущем каталоге. Условия: time и value со сравнениями
+// <, <=, >, >=, = и BETWEEN ... AND ..., channel = <n> и channel IN (<n>, ...).
+// Время - строка UTC 'YYYY-MM-DD HH:MM:SS[.mmm]' или миллисекунды от эпохи,
+// шаг - число с единицей ms, s, m, h или d. Например:
+//   SELECT avg(value), max(value) FROM channels WHERE time >= '2026-01-01 00:00:00'
+//     AND value > -50 GROUP BY time(1h), channel
+//
+// Запрос разбирается в план: список логов, диапазон времени, интервал
+// значений и бакеты. Исполнение идёт по блокам лога: блок вне диапазона или
+// с интервалом значений из сводки, не пересекающимся с условием, отсекается;
+// закрытый блок, целиком лежащий в диапазоне, в одном бакете и (при условии
+// на значения) целиком ему удовлетворяющий, берётся из сводки; остальные
+// блоки разбираются в столбцы, и отрезки одного бакета агрегируются
+// векторным проходом по столбцу значений.
+//
+// APPROXIMATE не разбирает блоки со сводками: вклад такого блока в строку
+// оценивается по доле его времени (и интервала значений при условии на них),
+// а строка получает гарантированные пределы каждого агрегата - в неё может
+// попасть от нуля до всех отсчётов блока с любыми значениями из его сводки.
+// Для исследования всей истории этого обычно хватает: разбирается не больше
+// последнего, ещё растущего блока лога. С ERROR строки, чья погрешность
+// (наибольшее отличие точного значения от ответа, абсолютное или в процентах
+// от значения) больше заданной, уточняются разбором своих блоков - худшие
+// первыми, пока все не уложатся в погрешность или не выйдет TIMEOUT;
+// APPROXIMATE TIMEOUT без ERROR уточняет ответ до точного, сколько успеет.
+//
+// Блок - и кусок работы для планировщика запросов (query_scheduler.hpp):
+// перед разбором каждого лога и после разбора каждого блока исполнение
+// проверяет отмену и бюджеты и уступает приёму.
+
+#include "history.hpp"
+#include "bucket_cache.hpp"
+#include "log_format.hpp"
+#include "query_scheduler.hpp"
+#include <map>
+#include <cmath>
+#include <chrono>
+#include <memory>
+#include <cctype>
+#include <limits>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstdlib>
+#include <sstream>
+#include <algorithm>
+#include <filesystem>
+
+enum QueryAggregate {
+    QUERY_AVG,
+    QUERY_MIN,
+    QUERY_MAX,
+    QUERY_SUM,
+    QUERY_COUNT
+};
+
+struct QueryPlan {
+    bool explain = false;
+    std::vector<QueryAggregate> aggregates;
+    std::vector<std::string> columns;     // Имена столбцов результата, как в запросе
+    std::string source;                   // Имя источника из запроса
+    std::string log_base;                 // Базовое имя логов источника
+    bool all_channels = true;
+    std::vector<uint32_t> channels;       // Каналы (если не все), по возрастанию
+    int64_t from_ms = std::numeric_limits<int64_t>::min();
+    int64_t to_ms = std::numeric_limits<int64_t>::max();
+    bool value_filter = false;
+    double value_min = -std::numeric_limits<double>::infinity();
+    double value_max = std::numeric_limits<double>::infinity();
+    int64_t bucket_ms = 0;                // 0 - без группировки по времени
+    bool by_channel = false;
+    bool approximate = false;
+    double max_error = 0.0;               // Допустимая погрешность (queryError); 0 - только сводки
+    bool relative_error = false;          // max_error - доля значения
+    int64_t timeout_ms = 0;               // Ограничение времени уточнения (0 - без ограничения)
+};
+
+// Приближённый запрос: вклад блоков строки, оставшихся неразобранными
+struct QueryEstimate {
+    Partial pending;        // Сводки блоков целиком (count == 0 - строка точная)
+    double count = 0.0;     // Оценка числа отобранных отсчётов блоков в строке (по доле времени и значений)
+    double sum = 0.0;       // Оценка их суммы
+    double sum_low = 0.0;   // Пределы их суммы
+    double sum_high = 0.0;
+};
+
+// Строка результата: бакет (0 без группировки по времени), канал (0 без группировки по каналам)
+struct QueryRow {
+    int64_t bucket_ms;
+    uint32_t channel;
+    Partial partial;        // Агрегат (в приближённом запросе - по разобранным блокам и целым сводкам)
+    QueryEstimate estimate;
+};
+
+// Как исполнялся запрос: логи и блоки по способу чтения
+struct QueryCounters {
+    size_t logs = 0;
+    size_t blocks_pruned = 0;
+    size_t blocks_from_stats = 0;
+    size_t blocks_decoded = 0;
+    size_t blocks_estimated = 0;  // Приближённый запрос: оценены по сводкам
+};
+
+// Лог канала источника: для канала 0 - "<base>.log", для остальных - "<base>_<канал>.log"
+inline std::string queryLogName(const std::string& base, uint32_t channel) {
+    return (channel == 0) ? base + ".log" : base + "_" + std::to_string(channel) + ".log";
+}
+
+// Логи источника в каталоге: канал -> имя файла
+inline std::map<uint32_t, std::string> findChannelLogs(const std::string& base, const std::string& directory = ".") {
+    std::map<uint32_t, std::string> channels;
+    std::error_code ec;
+    for (const auto& entry : std::filesystem::directory_iterator(directory, ec)) {
+        std::string name = entry.path().filename().string();
+        if (name == base + ".log") {
+            channels.emplace(0, name);
+            continue;
+        }
+        std::string prefix = base + "_";
+        if (name.size() <= prefix.size() + 4 || name.compare(0, prefix.size(), prefix) != 0 ||
+            name.compare(name.size() - 4, 4, ".log") != 0)
+            continue;
+        std::string number = name.substr(prefix.size(), name.size() - prefix.size() - 4);
+        if (number.size() <= 9 && number.find_first_not_of("0123456789") == std::string::npos)
+            channels.emplace((uint32_t)std::stoul(number), name);
+    }
+    return channels;
+}
+
+class QueryParser {
+public:
+    explicit QueryParser(const std::string& text) {
+        Tokenize(text);
+    }
+
+    bool Parse(QueryPlan& plan, std::string& error) {
+        plan = QueryPlan();
+        _error.clear();
+        bool ok = ParseQuery(plan);
+        if (ok && _pos < _tokens.size())
+            ok = Fail("unexpected '" + _tokens[_pos].text + "'");
+        error = _error;
+        return ok;
+    }
+
+private:
+    enum TokenKind {
+        TOKEN_WORD,
+        TOKEN_NUMBER,
+        TOKEN_STRING,
+        TOKEN_SYMBOL
+    };
+
+    struct Token {
+        TokenKind kind;
+        std::string text;
+    };
+
+    void Tokenize(const std::string& text) {
+        size_t i = 0;
+        while (i < text.size()) {
+            char c = text[i];
+            if (std::isspace((unsigned char)c)) {
+                i++;
+            } else if (std::isalpha((unsigned char)c) || c == '_') {
+                size_t begin = i;
+                while (i < text.size() && (std::isalnum((unsigned char)text[i]) || text[i] == '_'))
+                    i++;
+                _tokens.push_back(Token{TOKEN_WORD, text.substr(begin, i - begin)});
+            } else if (std::isdigit((unsigned char)c) || c == '.' || (c == '-' && i + 1 < text.size() &&
+                       (std::isdigit((unsigned char)text[i + 1]) || text[i + 1] == '.'))) {
+                // Число вместе с единицей длительности ("15m")
+                size_t begin = i++;
+                while (i < text.size() && (std::isalnum((unsigned char)text[i]) || text[i] == '.'))
+                    i++;
+                _tokens.push_back(Token{TOKEN_NUMBER, text.substr(begin, i - begin)});
+            } else if (c == '\'' || c == '"') {
+                size_t end = text.find(c, i + 1);
+                if (end == std::string::npos)
+                    end = text.size();
+                _tokens.push_back(Token{TOKEN_STRING, text.substr(i + 1, end - i - 1)});
+                i = end + 1;
+            } else if ((c == '<' || c == '>') && i + 1 < text.size() && text[i + 1] == '=') {
+                _tokens.push_back(Token{TOKEN_SYMBOL, text.substr(i, 2)});
+                i += 2;
+            } else {
+                _tokens.push_back(Token{TOKEN_SYMBOL, std::string(1, c)});
+                i++;
+            }
+        }
+    }
+
+    bool Fail(const std::string& message) {
+        if (_error.empty())
+            _error = message;
+        return false;
+    }
+
+    static std::string Lower(std::string text) {
+        for (auto& c : text)
+            c = (char)std::tolower((unsigned char)c);
+        return text;
+    }
+
+    // Следующее слово (без учёта регистра) или символ равен text: пропустить его
+    bool Accept(const std::string& text) {
+        if (_pos >= _tokens.size() || _tokens[_pos].kind == TOKEN_STRING || _tokens[_pos].kind == TOKEN_NUMBER)
+            return false;
+        if (Lower(_tokens[_pos].text) != text)
+            return false;
+        _pos++;
+        return true;
+    }
+
+    bool Expect(const std::string& text) {
+        if (Accept(text))
+            return true;
+        return Fail("expected '" + text + "'" + (_pos < _tokens.size() ? " at '" + _tokens[_pos].text + "'" : ""));
+    }
+
+    bool Word(std::string& word) {
+        if (_pos >= _tokens.size() || _tokens[_pos].kind != TOKEN_WORD)
+            return Fail("expected a name");
+        word = Lower(_tokens[_pos++].text);
+        return true;
+    }
+
+    bool Number(double& value) {
+        if (_pos >= _tokens.size() || _tokens[_pos].kind != TOKEN_NUMBER)
+            return Fail("expected a number");
+        const std::string& text = _tokens[_pos++].text;
+        char* end = nullptr;
+        value = std::strtod(text.c_str(), &end);
+        if (end != text.c_str() + text.size())
+            return Fail("invalid number '" + text + "'");
+        return true;
+    }
+
+    bool Channel(uint32_t& channel) {
+        double value = 0.0;
+        if (!Number(value))
+            return false;
+        if (value < 0 || value != std::floor(value) || value >= 4294967295.0)
+            return Fail("invalid channel");
+        channel = (uint32_t)value;
+        return true;
+    }
+
+    bool ChannelList(std::vector<uint32_t>& channels) {
+        if (!Expect("("))
+            return false;
+        do {
+            uint32_t channel = 0;
+            if (!Channel(channel))
+                return false;
+            channels.push_back(channel);
+        } while (Accept(","));
+        std::sort(channels.begin(), channels.end());
+        channels.erase(std::unique(channels.begin(), channels.end()), channels.end());
+        return Expect(")");
+    }
+
+    // Граница времени; upper - правая граница, без миллисекунд включающая всю секунду
+    bool Time(int64_t& time_ms, bool upper) {
+        if (_pos < _tokens.size() && _tokens[_pos].kind == TOKEN_STRING) {
+            const std::string& text = _tokens[_pos++].text;
+            if (!parseTimestamp(text, time_ms))
+                return Fail("invalid time '" + text + "'");
+            if (upper && text.size() < TIMESTAMP_WIDTH)
+                time_ms += 999;
+            return true;
+        }
+        double value = 0.0;
+        if (!Number(value))
+            return false;
+        time_ms = (int64_t)value;
+        return true;
+    }
+
+    bool Duration(int64_t& duration_ms) {
+        if (_pos >= _tokens.size() || _tokens[_pos].kind != TOKEN_NUMBER)
+            return Fail("expected a duration");
+        const std::string& text = _tokens[_pos++].text;
+        char* end = nullptr;
+        double value = std::strtod(text.c_str(), &end);
+        std::string unit = Lower(end);
+        double scale = 0.0;
+        if (unit == "ms")
+            scale = 1.0;
+        else if (unit == "s" || unit.empty())
+            scale = 1000.0;
+        else if (unit == "m")
+            scale = 60 * 1000.0;
+        else if (unit == "h")
+            scale = 60 * 60 * 1000.0;
+        else if (unit == "d")
+            scale = 24 * 60 * 60 * 1000.0;
+        duration_ms = (int64_t)(value * scale);
+        if (scale == 0.0 || duration_ms <= 0)
+            return Fail("invalid duration '" + text + "'");
+        return true;
+    }
+
+    bool ParseQuery(QueryPlan& plan) {
+        plan.explain = Accept("explain");
+        if (!Expect("select"))
+            return false;
+        do {
+            if (!ParseAggregate(plan))
+                return false;
+        } while (Accept(","));
+
+        if (!Expect("from") || !Word(plan.source))
+            return false;
+        if (plan.source == "channels")
+            plan.log_base = "log_temp";
+        else if (plan.source == "hour" || plan.source == "day")
+            plan.log_base = "log_avg_temp_" + plan.source;
+        else
+            return Fail("unknown source '" + plan.source + "' (channels, hour or day)");
+        if (_pos < _tokens.size() && _tokens[_pos].text == "(") {
+            plan.all_channels = false;
+            if (!ChannelList(plan.channels))
+                return false;
+        }
+
+        if (Accept("where")) {
+            do {
+                if (!ParseCondition(plan))
+                    return false;
+            } while (Accept("and"));
+        }
+
+        if (Accept("group")) {
+            if (!Expect("by"))
+                return false;
+            do {
+                if (Accept("channel")) {
+                    plan.by_channel = true;
+                } else if (Accept("time")) {
+                    if (!Expect("(") || !Duration(plan.bucket_ms) || !Expect(")"))
+                        return false;
+                } else {
+                    return Fail("expected time(<step>) or channel in GROUP BY");
+                }
+            } while (Accept(","));
+        }
+
+        if (Accept("approximate")) {
+            plan.approximate = true;
+            if (Accept("error")) {
+                if (!Number(plan.max_error))
+                    return false;
+                plan.relative_error = Accept("%");
+                if (plan.relative_error)
+                    plan.max_error /= 100;
+                if (!(plan.max_error > 0))
+                    return Fail("error must be positive");
+            }
+            if (Accept("timeout") && !Duration(plan.timeout_ms))
+                return false;
+        }
+        return true;
+    }
+
+    bool ParseAggregate(QueryPlan& plan) {
+        size_t begin = _pos;
+        std::string name;
+        if (!Word(name))
+            return false;
+        QueryAggregate aggregate;
+        if (name == "avg")
+            aggregate = QUERY_AVG;
+        else if (name == "min")
+            aggregate = QUERY_MIN;
+        else if (name == "max")
+            aggregate = QUERY_MAX;
+        else if (name == "sum")
+            aggregate = QUERY_SUM;
+        else if (name == "count")
+            aggregate = QUERY_COUNT;
+        else
+            return Fail("unknown aggregate '" + name + "'");
+        if (!Expect("("))
+            return false;
+        if (!(aggregate == QUERY_COUNT && Accept("*")) && !Expect("value"))
+            return false;
+        if (!Expect(")"))
+            return false;
+        std::string column;
+        for (size_t i = begin; i < _pos; i++)
+            column += _tokens[i].text;
+        plan.aggregates.push_back(aggregate);
+        plan.columns.push_back(Lower(column));
+        return true;
+    }
+
+    bool ParseCondition(QueryPlan& plan) {
+        std::string field;
+        if (!Word(field))
+            return false;
+
+        if (field == "channel") {
+            std::vector<uint32_t> channels;
+            if (Accept("in")) {
+                if (!ChannelList(channels))
+                    return false;
+            } else {
+                uint32_t channel = 0;
+                if (!Expect("=") || !Channel(channel))
+                    return false;
+                channels.push_back(channel);
+            }
+            if (plan.all_channels) {
+                plan.channels = channels;
+            } else {
+                std::vector<uint32_t> common;
+                std::set_intersection(plan.channels.begin(), plan.channels.end(), channels.begin(), channels.end(),
+                                      std::back_inserter(common));
+                plan.channels = common;
+            }
+            plan.all_channels = false;
+            return true;
+        }
+
+        if (field == "time") {
+            int64_t from_ms = std::numeric_limits<int64_t>::min(), to_ms = std::numeric_limits<int64_t>::max();
+            if (Accept("between")) {
+                if (!Time(from_ms, false) || !Expect("and") || !Time(to_ms, true))
+                    return false;
+            } else if (Accept(">=")) {
+                if (!Time(from_ms, false))
+                    return false;
+            } else if (Accept(">")) {
+                if (!Time(from_ms, true))
+                    return false;
+                from_ms++;
+            } else if (Accept("<=")) {
+                if (!Time(to_ms, true))
+                    return false;
+            } else if (Accept("<")) {
+                if (!Time(to_ms, false))
+                    return false;
+                to_ms--;
+            } else if (Accept("=")) {
+                if (!Time(from_ms, false))
+                    return false;
+                to_ms = from_ms;
+            } else {
+                return Fail("expected a comparison for time");
+            }
+            plan.from_ms = std::max(plan.from_ms, from_ms);
+            plan.to_ms = std::min(plan.to_ms, to_ms);
+            return true;
+        }
+
+        if (field == "value") {
+            double low = -std::numeric_limits<double>::infinity(), high = std::numeric_limits<double>::infinity();
+            double value = 0.0;
+            if (Accept("between")) {
+                if (!Number(low) || !Expect("and") || !Number(high))
+                    return false;
+            } else if (Accept(">=")) {
+                if (!Number(low))
+                    return false;
+            } else if (Accept(">")) {
+                if (!Number(value))
+                    return false;
+                low = std::nextafter(value, high);
+            } else if (Accept("<=")) {
+                if (!Number(high))
+                    return false;
+            } else if (Accept("<")) {
+                if (!Number(value))
+                    return false;
+                high = std::nextafter(value, low);
+            } else if (Accept("=")) {
+                if (!Number(low))
+                    return false;
+                high = low;
+            } else {
+                return Fail("expected a comparison for value");
+            }
+            plan.value_filter = true;
+            plan.value_min = std::max(plan.value_min, low);
+            plan.value_max = std::min(plan.value_max, high);
+            return true;
+        }
+        return Fail("unknown field '" + field + "' (time, value or channel)");
+    }
+
+    std::vector<Token> _tokens;
+    size_t _pos = 0;
+    std::string _error;
+};
+
+inline bool parseQuery(const std::string& text, QueryPlan& plan, std::string& error) {
+    return QueryParser(text).Parse(plan, error);
+}
+
+// Агрегат values[0, n), отобранных условием [low, high]: четыре независимые
+// цепочки накопления и условные присваивания вместо ветвлений, чтобы цикл
+// векторизовался
+inline void aggregateColumn(const double* values, size_t n, bool filter, double low, double high, Partial& result) {
+    double sum[4] = {0.0, 0.0, 0.0, 0.0};
+    double min[4] = {result.min, result.min, result.min, result.min};
+    double max[4] = {result.max, result.max, result.max, result.max};
+    uint64_t count[4] = {0, 0, 0, 0};
+    const double inf = std::numeric_limits<double>::infinity();
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        for (int lane = 0; lane < 4; lane++) {
+            double v = values[i + lane];
+            bool keep = !filter || (v >= low && v <= high);
+            sum[lane] += keep ? v : 0.0;
+            count[lane] += keep ? 1 : 0;
+            min[lane] = std::min(min[lane], keep ? v : inf);
+            max[lane] = std::max(max[lane], keep ? v : -inf);
+        }
+    }
+    for (; i < n; i++) {
+        double v = values[i];
+        bool keep = !filter || (v >= low && v <= high);
+        sum[0] += keep ? v : 0.0;
+        count[0] += keep ? 1 : 0;
+        min[0] = std::min(min[0], keep ? v : inf);
+        max[0] = std::max(max[0], keep ? v : -inf);
+    }
+    result.sum += (sum[0] + sum[1]) + (sum[2] + sum[3]);
+    result.count += count[0] + count[1] + count[2] + count[3];
+    result.min = std::min(std::min(min[0], min[1]), std::min(min[2], min[3]));
+    result.max = std::max(std::max(max[0], max[1]), std::max(max[2], max[3]));
+}
+
+inline double queryValue(QueryAggregate aggregate, const Partial& partial) {
+    switch (aggregate) {
+    case QUERY_AVG: return partial.Average();
+    case QUERY_MIN: return partial.min;
+    case QUERY_MAX: return partial.max;
+    case QUERY_SUM: return partial.sum;
+    default: return (double)partial.count;
+    }
+}
+
+// Значение строки; в приближённом запросе - оценка с учётом неразобранных блоков
+// (min и max - по их сводкам)
+inline double queryValue(QueryAggregate aggregate, const QueryRow& row) {
+    const QueryEstimate& estimate = row.estimate;
+    if (estimate.pending.count == 0)
+        return queryValue(aggregate, row.partial);
+    double count = row.partial.count + estimate.count;
+    switch (aggregate) {
+    case QUERY_AVG: return count > 0 ? (row.partial.sum + estimate.sum) / count : 0.0;
+    case QUERY_MIN: return std::min(row.partial.min, estimate.pending.min);
+    case QUERY_MAX: return std::max(row.partial.max, estimate.pending.max);
+    case QUERY_SUM: return row.partial.sum + estimate.sum;
+    default: return count;
+    }
+}
+
+// Гарантированные пределы значения строки: в неразобранные блоки может попасть
+// от 0 до всех их отсчётов с любыми значениями из [pending.min, pending.max]
+inline void queryBounds(QueryAggregate aggregate, const QueryRow& row, double& low, double& high) {
+    const Partial& exact = row.partial;
+    const QueryEstimate& estimate = row.estimate;
+    const Partial& pending = estimate.pending;
+    if (pending.count == 0) {
+        low = high = queryValue(aggregate, exact);
+        return;
+    }
+    switch (aggregate) {
+    case QUERY_AVG:
+        // Среднее монотонно по числу добавленных отсчётов: крайние случаи - ни одного или все
+        if (exact.count == 0) {
+            low = pending.min;
+            high = pending.max;
+        } else {
+            double all = (double)(exact.count + pending.count);
+            low = std::min(exact.Average(), (exact.sum + pending.count * pending.min) / all);
+            high = std::max(exact.Average(), (exact.sum + pending.count * pending.max) / all);
+        }
+        break;
+    case QUERY_MIN:
+        low = std::min(exact.min, pending.min);
+        high = exact.count > 0 ? exact.min : pending.max;
+        break;
+    case QUERY_MAX:
+        low = exact.count > 0 ? exact.max : pending.min;
+        high = std::max(exact.max, pending.max);
+        break;
+    case QUERY_SUM:
+        low = exact.sum + estimate.sum_low;
+        high = exact.sum + estimate.sum_high;
+        break;
+    default:
+        low = (double)exact.count;
+        high = (double)(exact.count + pending.count);
+        break;
+    }
+}
+
+// Погрешность значения строки: насколько точное значение может от него отличаться
+inline double queryError(QueryAggregate aggregate, const QueryRow& row) {
+    double low = 0.0, high = 0.0;
+    queryBounds(aggregate, row, low, high);
+    double value = queryValue(aggregate, row);
+    return std::max(value - low, high - value);
+}
+
+// Блок лога в пределах запроса: в приближённом запросе его вклад в строки
+// оценивается по сводке, пока блок не разобран
+struct QueryBlock {
+    HistoryLog* log;
+    size_t block;
+    uint32_t key_channel;
+    BlockStats stats;
+    double low;       // Отобранные значения блока лежат в [low, high]
+    double high;
+    bool decoded;
+};
+
+// Исполнение плана: строки по возрастанию (бакет, канал), только с отсчётами.
+// Запрос, прерванный control, возвращает пустой результат (причина - control->Status()).
+inline std::vector<QueryRow> runQuery(const QueryPlan& plan, BlockCache* cache, QueryCounters* counters = nullptr,
+                                      QueryControl* control = nullptr, const std::string& directory = ".") {
+    QueryCounters local;
+    QueryCounters& stats = counters ? *counters : local;
+    typedef std::pair<int64_t, uint32_t> GroupKey;
+    std::map<GroupKey, Partial> groups;
+    auto bucketOf = [&](int64_t time_ms) {
+        return (plan.bucket_ms > 0) ? alignTime(time_ms, plan.bucket_ms) : 0;
+    };
+    // Конец бакета (включительно), не выходящий за int64
+    auto bucketLast = [&](int64_t bucket) {
+        if (plan.bucket_ms <= 0 || bucket > std::numeric_limits<int64_t>::max() - plan.bucket_ms)
+            return std::numeric_limits<int64_t>::max();
+        return bucket + plan.bucket_ms - 1;
+    };
+
+    // Разобрать блок и добавить его отсчёты в строки; false - блок дошёл до конца диапазона
+    bool aborted = false;
+    auto decodeBlock = [&](HistoryLog& log, size_t block, uint32_t key_channel) {
+        stats.blocks_decoded++;
+        auto decoded = log.Block(block);
+        if (control && !control->Checkpoint(decoded->MemoryUsage())) {
+            aborted = true;
+            return false;
+        }
+        const auto& times = decoded->times;
+        size_t begin = std::lower_bound(times.begin(), times.end(), plan.from_ms) - times.begin();
+        size_t end = std::upper_bound(times.begin() + begin, times.end(), plan.to_ms) - times.begin();
+        // Отрезки одного бакета: времена в блоке по возрастанию
+        while (begin < end) {
+            int64_t bucket = bucketOf(times[begin]);
+            size_t run_end = end;
+            if (plan.bucket_ms > 0 && bucket <= std::numeric_limits<int64_t>::max() - plan.bucket_ms)
+                run_end = std::lower_bound(times.begin() + begin, times.begin() + end, bucket + plan.bucket_ms) -
+                          times.begin();
+            Partial run;
+            aggregateColumn(decoded->values.data() + begin, run_end - begin, plan.value_filter, plan.value_min,
+                            plan.value_max, run);
+            if (run.count > 0)
+                groups[std::make_pair(bucket, key_channel)].Merge(run);
+            begin = run_end;
+        }
+        return end == times.size();
+    };
+
+    std::map<uint32_t, std::string> files;
+    if (plan.all_channels)
+        files = findChannelLogs(plan.log_base, directory);
+    for (uint32_t channel : plan.channels)
+        files.emplace(channel, queryLogName(plan.log_base, channel));
+    // Приближённый запрос разбирает блоки позже, поэтому логи остаются открытыми
+    std::vector<std::unique_ptr<HistoryLog>> logs;
+    std::vector<QueryBlock> blocks;
+    for (const auto& file : files) {
+        uint32_t channel = file.first;
+        if (control && !control->Checkpoint(0))
+            return {};
+        logs.emplace_back(new HistoryLog((std::filesystem::path(directory) / file.second).string(), cache));
+        HistoryLog& log = *logs.back();
+        if (!log.IsOpen() || log.BlockCount() == 0) {
+            logs.pop_back();
+            continue;
+        }
+        stats.logs++;
+        uint32_t key_channel = plan.by_channel ? channel : 0;
+
+        for (size_t block = log.BlockOf(log.SeekOffset(plan.from_ms)); block < log.BlockCount(); block++) {
+            const BlockStats* summary = log.Stats(block);
+            if (summary) {
+                if (summary->first_ms > plan.to_ms)
+                    break;
+                bool outside = summary->last_ms < plan.from_ms ||
+                               (plan.value_filter && (summary->max < plan.value_min || summary->min > plan.value_max));
+                if (outside) {
+                    stats.blocks_pruned++;
+                    continue;
+                }
+                bool covered = summary->first_ms >= plan.from_ms && summary->last_ms <= plan.to_ms &&
+                               bucketOf(summary->first_ms) == bucketOf(summary->last_ms) &&
+                               (!plan.value_filter || (summary->min >= plan.value_min && summary->max <= plan.value_max));
+                if (covered) {
+                    Partial& group = groups[std::make_pair(bucketOf(summary->first_ms), key_channel)];
+                    group.count += summary->count;
+                    group.sum += summary->sum;
+                    group.min = std::min(group.min, summary->min);
+                    group.max = std::max(group.max, summary->max);
+                    stats.blocks_from_stats++;
+                    continue;
+                }
+                if (plan.approximate) {
+                    blocks.push_back(QueryBlock{&log, block, key_channel, *summary,
+                                                std::max(summary->min, plan.value_min),
+                                                std::min(summary->max, plan.value_max), false});
+                    continue;
+                }
+            }
+
+            if (!decodeBlock(log, block, key_channel)) {
+                if (aborted)
+                    return {};
+                break;
+            }
+        }
+    }
+
+    // Приближённый запрос: доли неразобранных блоков в строках
+    std::map<GroupKey, std::vector<std::pair<size_t, double>>> shares;
+    for (size_t i = 0; i < blocks.size(); i++) {
+        const QueryBlock& block = blocks[i];
+        double span = (double)(block.stats.last_ms - block.stats.first_ms) + 1.0;
+        double value_share = 1.0;
+        if (plan.value_filter && block.stats.max > block.stats.min)
+            value_share = std::max(0.0, block.high - block.low) / (block.stats.max - block.stats.min);
+        int64_t first = std::max(block.stats.first_ms, plan.from_ms);
+        int64_t last = std::min(block.stats.last_ms, plan.to_ms);
+        for (int64_t bucket = bucketOf(first); ; bucket = bucketLast(bucket) + 1) {
+            int64_t part_first = std::max(first, bucket);
+            int64_t part_last = std::min(last, bucketLast(bucket));
+            double time_share = ((double)(part_last - part_first) + 1.0) / span;
+            shares[std::make_pair(bucket, block.key_channel)].emplace_back(i, time_share * value_share);
+            if (part_last >= last)
+                break;
+        }
+    }
+
+    auto makeRow = [&](const GroupKey& key) {
+        QueryRow row{key.first, key.second, Partial(), QueryEstimate()};
+        auto group = groups.find(key);
+        if (group != groups.end())
+            row.partial = group->second;
+        auto share = shares.find(key);
+        if (share == shares.end())
+            return row;
+        for (const auto& part : share->second) {
+            const QueryBlock& block = blocks[part.first];
+            if (block.decoded)
+                continue;
+            double count = block.stats.count * part.second;
+            row.estimate.pending.count += block.stats.count;
+            row.estimate.pending.min = std::min(row.estimate.pending.min, block.low);
+            row.estimate.pending.max = std::max(row.estimate.pending.max, block.high);
+            row.estimate.count += count;
+            row.estimate.sum += (plan.value_filter ? count * (block.low + block.high) / 2
+                                                   : block.stats.sum * part.second);
+            row.estimate.sum_low += std::min(0.0, block.stats.count * block.low);
+            row.estimate.sum_high += std::max(0.0, block.stats.count * block.high);
+        }
+        return row;
+    };
+    // Превышение погрешности строки над целью (<= 0 - строка достаточно точна)
+    auto excess = [&](const QueryRow& row) {
+        double worst = -std::numeric_limits<double>::infinity();
+        for (QueryAggregate aggregate : plan.aggregates) {
+            double allowed = plan.relative_error ? plan.max_error * std::fabs(queryValue(aggregate, row))
+                                                 : plan.max_error;
+            worst = std::max(worst, queryError(aggregate, row) - allowed);
+        }
+        return worst;
+    };
+
+    // Уточнение: строки с наибольшим превышением разбирают свои блоки первыми
+    if (plan.approximate && (plan.max_error > 0 || plan.timeout_ms > 0)) {
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(plan.timeout_ms);
+        std::vector<std::pair<double, GroupKey>> order;
+        for (const auto& share : shares)
+            order.emplace_back(excess(makeRow(share.first)), share.first);
+        std::sort(order.begin(), order.end(), [](const std::pair<double, GroupKey>& a,
+                                                 const std::pair<double, GroupKey>& b) { return a.first > b.first; });
+        auto expired = [&]() {
+            return plan.timeout_ms > 0 && std::chrono::steady_clock::now() >= deadline;
+        };
+        for (const auto& item : order) {
+            if (item.first <= 0 || expired())
+                break;
+            if (excess(makeRow(item.second)) <= 0)
+                continue;
+            for (const auto& part : shares[item.second]) {
+                QueryBlock& block = blocks[part.first];
+                if (block.decoded)
+                    continue;
+                if (expired())
+                    break;
+                block.decoded = true;
+                decodeBlock(*block.log, block.block, block.key_channel);
+                if (aborted)
+                    return {};
+            }
+        }
+    }
+    for (const auto& block : blocks) {
+        if (!block.decoded)
+            stats.blocks_estimated++;
+    }
+
+    std::vector<QueryRow> rows;
+    for (const auto& share : shares)
+        groups.emplace(share.first, Partial());
+    for (const auto& group : groups) {
+        QueryRow row = makeRow(group.first);
+        if (row.partial.count > 0 || row.estimate.pending.count > 0)
+            rows.push_back(row);
+    }
+    return rows;
+}
+
+// Описание плана для EXPLAIN
+inline std::string describePlan(const QueryPlan& plan, const QueryCounters* counters = nullptr) {
+    std::ostringstream out;
+    out << "source: " << plan.source << " (" << plan.log_base << "*.log)\n";
+    out << "channels: ";
+    if (plan.all_channels) {
+        out << "all";
+    } else {
+        for (size_t i = 0; i < plan.channels.size(); i++)
+            out << (i ? "," : "") << plan.channels[i];
+        if (plan.channels.empty())
+            out << "none";
+    }
+    out << "\ntime: " << (plan.from_ms == std::numeric_limits<int64_t>::min() ? "-" : formatTimestamp(plan.from_ms))
+        << " .. " << (plan.to_ms == std::numeric_limits<int64_t>::max() ? "-" : formatTimestamp(plan.to_ms)) << '\n';
+    if (plan.value_filter)
+        out << "value: " << plan.value_min << " .. " << plan.value_max << " (blocks pruned by zone maps)\n";
+    out << "group: ";
+    if (plan.bucket_ms > 0)
+        out << "time " << plan.bucket_ms / 1000.0 << " s";
+    else
+        out << "none";
+    out << (plan.by_channel ? ", channel" : "") << '\n';
+    if (plan.approximate) {
+        out << "approximate: error ";
+        if (plan.max_error <= 0)
+            out << "any";
+        else if (plan.relative_error)
+            out << plan.max_error * 100 << "%";
+        else
+            out << plan.max_error;
+        out << ", timeout ";
+        if (plan.timeout_ms > 0)
+            out << plan.timeout_ms << " ms\n";
+        else
+            out << "none\n";
+    }
+    if (counters) {
+        out << "logs " << counters->logs << ", blocks: pruned " << counters->blocks_pruned << ", from stats "
+            << counters->blocks_from_stats << ", decoded " << counters->blocks_decoded;
+        if (plan.approximate)
+            out << ", estimated " << counters->blocks_estimated;
+        out << '\n';
+    }
+    return out.str();
+}
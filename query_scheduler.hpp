@@ -0,0 +1,277 @@
+#pragma once
+
+// Планировщик запросов: запросы не должны отнимать время у приёма.
+//
+// Запросы выполняются на своих рабочих потоках с пониженным приоритетом
+// процессора (nice) и, в Linux, с классом ввода-вывода idle, так что чтение
+// логов для запроса уступает диск записи логов. Число одновременно
+// выполняемых и ждущих запросов ограничено; запрос, не дождавшийся рабочего
+// потока, отклоняется. Длинный запрос идёт кусками (блоками лога) и между
+// ними проверяет отмену и бюджеты процессорного времени и памяти, уступает
+// процессор после каждого кванта и ждёт, пока идут приём или синхронизация
+// логов: у них строгий приоритет.
+
+#include <map>
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+#include <functional>
+#include <condition_variable>
+#include <ctime>
+
+#if defined (__linux__)
+#	include <unistd.h>        // syscall
+#	include <sys/syscall.h>   // SYS_gettid, SYS_ioprio_set
+#	include <sys/resource.h>  // setpriority
+#endif
+
+const size_t QUERY_WORKERS_DEFAULT = 2;           // Рабочих потоков запросов
+const size_t QUERY_QUEUE_LIMIT_DEFAULT = 16;      // Запросов в очереди сверх выполняемых
+const int64_t QUERY_WAIT_MS_DEFAULT = 5000;       // Ожидание рабочего потока до отказа
+const int64_t QUERY_SLICE_MS = 2;                 // Квант запроса между уступками процессора
+const int QUERY_NICE = 10;                        // Приоритет рабочих потоков (nice)
+const auto QUERY_INGEST_POLL = std::chrono::microseconds(200); // Проверка окончания приёма
+
+enum QueryStatus {
+    QUERY_DONE,
+    QUERY_REJECTED,       // Не дождался рабочего потока
+    QUERY_CANCELLED,
+    QUERY_CPU_EXCEEDED,
+    QUERY_MEMORY_EXCEEDED
+};
+
+inline const char* queryStatusName(QueryStatus status) {
+    switch (status) {
+    case QUERY_DONE: return "done";
+    case QUERY_REJECTED: return "rejected: too many queries";
+    case QUERY_CANCELLED: return "cancelled";
+    case QUERY_CPU_EXCEEDED: return "CPU budget exceeded";
+    default: return "memory budget exceeded";
+    }
+}
+
+// Бюджеты запроса (0 - без ограничения)
+struct QueryBudget {
+    int64_t cpu_ms = 0;        // Процессорное время потока запроса
+    size_t memory_bytes = 0;   // Объём данных, разобранных запросом
+};
+
+// Процессорное время текущего потока, мс
+inline int64_t threadCpuMs() {
+#if defined (CLOCK_THREAD_CPUTIME_ID)
+    timespec ts;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) == 0)
+        return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+#endif
+    return (int64_t)(std::clock() * 1000.0 / CLOCKS_PER_SEC);
+}
+
+// Понизить приоритет процессора и ввода-вывода текущего потока (необратимо для потока)
+inline void lowerThreadPriority() {
+#if defined (__linux__)
+    pid_t tid = (pid_t)syscall(SYS_gettid);
+    setpriority(PRIO_PROCESS, (id_t)tid, QUERY_NICE);
+#if defined (SYS_ioprio_set)
+    const int IOPRIO_WHO_PROCESS = 1;
+    const int IOPRIO_CLASS_IDLE = 3;
+    const int IOPRIO_CLASS_SHIFT = 13;
+    syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, tid, IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT);
+#endif
+#endif
+}
+
+// Состояние одного запроса: отмена, бюджеты и кванты
+class QueryControl {
+public:
+    QueryControl(const QueryBudget& budget, const std::atomic<int>* ingest_active)
+        : _budget(budget), _ingest_active(ingest_active), _cancelled(false), _status(QUERY_DONE),
+          _bytes(0), _cpu_start_ms(0), _slice_start(std::chrono::steady_clock::now()) {}
+
+    // Вызывается в начале выполнения, на рабочем потоке
+    void Start() {
+        _cpu_start_ms = threadCpuMs();
+        _slice_start = std::chrono::steady_clock::now();
+    }
+
+    void Cancel() {
+        _cancelled = true;
+    }
+
+    // Граница куска работы: bytes - объём данных, разобранных в куске.
+    // false - запрос нужно прекратить (причина - Status()).
+    bool Checkpoint(size_t bytes) {
+        if (_status != QUERY_DONE)
+            return false;
+        _bytes += bytes;
+        if (_budget.memory_bytes > 0 && _bytes > _budget.memory_bytes)
+            return Stop(QUERY_MEMORY_EXCEEDED);
+        if (_budget.cpu_ms > 0 && threadCpuMs() - _cpu_start_ms > _budget.cpu_ms)
+            return Stop(QUERY_CPU_EXCEEDED);
+
+        // Приём и синхронизация идут первыми
+        while (_ingest_active && _ingest_active->load(std::memory_order_acquire) > 0 && !_cancelled)
+            std::this_thread::sleep_for(QUERY_INGEST_POLL);
+        if (_cancelled)
+            return Stop(QUERY_CANCELLED);
+
+        auto now = std::chrono::steady_clock::now();
+        if (now - _slice_start >= std::chrono::milliseconds(QUERY_SLICE_MS)) {
+            std::this_thread::yield();
+            _slice_start = std::chrono::steady_clock::now();
+        }
+        return true;
+    }
+
+    QueryStatus Status() const {
+        return _cancelled && _status == QUERY_DONE ? QUERY_CANCELLED : _status;
+    }
+
+private:
+    bool Stop(QueryStatus status) {
+        _status = status;
+        return false;
+    }
+
+    QueryBudget _budget;
+    const std::atomic<int>* _ingest_active;
+    std::atomic<bool> _cancelled;
+    QueryStatus _status;
+    size_t _bytes;
+    int64_t _cpu_start_ms;
+    std::chrono::steady_clock::time_point _slice_start;
+};
+
+class QueryScheduler {
+public:
+    explicit QueryScheduler(size_t workers = QUERY_WORKERS_DEFAULT, size_t queue_limit = QUERY_QUEUE_LIMIT_DEFAULT)
+        : _queue_limit(queue_limit), _stop(false), _ingest_active(0) {
+        for (size_t i = 0; i < std::max<size_t>(1, workers); i++)
+            _workers.emplace_back(&QueryScheduler::WorkerLoop, this);
+    }
+
+    ~QueryScheduler() {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stop = true;
+            for (auto& job : _tagged)
+                job.second->control.Cancel();
+        }
+        _cv.notify_all();
+        for (auto& worker : _workers)
+            worker.join();
+    }
+
+    // Выполнить task на рабочем потоке и дождаться окончания. tag (не 0) - для Cancel.
+    // Запрос, не получивший рабочий поток за wait_ms, отклоняется.
+    QueryStatus Run(uint32_t tag, const QueryBudget& budget, int64_t wait_ms,
+                    const std::function<void(QueryControl&)>& task) {
+        Job job(budget, &_ingest_active, task);
+        std::unique_lock<std::mutex> lock(_mutex);
+        if (_stop || _queue.size() >= _queue_limit)
+            return QUERY_REJECTED;
+        _queue.push_back(&job);
+        if (tag != 0)
+            _tagged.emplace(tag, &job);
+        _cv.notify_all();
+
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(wait_ms);
+        bool started = _cv.wait_until(lock, deadline, [&]() { return job.started; });
+        if (!started) {
+            _queue.erase(std::find(_queue.begin(), _queue.end(), &job));
+            Untag(&job);
+            return QUERY_REJECTED;
+        }
+        _cv.wait(lock, [&]() { return job.finished; });
+        Untag(&job);
+        return job.control.Status();
+    }
+
+    // Отменить запросы с тегом tag; false - таких нет
+    bool Cancel(uint32_t tag) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto range = _tagged.equal_range(tag);
+        for (auto it = range.first; it != range.second; ++it)
+            it->second->control.Cancel();
+        return range.first != range.second;
+    }
+
+    // Приём и синхронизация логов: пока они идут, запросы стоят на границе куска
+    void BeginIngest() {
+        _ingest_active.fetch_add(1, std::memory_order_acq_rel);
+    }
+
+    void EndIngest() {
+        _ingest_active.fetch_sub(1, std::memory_order_acq_rel);
+    }
+
+private:
+    struct Job {
+        QueryControl control;
+        const std::function<void(QueryControl&)>& task;
+        bool started = false;
+        bool finished = false;
+
+        Job(const QueryBudget& budget, const std::atomic<int>* ingest_active,
+            const std::function<void(QueryControl&)>& task)
+            : control(budget, ingest_active), task(task) {}
+    };
+
+    void Untag(Job* job) {
+        for (auto it = _tagged.begin(); it != _tagged.end(); ++it) {
+            if (it->second == job) {
+                _tagged.erase(it);
+                return;
+            }
+        }
+    }
+
+    void WorkerLoop() {
+        lowerThreadPriority();
+        std::unique_lock<std::mutex> lock(_mutex);
+        for (;;) {
+            _cv.wait(lock, [&]() { return _stop || !_queue.empty(); });
+            if (_stop && _queue.empty())
+                return;
+            Job* job = _queue.front();
+            _queue.pop_front();
+            job->started = true;
+            _cv.notify_all();
+            lock.unlock();
+            job->control.Start();
+            if (job->control.Checkpoint(0))
+                job->task(job->control);
+            lock.lock();
+            job->finished = true;
+            _cv.notify_all();
+        }
+    }
+
+    size_t _queue_limit;
+    bool _stop;
+    std::atomic<int> _ingest_active;
+    std::mutex _mutex;
+    std::condition_variable _cv;
+    std::deque<Job*> _queue;
+    std::multimap<uint32_t, Job*> _tagged;
+    std::vector<std::thread> _workers;
+};
+
+// Участок приёма или синхронизации на время жизни объекта
+class IngestScope {
+public:
+    explicit IngestScope(QueryScheduler& scheduler) : _scheduler(scheduler) {
+        _scheduler.BeginIngest();
+    }
+
+    ~IngestScope() {
+        _scheduler.EndIngest();
+    }
+
+private:
+    QueryScheduler& _scheduler;
+};
@@ -0,0 +1,368 @@
+#pragma once
+
+// Многополевые записи (температура, влажность, давление, заряд...).
+//
+// Для канала задаётся схема - список типизированных полей, и устройство шлёт
+// их в одной строке через запятую: "23.4,45.1,1013.2,2950". Строка
+// разбирается за один проход, а записи канала хранятся по столбцам: один
+// общий столбец времени и по столбцу на поле.
+//
+// Открытый блок канала - несжатые столбцы. Заполненный блок
+// (RECORD_BLOCK_ROWS записей) сжимается по столбцам: время - разности
+// (zigzag + varint), целые поля - так же, вещественные - XOR с предыдущим
+// значением без нулевых старших и младших байтов (медленно меняющиеся
+// показания датчиков занимают 1-3 байта вместо 8).
+//
+// Формат файла схем: строки "<канал> <поле>[:int] <поле>[:int] ...",
+// '#' - комментарий. Например, "3 temp humidity pressure battery:int".
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdlib>
+#include <sstream>
+#include <fstream>
+#include <cstdint>
+#include <cmath>
+#include <limits>
+#include <algorithm>
+
+const size_t RECORD_MAX_FIELDS = 8;     // Максимум полей в записи
+const size_t RECORD_BLOCK_ROWS = 1024;  // Записей в блоке до сжатия
+const int64_t RECORD_INT_MISSING = std::numeric_limits<int64_t>::min(); // Целое поле без значения
+
+enum FieldType {
+    FIELD_REAL,
+    FIELD_INT
+};
+
+struct FieldSpec {
+    std::string name;
+    FieldType type;
+};
+
+// Схема записей канала; первое поле - основное значение канала
+struct RecordSchema {
+    std::vector<FieldSpec> fields;
+};
+
+// Схемы каналов
+class SchemaConfig {
+public:
+    bool Load(const std::string& file_name, std::string& errors) {
+        std::ifstream file(file_name);
+        if (!file.is_open()) {
+            errors += "Failed to open schema config: " + file_name + "\n";
+            return false;
+        }
+        std::string line;
+        int line_no = 0;
+        while (std::getline(file, line)) {
+            line_no++;
+            size_t hash_pos = line.find('#');
+            if (hash_pos != std::string::npos)
+                line.erase(hash_pos);
+            std::istringstream ss(line);
+            std::string channel, field;
+            if (!(ss >> channel))
+                continue;
+            RecordSchema schema;
+            bool ok = channel.find_first_not_of("0123456789") == std::string::npos;
+            while (ok && ss >> field) {
+                FieldSpec spec{field, FIELD_REAL};
+                size_t colon_pos = field.find(':');
+                if (colon_pos != std::string::npos) {
+                    spec.name = field.substr(0, colon_pos);
+                    std::string type = field.substr(colon_pos + 1);
+                    if (type == "int")
+                        spec.type = FIELD_INT;
+                    else if (type != "real")
+                        ok = false;
+                }
+                ok = ok && !spec.name.empty();
+                schema.fields.push_back(spec);
+            }
+            if (!ok || schema.fields.empty() || schema.fields.size() > RECORD_MAX_FIELDS) {
+                errors += file_name + ":" + std::to_string(line_no) + ": invalid schema '" + line + "'\n";
+                continue;
+            }
+            _schemas[(uint32_t)std::stoul(channel)] = schema;
+        }
+        return true;
+    }
+
+    // Схема канала; nullptr - у канала одно значение
+    const RecordSchema* For(uint32_t channel) const {
+        auto it = _schemas.find(channel);
+        return (it != _schemas.end()) ? &it->second : nullptr;
+    }
+
+private:
+    std::map<uint32_t, RecordSchema> _schemas;
+};
+
+// Разбор "<v1>,<v2>,..." из [begin, end) за один проход; число полей должно совпасть со схемой
+inline bool parseFields(const char* begin, const char* end, const RecordSchema& schema, double* values) {
+    const char* pos = begin;
+    for (size_t f = 0; f < schema.fields.size(); f++) {
+        const char* field_end = (const char*)std::memchr(pos, ',', end - pos);
+        if (!field_end)
+            field_end = end;
+        if (pos == field_end || (field_end == end) != (f + 1 == schema.fields.size()))
+            return false;
+        bool is_int = schema.fields[f].type == FIELD_INT;
+        for (const char* c = pos; c < field_end; c++) {
+            if (!(*c >= '0' && *c <= '9') && *c != '-' && (is_int || *c != '.'))
+                return false;
+        }
+        char* parsed_end = nullptr;
+        values[f] = is_int ? (double)std::strtoll(pos, &parsed_end, 10) : std::strtod(pos, &parsed_end);
+        if (parsed_end != field_end)
+            return false;
+        pos = field_end + 1;
+    }
+    return true;
+}
+
+inline void putVarint(std::string& out, uint64_t value) {
+    while (value >= 0x80) {
+        out.push_back((char)(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back((char)value);
+}
+
+inline uint64_t getVarint(const char*& pos) {
+    uint64_t value = 0;
+    for (int shift = 0;; shift += 7) {
+        uint8_t byte = (uint8_t)*pos++;
+        value |= (uint64_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+            return value;
+    }
+}
+
+inline uint64_t zigzag(int64_t value) {
+    return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+inline int64_t unzigzag(uint64_t value) {
+    return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+// Сжатый блок записей одного канала
+struct RecordBlock {
+    int64_t min_time_ms;
+    int64_t max_time_ms;
+    size_t rows;
+    std::string times;
+    std::vector<std::string> columns;
+
+    size_t MemoryUsage() const {
+        size_t size = sizeof(*this) + times.size();
+        for (const auto& column : columns)
+            size += column.size();
+        return size;
+    }
+};
+
+// Сжать разности целых (время, целые поля); разность считается по модулю 2^64,
+// так что соседство с RECORD_INT_MISSING не переполняет знаковую арифметику
+inline void encodeDeltas(const std::vector<int64_t>& values, std::string& out) {
+    uint64_t prev = 0;
+    for (int64_t value : values) {
+        putVarint(out, zigzag((int64_t)((uint64_t)value - prev)));
+        prev = (uint64_t)value;
+    }
+}
+
+inline void decodeDeltas(const char* pos, size_t rows, std::vector<int64_t>& values) {
+    uint64_t prev = 0;
+    for (size_t i = 0; i < rows; i++) {
+        prev += (uint64_t)unzigzag(getVarint(pos));
+        values.push_back((int64_t)prev);
+    }
+}
+
+// Значение целого поля в столбце: NaN (поля нет, запись отбракована) - RECORD_INT_MISSING,
+// за пределами int64 - ближайшая граница
+inline int64_t recordInt(double value) {
+    if (std::isnan(value))
+        return RECORD_INT_MISSING;
+    if (value >= 9223372036854775807.0)
+        return std::numeric_limits<int64_t>::max();
+    if (value <= -9223372036854775807.0)
+        return RECORD_INT_MISSING + 1;
+    return (int64_t)value;
+}
+
+// Сжать вещественные значения XOR с предыдущим: байт-заголовок
+// (нулевые старшие байты << 4 | нулевые младшие байты) и значимые байты
+inline void encodeXor(const std::vector<double>& values, std::string& out) {
+    uint64_t prev = 0;
+    for (double value : values) {
+        uint64_t bits = 0;
+        std::memcpy(&bits, &value, sizeof(bits));
+        uint64_t x = bits ^ prev;
+        prev = bits;
+        int lead = 0, trail = 0;
+        while (lead < 8 && ((x >> (56 - 8 * lead)) & 0xff) == 0)
+            lead++;
+        while (lead + trail < 8 && ((x >> (8 * trail)) & 0xff) == 0)
+            trail++;
+        out.push_back((char)((lead << 4) | trail));
+        for (int b = 7 - lead; b >= trail; b--)
+            out.push_back((char)((x >> (8 * b)) & 0xff));
+    }
+}
+
+inline void decodeXor(const char* pos, size_t rows, std::vector<double>& values) {
+    uint64_t prev = 0;
+    for (size_t i = 0; i < rows; i++) {
+        uint8_t header = (uint8_t)*pos++;
+        int lead = header >> 4, trail = header & 0x0f;
+        uint64_t x = 0;
+        for (int b = 7 - lead; b >= trail; b--)
+            x |= (uint64_t)(uint8_t)*pos++ << (8 * b);
+        prev ^= x;
+        double value = 0.0;
+        std::memcpy(&value, &prev, sizeof(value));
+        values.push_back(value);
+    }
+}
+
+class RecordStore {
+public:
+    // Добавить запись канала; values - по одному значению на поле схемы
+    void Append(uint32_t channel, const RecordSchema& schema, int64_t time_ms, const double* values) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        ChannelRecords& records = _channels[channel];
+        if (records.columns.empty()) {
+            records.schema = schema; // Схема канала не меняется за время работы
+            records.columns.assign(schema.fields.size(), std::vector<double>());
+        }
+        records.times.push_back(time_ms);
+        for (size_t f = 0; f < records.columns.size(); f++)
+            records.columns[f].push_back(values[f]);
+        if (records.times.size() >= RECORD_BLOCK_ROWS)
+            SealLocked(records);
+    }
+
+    // Обойти записи канала с временем в [from_ms, to_ms] в порядке прихода:
+    // f(time_ms, const double* values)
+    template<class F>
+    void Read(uint32_t channel, int64_t from_ms, int64_t to_ms, F f) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto it = _channels.find(channel);
+        if (it == _channels.end())
+            return;
+        const ChannelRecords& records = it->second;
+        std::vector<int64_t> times;
+        std::vector<std::vector<double>> columns;
+        std::vector<double> row(records.columns.size());
+        for (const auto& block : records.blocks) {
+            if (block.max_time_ms < from_ms || block.min_time_ms > to_ms)
+                continue;
+            DecodeBlock(block, records.schema, times, columns);
+            EmitRows(times, columns, from_ms, to_ms, row, f);
+        }
+        EmitRows(records.times, records.columns, from_ms, to_ms, row, f);
+    }
+
+    // Схема записей канала; false - записей не было
+    bool Schema(uint32_t channel, RecordSchema& schema) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto it = _channels.find(channel);
+        if (it == _channels.end())
+            return false;
+        schema = it->second.schema;
+        return true;
+    }
+
+    // Удалить сжатые блоки, целиком лежащие раньше time_ms
+    void DropBefore(int64_t time_ms) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        for (auto& entry : _channels) {
+            auto& blocks = entry.second.blocks;
+            blocks.erase(std::remove_if(blocks.begin(), blocks.end(), [&](const RecordBlock& block) {
+                return block.max_time_ms < time_ms;
+            }), blocks.end());
+        }
+    }
+
+    // Занимаемая память в байтах
+    size_t MemoryUsage() {
+        std::lock_guard<std::mutex> lock(_mutex);
+        size_t size = 0;
+        for (const auto& entry : _channels) {
+            for (const auto& block : entry.second.blocks)
+                size += block.MemoryUsage();
+            size += entry.second.times.size() * sizeof(int64_t) * (1 + entry.second.columns.size());
+        }
+        return size;
+    }
+
+private:
+    struct ChannelRecords {
+        RecordSchema schema;
+        std::vector<RecordBlock> blocks;           // Сжатые блоки
+        std::vector<int64_t> times;                // Открытый блок: столбец времени
+        std::vector<std::vector<double>> columns;  // и столбцы полей
+    };
+
+    static void SealLocked(ChannelRecords& records) {
+        RecordBlock block;
+        block.rows = records.times.size();
+        block.min_time_ms = *std::min_element(records.times.begin(), records.times.end());
+        block.max_time_ms = *std::max_element(records.times.begin(), records.times.end());
+        encodeDeltas(records.times, block.times);
+        for (size_t f = 0; f < records.columns.size(); f++) {
+            block.columns.emplace_back();
+            if (records.schema.fields[f].type == FIELD_INT) {
+                std::vector<int64_t> ints(records.columns[f].size());
+                std::transform(records.columns[f].begin(), records.columns[f].end(), ints.begin(), recordInt);
+                encodeDeltas(ints, block.columns.back());
+            } else
+                encodeXor(records.columns[f], block.columns.back());
+            records.columns[f].clear();
+        }
+        records.times.clear();
+        records.blocks.push_back(std::move(block));
+    }
+
+    static void DecodeBlock(const RecordBlock& block, const RecordSchema& schema,
+                            std::vector<int64_t>& times, std::vector<std::vector<double>>& columns) {
+        times.clear();
+        decodeDeltas(block.times.data(), block.rows, times);
+        columns.assign(block.columns.size(), std::vector<double>());
+        std::vector<int64_t> ints;
+        for (size_t f = 0; f < block.columns.size(); f++) {
+            columns[f].reserve(block.rows);
+            if (schema.fields[f].type == FIELD_INT) {
+                ints.clear();
+                decodeDeltas(block.columns[f].data(), block.rows, ints);
+                for (int64_t value : ints)
+                    columns[f].push_back(value == RECORD_INT_MISSING ? std::nan("") : (double)value);
+            } else {
+                decodeXor(block.columns[f].data(), block.rows, columns[f]);
+            }
+        }
+    }
+
+    template<class F>
+    static void EmitRows(const std::vector<int64_t>& times, const std::vector<std::vector<double>>& columns,
+                         int64_t from_ms, int64_t to_ms, std::vector<double>& row, F& f) {
+        for (size_t i = 0; i < times.size(); i++) {
+            if (times[i] < from_ms || times[i] > to_ms)
+                continue;
+            for (size_t c = 0; c < columns.size(); c++)
+                row[c] = columns[c][i];
+            f(times[i], row.data());
+        }
+    }
+
+    std::mutex _mutex;
+    std::map<uint32_t, ChannelRecords> _channels;
+};
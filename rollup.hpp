@@ -0,0 +1,238 @@
+#pragma once
+
+// Роллапы по времени событий с водяным знаком (watermark).
+//
+// Отсчёт попадает в бакет по своему времени, а не по времени прихода. Водяной
+// знак источника - "все отсчёты старше него уже пришли": максимальное
+// увиденное время минус допустимое опоздание (allowed lateness). Бакет,
+// целиком лежащий раньше водяного знака, закрывается и отдаётся наружу, как
+// только интеграл дошёл до его конца (см. ниже): пришёл первый отсчёт после
+// бакета или следующий отрезок был бы уже пропуском данных.
+//
+// Открытых бакетов не больше max_open_buckets (ограниченный буфер
+// переупорядочивания): при переполнении самый старый закрывается досрочно.
+// Отсчёт, опоздавший в уже закрытый бакет, не теряется - он обновляет
+// сохранённый агрегат бакета, а бакет попадает в список исправлений.
+// Закрытые агрегаты хранятся для max_closed_buckets последних бакетов;
+// ещё более старые опоздания отбрасываются и считаются.
+//
+// Отрезок между соседними (по времени прихода и по возрастанию времени)
+// отсчётами интегрируется за O(1): он разрезается по границам бакетов, и
+// каждый бакет получает свою часть с линейно интерполированными значениями
+// на границах. Отрезки длиннее max_gap_ms (пропуски данных) не
+// интегрируются; опоздавшие и исключённые по флагам отсчёты в интегралы не
+// входят. С max_gap_ms = 0 интеграл не ведётся вовсе, и бакеты закрываются
+// по одному водяному знаку.
+
+#include "bucket_cache.hpp"
+#include <map>
+#include <set>
+#include <vector>
+#include <limits>
+#include <cstdint>
+
+const int64_t ALLOWED_LATENESS_MS_DEFAULT = 20 * 1000; // Допустимое опоздание отсчётов
+const size_t MAX_OPEN_BUCKETS_DEFAULT = 4;             // Размер буфера переупорядочивания (в бакетах)
+const int64_t INTEGRAL_MAX_GAP_MS_DEFAULT = 10 * 60 * 1000; // Самый длинный интегрируемый отрезок
+
+// Бакет роллапа: начало интервала и агрегат за него
+struct RollupBucket {
+    int64_t start_ms;
+    Partial partial;
+};
+
+class EventTimeRollup {
+public:
+    enum AddResult {
+        ADD_OPEN,        // Отсчёт попал в открытый бакет
+        ADD_CORRECTION,  // Опоздавший отсчёт исправил закрытый бакет
+        ADD_DROPPED      // Бакет уже забыт
+    };
+
+    EventTimeRollup(int64_t bucket_ms, int64_t allowed_lateness_ms = ALLOWED_LATENESS_MS_DEFAULT,
+                    size_t max_closed_buckets = 0, size_t max_open_buckets = MAX_OPEN_BUCKETS_DEFAULT,
+                    int64_t max_gap_ms = INTEGRAL_MAX_GAP_MS_DEFAULT)
+        : _bucket_ms(std::max<int64_t>(1, bucket_ms)), _allowed_lateness_ms(allowed_lateness_ms),
+          _max_open_buckets(std::max<size_t>(1, max_open_buckets)), _max_closed_buckets(max_closed_buckets),
+          _max_gap_ms(max_gap_ms), _watermark_ms(std::numeric_limits<int64_t>::min()), _dropped(0) {}
+
+    // Отсчёт с флагами качества: отсчёты с QUALITY_EXCLUDE_DEFAULT учитываются только в счётчиках флагов
+    AddResult Add(int64_t time_ms, double value, uint8_t flags = 0) {
+        if (!(flags & QUALITY_EXCLUDE_DEFAULT)) {
+            Integrate(time_ms, value);
+        }
+        int64_t start = alignTime(time_ms, _bucket_ms);
+        // Бакет за водяным знаком, ещё ждущий конца интеграла, открыт: отсчёт не опоздал
+        if (start + _bucket_ms <= _watermark_ms && _open.find(start) == _open.end()) {
+            return Correct(start, value, flags | QUALITY_LATE);
+        }
+
+        _open[start].Add(value, flags);
+        if (!_manual_watermark) {
+            AdvanceWatermark(time_ms - _allowed_lateness_ms);
+        }
+        // Буфер переполнен - закрываем самые старые бакеты досрочно
+        while (_open.size() > _max_open_buckets) {
+            _watermark_ms = std::max(_watermark_ms, _open.begin()->first + _bucket_ms);
+            Finalize(_open.begin());
+        }
+        return ADD_OPEN;
+    }
+
+    // Продвинуть водяной знак (например, по часам хоста, если источник молчит).
+    // Бакет за водяным знаком закрывается, когда интеграл дошёл до его конца: пришёл
+    // отсчёт не раньше конца бакета, или следующий отрезок был бы уже пропуском данных.
+    void AdvanceWatermark(int64_t watermark_ms) {
+        _watermark_ms = std::max(_watermark_ms, watermark_ms);
+        while (!_open.empty() && _open.begin()->first + _bucket_ms <= _watermark_ms &&
+               IntegralComplete(_open.begin()->first + _bucket_ms)) {
+            Finalize(_open.begin());
+        }
+    }
+
+    // Водяной знак двигается только через AdvanceWatermark: источник из нескольких
+    // каналов, у каждого из которых свой водяной знак
+    void SetManualWatermark() {
+        _manual_watermark = true;
+    }
+
+    int64_t Watermark() const {
+        return _watermark_ms;
+    }
+
+    // Время, до которого все бакеты уже закрыты: бакет, кончающийся не позже него,
+    // больше не появится среди открытых. Бакет за водяным знаком может ещё ждать
+    // конца интеграла, поэтому потребители, сводящие несколько роллапов, ждут этого
+    // времени, а не водяного знака.
+    int64_t FinalizedThrough() const {
+        return _open.empty() ? _watermark_ms : std::min(_watermark_ms, _open.begin()->first);
+    }
+
+    int64_t AllowedLateness() const {
+        return _allowed_lateness_ms;
+    }
+
+    int64_t BucketMs() const {
+        return _bucket_ms;
+    }
+
+    // Забрать бакеты, закрытые с прошлого вызова (в порядке времени)
+    std::vector<RollupBucket> TakeFinalized() {
+        std::vector<RollupBucket> result;
+        result.swap(_finalized);
+        return result;
+    }
+
+    // Забрать исправленные закрытые бакеты (по одному на бакет, с итоговым агрегатом)
+    std::vector<RollupBucket> TakeCorrections() {
+        std::vector<RollupBucket> result;
+        for (int64_t start : _corrected) {
+            auto it = _closed.find(start);
+            if (it != _closed.end()) {
+                result.push_back(RollupBucket{start, it->second});
+            }
+        }
+        _corrected.clear();
+        return result;
+    }
+
+    // Агрегат закрытого бакета; nullptr, если он не закрыт или уже забыт
+    const Partial* Closed(int64_t start_ms) const {
+        auto it = _closed.find(start_ms);
+        return (it != _closed.end()) ? &it->second : nullptr;
+    }
+
+    // Число отброшенных слишком поздних отсчётов
+    uint64_t Dropped() const {
+        return _dropped;
+    }
+
+private:
+    bool IntegralComplete(int64_t end_ms) const {
+        return !_has_last || _last_time_ms >= end_ms || _watermark_ms >= _last_time_ms + _max_gap_ms;
+    }
+
+    void Finalize(std::map<int64_t, Partial>::iterator it) {
+        _finalized.push_back(RollupBucket{it->first, it->second});
+        _closed[it->first] = it->second;
+        _open.erase(it);
+        while (_closed.size() > _max_closed_buckets) {
+            _closed.erase(_closed.begin());
+        }
+    }
+
+    AddResult Correct(int64_t start, double value, uint8_t flags) {
+        Partial* partial = ClosedForCorrection(start);
+        if (!partial) {
+            _dropped++;
+            return ADD_DROPPED;
+        }
+        partial->Add(value, flags);
+        return ADD_CORRECTION;
+    }
+
+    // Закрытый бакет для исправления (помечается исправленным); nullptr, если уже забыт.
+    // Закрытый бакет без отсчётов создаётся, если он ещё в пределах хранения.
+    Partial* ClosedForCorrection(int64_t start) {
+        auto it = _closed.find(start);
+        if (it == _closed.end()) {
+            if (start + (int64_t)_max_closed_buckets * _bucket_ms <= _watermark_ms) {
+                return nullptr;
+            }
+            it = _closed.emplace(start, Partial()).first;
+        }
+        _corrected.insert(start);
+        return &it->second;
+    }
+
+    // Интегрирование отрезка от предыдущего отсчёта до (time_ms, value)
+    void Integrate(int64_t time_ms, double value) {
+        if (_has_last && time_ms <= _last_time_ms) {
+            return; // Опоздавший отсчёт
+        }
+        if (_has_last && time_ms - _last_time_ms <= _max_gap_ms) {
+            double slope = (value - _last_value) / (double)(time_ms - _last_time_ms);
+            for (int64_t start = alignTime(_last_time_ms, _bucket_ms); start < time_ms; start += _bucket_ms) {
+                int64_t lo = std::max(_last_time_ms, start);
+                int64_t hi = std::min(time_ms, start + _bucket_ms);
+                double value_lo = _last_value + slope * (double)(lo - _last_time_ms);
+                double value_hi = _last_value + slope * (double)(hi - _last_time_ms);
+                // Бакет закрыт досрочно (переполнение буфера): хвост интеграла дописывается
+                // в сохранённый агрегат без пометки исправления - опоздавших отсчётов не было
+                Partial* partial = nullptr;
+                auto open = _open.find(start);
+                if (open != _open.end()) {
+                    partial = &open->second;
+                } else if (start + _bucket_ms > _watermark_ms) {
+                    partial = &_open[start];
+                } else {
+                    auto closed = _closed.find(start);
+                    partial = (closed != _closed.end()) ? &closed->second : nullptr;
+                }
+                if (partial) {
+                    partial->AddSegment(hi - lo, (value_lo + value_hi) / 2.0 * (double)(hi - lo),
+                                        _last_value * (double)(hi - lo));
+                }
+            }
+        }
+        _has_last = true;
+        _last_time_ms = time_ms;
+        _last_value = value;
+    }
+
+    int64_t _bucket_ms;
+    int64_t _allowed_lateness_ms;
+    size_t _max_open_buckets;
+    size_t _max_closed_buckets;
+    int64_t _max_gap_ms;
+    int64_t _watermark_ms;
+    uint64_t _dropped;
+    bool _manual_watermark = false;
+    bool _has_last = false;   // Последний интегрированный отсчёт
+    int64_t _last_time_ms = 0;
+    double _last_value = 0.0;
+    std::map<int64_t, Partial> _open;   // Начало бакета -> агрегат
+    std::map<int64_t, Partial> _closed; // Закрытые бакеты, доступные для исправлений
+    std::set<int64_t> _corrected;
+    std::vector<RollupBucket> _finalized;
+};
@@ -0,0 +1,374 @@
+#pragma once
+
+// Хранилище отсчётов в памяти в стиле LSM.
+//
+// Время делится на партиции (по умолчанию по часу). В каждой партиции новые
+// отсчёты попадают в memtable, отсортированную по ключу (канал, время), так что
+// отсчёты, пришедшие не по порядку и вперемешку из тысяч каналов, сразу
+// оказываются на своём месте. Заполненная memtable замораживается в
+// неизменяемый отсортированный прогон (SortedRun), а фоновый поток сливает
+// накопившиеся прогоны партиции в один. Чтение объединяет memtable и прогоны
+// k-путевым слиянием; при совпадении ключа побеждает более поздняя запись.
+//
+// Прогоны хранятся по столбцам (канал, время, значение, битовые плоскости
+// флагов качества). Агрегат по партиции из одного прогона считается прямо по
+// столбцам с маской флагов, без разбора отсчётов по одному.
+
+#include "quality.hpp"
+#include "bucket_cache.hpp"
+#include <map>
+#include <set>
+#include <queue>
+#include <mutex>
+#include <thread>
+#include <memory>
+#include <vector>
+#include <limits>
+#include <cstdint>
+#include <utility>
+#include <algorithm>
+#include <condition_variable>
+
+const int64_t PARTITION_MS_DEFAULT = 60 * 60 * 1000; // Размер партиции (1 час)
+const size_t MEMTABLE_LIMIT_DEFAULT = 4096;          // Отсчётов в memtable до заморозки
+const size_t MERGE_THRESHOLD_DEFAULT = 4;            // Прогонов в партиции до фонового слияния
+
+// Отсчёт одного канала
+struct Sample {
+    int64_t time_ms;
+    uint32_t channel;
+    double value;
+    uint8_t flags = 0;
+};
+
+// Неизменяемый отсортированный по (канал, время) прогон без повторов ключей.
+// seq растёт с каждой заморозкой: при равных ключах новее прогон с большим seq.
+struct SortedRun {
+    std::vector<uint32_t> channels;
+    std::vector<int64_t> times;
+    std::vector<double> values;
+    FlagColumn flags;
+    uint64_t seq = 0;
+
+    void PushBack(const Sample& sample) {
+        channels.push_back(sample.channel);
+        times.push_back(sample.time_ms);
+        values.push_back(sample.value);
+        flags.PushBack(sample.flags);
+    }
+
+    void Reserve(size_t size) {
+        channels.reserve(size);
+        times.reserve(size);
+        values.reserve(size);
+        flags.Reserve(size);
+    }
+
+    Sample At(size_t i) const {
+        return Sample{times[i], channels[i], values[i], flags.Get(i)};
+    }
+
+    size_t Size() const {
+        return times.size();
+    }
+
+    bool KeyLess(size_t i, uint32_t channel, int64_t time_ms) const {
+        return channels[i] < channel || (channels[i] == channel && times[i] < time_ms);
+    }
+
+    // Первая позиция с ключом не меньше (channel, time_ms)
+    size_t LowerBound(uint32_t channel, int64_t time_ms) const {
+        size_t lo = 0, hi = Size();
+        while (lo < hi) {
+            size_t mid = lo + (hi - lo) / 2;
+            if (KeyLess(mid, channel, time_ms))
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        return lo;
+    }
+
+    // Первая позиция с ключом больше (channel, time_ms)
+    size_t UpperBound(uint32_t channel, int64_t time_ms) const {
+        size_t lo = 0, hi = Size();
+        while (lo < hi) {
+            size_t mid = lo + (hi - lo) / 2;
+            if (!KeyLess(mid, channel, time_ms) && (channels[mid] != channel || times[mid] != time_ms))
+                hi = mid;
+            else
+                lo = mid + 1;
+        }
+        return lo;
+    }
+};
+
+typedef std::shared_ptr<const SortedRun> RunPtr;
+
+// Позиция в прогоне для k-путевого слияния
+struct RunCursor {
+    const SortedRun* run;
+    size_t pos;
+    size_t end;
+
+    uint32_t Channel() const {
+        return run->channels[pos];
+    }
+
+    int64_t Time() const {
+        return run->times[pos];
+    }
+};
+
+// k-путевое слияние прогонов одного канала в диапазоне [from_ms, to_ms] в порядке времени.
+// Для одинакового времени выдаётся значение из прогона с наибольшим seq.
+template<class F>
+void mergeRuns(const std::vector<RunPtr>& runs, uint32_t channel, int64_t from_ms, int64_t to_ms, F f) {
+    auto later = [](const RunCursor& a, const RunCursor& b) {
+        if (a.Time() != b.Time())
+            return a.Time() > b.Time();
+        return a.run->seq < b.run->seq;
+    };
+    std::priority_queue<RunCursor, std::vector<RunCursor>, decltype(later)> heap(later);
+
+    for (const auto& run : runs) {
+        size_t first = run->LowerBound(channel, from_ms);
+        size_t last = run->UpperBound(channel, to_ms);
+        if (first < last)
+            heap.push(RunCursor{run.get(), first, last});
+    }
+
+    bool emitted = false;
+    int64_t last_time = 0;
+    while (!heap.empty()) {
+        RunCursor cursor = heap.top();
+        heap.pop();
+        if (!emitted || cursor.Time() != last_time) {
+            f(cursor.run->At(cursor.pos));
+            last_time = cursor.Time();
+            emitted = true;
+        }
+        if (++cursor.pos != cursor.end)
+            heap.push(cursor);
+    }
+}
+
+class SampleStore {
+public:
+    SampleStore(int64_t partition_ms = PARTITION_MS_DEFAULT,
+                size_t memtable_limit = MEMTABLE_LIMIT_DEFAULT,
+                size_t merge_threshold = MERGE_THRESHOLD_DEFAULT)
+        : _partition_ms(partition_ms), _memtable_limit(memtable_limit),
+          _merge_threshold(std::max<size_t>(2, merge_threshold)), _next_seq(1), _stop(false) {
+        _merger = std::thread(&SampleStore::MergeLoop, this);
+    }
+
+    ~SampleStore() {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stop = true;
+        }
+        _cv.notify_all();
+        _merger.join();
+    }
+
+    // Добавить отсчёт (повтор ключа (канал, время) заменяет прежнее значение)
+    void Insert(const Sample& sample) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        Partition& partition = _partitions[PartitionStart(sample.time_ms)];
+        partition.memtable[Key(sample.channel, sample.time_ms)] = Cell{sample.value, sample.flags};
+        _channels.insert(sample.channel);
+        if (partition.memtable.size() >= _memtable_limit)
+            FreezeLocked(partition);
+    }
+
+    // Обойти отсчёты канала в [from_ms, to_ms] в порядке времени: f(const Sample&)
+    template<class F>
+    void Read(uint32_t channel, int64_t from_ms, int64_t to_ms, F f) {
+        // Партиции не пересекаются по времени, поэтому сливаются по очереди
+        for (const auto& runs : Snapshot(channel, from_ms, to_ms))
+            mergeRuns(runs, channel, from_ms, to_ms, f);
+    }
+
+    // Агрегат канала в [from_ms, to_ms] без отсчётов с флагами из exclude_mask
+    // (счётчики флагов - по всем отсчётам). Партиция из одного прогона
+    // агрегируется по столбцам, остальные - через слияние.
+    Partial Aggregate(uint32_t channel, int64_t from_ms, int64_t to_ms,
+                      uint8_t exclude_mask = QUALITY_EXCLUDE_DEFAULT) {
+        Partial result;
+        for (const auto& runs : Snapshot(channel, from_ms, to_ms)) {
+            if (runs.size() == 1) {
+                const SortedRun& run = *runs.front();
+                result.AddMasked(run.values.data(), run.flags, run.LowerBound(channel, from_ms),
+                                 run.UpperBound(channel, to_ms), exclude_mask);
+                continue;
+            }
+            mergeRuns(runs, channel, from_ms, to_ms, [&](const Sample& sample) {
+                result.Add(sample.value, sample.flags, exclude_mask);
+            });
+        }
+        return result;
+    }
+
+    // Каналы, по которым были отсчёты
+    std::vector<uint32_t> Channels() {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return std::vector<uint32_t>(_channels.begin(), _channels.end());
+    }
+
+    // Удалить партиции, целиком лежащие раньше time_ms
+    void DropBefore(int64_t time_ms) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto last = _partitions.begin();
+        while (last != _partitions.end() && last->first + _partition_ms <= time_ms)
+            ++last;
+        _partitions.erase(_partitions.begin(), last);
+    }
+
+    // Число отсчётов (с учётом ещё не слитых повторов)
+    size_t Size() {
+        std::lock_guard<std::mutex> lock(_mutex);
+        size_t size = 0;
+        for (const auto& partition : _partitions) {
+            size += partition.second.memtable.size();
+            for (const auto& run : partition.second.runs)
+                size += run->Size();
+        }
+        return size;
+    }
+
+private:
+    typedef std::pair<uint32_t, int64_t> Key;
+
+    struct Cell {
+        double value;
+        uint8_t flags;
+    };
+
+    struct Partition {
+        std::map<Key, Cell> memtable;
+        std::vector<RunPtr> runs; // В порядке заморозки
+    };
+
+    // Снимок партиций, пересекающих [from_ms, to_ms]: ссылки на прогоны и копия нужного куска memtable.
+    // Только он делается под блокировкой.
+    std::vector<std::vector<RunPtr>> Snapshot(uint32_t channel, int64_t from_ms, int64_t to_ms) {
+        std::vector<std::vector<RunPtr>> snapshot;
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto it = _partitions.lower_bound(PartitionStart(from_ms));
+        for (; it != _partitions.end() && it->first <= to_ms; ++it) {
+            std::vector<RunPtr> runs = it->second.runs;
+            auto mem = std::make_shared<SortedRun>();
+            mem->seq = _next_seq; // memtable новее любого прогона
+            auto first = it->second.memtable.lower_bound(Key(channel, from_ms));
+            auto last = it->second.memtable.upper_bound(Key(channel, to_ms));
+            for (; first != last; ++first)
+                mem->PushBack(Sample{first->first.second, channel, first->second.value, first->second.flags});
+            if (mem->Size() > 0)
+                runs.push_back(mem);
+            snapshot.push_back(std::move(runs));
+        }
+        return snapshot;
+    }
+
+    // Начало партиции time_ms; у самых малых времён (границ "с начала") - без переполнения
+    int64_t PartitionStart(int64_t time_ms) const {
+        int64_t r = time_ms % _partition_ms;
+        if (r < 0 && time_ms - r < std::numeric_limits<int64_t>::min() + _partition_ms)
+            return std::numeric_limits<int64_t>::min();
+        return time_ms - (r < 0 ? r + _partition_ms : r);
+    }
+
+    // Заморозить memtable в прогон; ключи map уже отсортированы
+    void FreezeLocked(Partition& partition) {
+        auto run = std::make_shared<SortedRun>();
+        run->seq = _next_seq++;
+        run->Reserve(partition.memtable.size());
+        for (const auto& entry : partition.memtable)
+            run->PushBack(Sample{entry.first.second, entry.first.first, entry.second.value, entry.second.flags});
+        partition.memtable.clear();
+        partition.runs.push_back(run);
+        if (partition.runs.size() >= _merge_threshold)
+            _cv.notify_one();
+    }
+
+    // Слить прогоны в один; при равных ключах остаётся значение из прогона с большим seq
+    static RunPtr MergeAll(const std::vector<RunPtr>& runs) {
+        auto merged = std::make_shared<SortedRun>();
+        size_t total = 0;
+        for (const auto& run : runs) {
+            total += run->Size();
+            merged->seq = std::max(merged->seq, run->seq);
+        }
+        merged->Reserve(total);
+
+        auto later = [](const RunCursor& a, const RunCursor& b) {
+            if (a.Channel() != b.Channel())
+                return a.Channel() > b.Channel();
+            if (a.Time() != b.Time())
+                return a.Time() > b.Time();
+            return a.run->seq < b.run->seq;
+        };
+        std::priority_queue<RunCursor, std::vector<RunCursor>, decltype(later)> heap(later);
+        for (const auto& run : runs) {
+            if (run->Size() > 0)
+                heap.push(RunCursor{run.get(), 0, run->Size()});
+        }
+        while (!heap.empty()) {
+            RunCursor cursor = heap.top();
+            heap.pop();
+            size_t last = merged->Size();
+            if (last == 0 || merged->KeyLess(last - 1, cursor.Channel(), cursor.Time()))
+                merged->PushBack(cursor.run->At(cursor.pos));
+            if (++cursor.pos != cursor.end)
+                heap.push(cursor);
+        }
+        return merged;
+    }
+
+    // Фоновое слияние прогонов; само слияние идёт без блокировки хранилища
+    void MergeLoop() {
+        std::unique_lock<std::mutex> lock(_mutex);
+        for (;;) {
+            _cv.wait(lock, [this] { return _stop || FindMergeCandidate() != _partitions.end(); });
+            if (_stop)
+                return;
+            auto it = FindMergeCandidate();
+            int64_t partition_start = it->first;
+            std::vector<RunPtr> runs = it->second.runs;
+
+            lock.unlock();
+            RunPtr merged = MergeAll(runs);
+            lock.lock();
+
+            // Партиция могла быть удалена, а в конец - дописаны новые прогоны
+            it = _partitions.find(partition_start);
+            if (it == _partitions.end())
+                continue;
+            auto& current = it->second.runs;
+            if (current.size() >= runs.size() && std::equal(runs.begin(), runs.end(), current.begin())) {
+                current.erase(current.begin(), current.begin() + runs.size());
+                current.insert(current.begin(), merged);
+            }
+        }
+    }
+
+    std::map<int64_t, Partition>::iterator FindMergeCandidate() {
+        for (auto it = _partitions.begin(); it != _partitions.end(); ++it) {
+            if (it->second.runs.size() >= _merge_threshold)
+                return it;
+        }
+        return _partitions.end();
+    }
+
+    int64_t _partition_ms;
+    size_t _memtable_limit;
+    size_t _merge_threshold;
+    uint64_t _next_seq;
+    bool _stop;
+    std::mutex _mutex;
+    std::condition_variable _cv;
+    std::map<int64_t, Partition> _partitions; // Начало партиции -> партиция
+    std::set<uint32_t> _channels;
+    std::thread _merger;
+};
@@ -0,0 +1,1679 @@
+// Ядро приёма отсчётов: разбор чтений, калибровка, фильтры, хранилище, роллапы
+// и запись логов на диске; снаружи доступно через C ABI из templog.h.
+
+#include "templog.h"
+#include "log_format.hpp"
+#include "history.hpp"
+#include "rollup.hpp"
+#include "sample_store.hpp"
+#include "clock_sync.hpp"
+#include "metrics.hpp"
+#include "calibration.hpp"
+#include "filters.hpp"
+#include "gaps.hpp"
+#include "records.hpp"
+#include "aggregates.hpp"
+#include "anomaly.hpp"
+#include "forecast.hpp"
+#include "correlation.hpp"
+#include "latest_board.hpp"
+#include "query_lang.hpp"
+#include "query_scheduler.hpp"
+#include <filesystem>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <iomanip>
+#include <ctime>
+#include <deque>
+#include <algorithm>
+#include <mutex>
+#include <atomic>
+#include <limits>
+#include <memory>
+#include <cstring>
+#include <condition_variable>
+
+// Состояние и вспомогательные функции ядра видны только в этой единице
+// трансляции; наружу торчат лишь функции templog.h
+namespace {
+
+// Лог в памяти: записи и число последних записей, ещё не сброшенных на диск
+struct MemoryLog {
+    std::deque<std::string> entries;
+    size_t unsynced = 0;
+};
+
+// Константы
+const int MAX_TIME_DEFAULT = 24 * 60 * 60; // Максимальное время хранения записей в основном логе (24 часа)
+const int MAX_TIME_HOUR = 30 * 24 * 60 * 60; // Максимальное время хранения записей в логе за час (30 дней)
+const int MAX_TIME_DAY = 365 * 24 * 60 * 60; // Максимальное время хранения записей в логе за день (1 год)
+const int HOUR = 60 * 60;                   // Количество секунд в часе
+const int DAY = 24 * 60 * 60;               // Количество секунд в дне
+
+// Настройки формата логов
+bool fixed_width_format = false;          // Строки фиксированной ширины + разреженный индекс
+int index_every = INDEX_EVERY_DEFAULT;    // Шаг разреженного индекса (в строках)
+
+// Допустимое опоздание отсчётов: столько ждём отставшие данные перед
+// закрытием бакетов роллапов и записью отсчётов на диск
+int64_t allowed_lateness_ms = ALLOWED_LATENESS_MS_DEFAULT;
+
+// Ожидаемый период отсчётов для поиска пробелов (0 - оценивать по данным)
+int64_t expected_period_ms = 0;
+
+// Интегралы роллапов: самый длинный интегрируемый отрезок между отсчётами
+// и вид интеграла в логах (трапеции или ступенька)
+int64_t integral_max_gap_ms = INTEGRAL_MAX_GAP_MS_DEFAULT;
+bool step_integral = false;
+
+// Бакет модели прогноза и правила предупреждений о предсказанном выходе за границу
+int64_t forecast_bucket_ms = FORECAST_BUCKET_MS_DEFAULT;
+std::vector<ForecastAlertRule> forecast_alerts;
+
+// Уровень роллапа (час/день): агрегаты по времени событий и их логи в памяти
+struct RollupTier {
+    EventTimeRollup rollup;
+    MemoryLog memory;      // Закрытые бакеты
+    MemoryLog fix_memory;  // Исправления закрытых бакетов опоздавшими отсчётами
+    MemoryLog quality_memory; // Число отсчётов бакета и счётчики флагов качества
+    MemoryLog twa_memory;     // Средние, взвешенные по времени
+    MemoryLog integral_memory; // Интегралы (градусо-часы)
+    bool detailed = true;     // Вести логи качества и интегралов (только для основного значения)
+    std::unique_ptr<AnomalyDetector> anomaly; // Поиск аномалий по закрытым бакетам (если задан)
+    MemoryLog anomaly_memory;                 // Найденные аномалии
+
+    RollupTier(int bucket_seconds, int max_age_seconds)
+        : rollup((int64_t)bucket_seconds * 1000, allowed_lateness_ms, max_age_seconds / bucket_seconds,
+                 MAX_OPEN_BUCKETS_DEFAULT, integral_max_gap_ms) {}
+};
+
+// Непрерывный агрегат из конфигурации и его логи в памяти (по функции)
+struct AggregateState {
+    ContinuousAggregate aggregate;
+    std::vector<MemoryLog> memory;
+    std::vector<MemoryLog> fix_memory;
+
+    explicit AggregateState(const AggregateDefinition& definition)
+        : aggregate(definition, allowed_lateness_ms),
+          memory(definition.functions.size()), fix_memory(definition.functions.size()) {}
+};
+
+// Отсчёт, опоздавший к записи своего времени на диск
+struct LateSample {
+    int64_t time_ms;
+    double value;
+    double raw;
+    uint8_t flags;
+};
+
+// Состояние канала: роллапы и граница записанных на диск отсчётов
+struct ChannelState {
+    RollupTier hour{HOUR, MAX_TIME_HOUR};
+    RollupTier day{DAY, MAX_TIME_DAY};
+    ClockSync clock; // Часы устройства -> часы хоста
+    GapIndex gaps{expected_period_ms}; // Пропуски данных
+    bool gaps_ready = false;           // Индекс продолжен с хвоста лога на диске
+    std::vector<RollupTier> field_hour;   // Роллапы дополнительных полей записи (со второго)
+    std::vector<RollupTier> field_day;
+    std::vector<AggregateState*> aggregates; // Агрегаты из конфигурации, в которые входит канал
+    bool aggregates_ready = false;
+    std::vector<std::pair<CorrelationGroup*, int>> correlations; // Группы корреляций канала и номер в них
+    bool correlations_ready = false;
+    std::unique_ptr<SampleFilter> filter; // Фильтр выбросов (если настроен для канала)
+    bool filter_ready = false;
+    std::map<std::string, int64_t> synced_until_ms; // Лог -> последний записанный на диск отсчёт
+    std::vector<LateSample> late_samples; // Отсчёты, пришедшие, когда их время уже было записано на диск
+    std::vector<std::pair<int64_t, std::vector<double>>> late_records; // То же для многополевых записей
+    EventTimeRollup forecast_rollup{forecast_bucket_ms, allowed_lateness_ms}; // Бакеты для модели прогноза
+    HoltWinters forecast{forecast_bucket_ms};
+    bool forecast_loaded = false;       // Состояние модели прочитано с диска
+    bool anomaly_loaded = false;        // Состояние поиска аномалий прочитано с диска
+    std::vector<char> breach_predicted; // По правилам forecast_alerts: выход за границу предсказан
+    MemoryLog forecast_alert_memory;    // Предупреждения о предсказанном выходе и их снятие
+
+    ChannelState() {
+        hour.anomaly.reset(new AnomalyDetector());
+    }
+};
+
+// Пачка отсчётов одного чтения, разложенная по столбцам
+struct IngestBatch {
+    std::vector<uint32_t> channels;
+    std::vector<int64_t> times;
+    std::vector<double> raw;     // Значения как пришли от устройства
+    std::vector<double> values;  // После калибровки
+    std::vector<uint8_t> flags;  // Флаги качества (QualityFlag)
+    // Дополнительные поля многополевых записей (со второго): поля строки i
+    // лежат в fields начиная с field_begin[i]
+    std::vector<double> fields;
+    std::vector<size_t> field_begin;
+
+    void Clear() {
+        channels.clear();
+        times.clear();
+        raw.clear();
+        values.clear();
+        flags.clear();
+        fields.clear();
+        field_begin.clear();
+    }
+
+    size_t Size() const {
+        return channels.size();
+    }
+
+    size_t FieldCount(size_t i) const {
+        return ((i + 1 < field_begin.size()) ? field_begin[i + 1] : fields.size()) - field_begin[i];
+    }
+};
+
+// Глобальные переменные для хранения логов в памяти
+std::mutex log_mutex;
+std::unique_ptr<SampleStore> sample_store; // Отсчёты всех каналов (основной лог температур)
+std::map<uint32_t, ChannelState> channels; // Канал -> состояние
+
+// Калибровка каналов: таблица подменяется целиком через std::atomic_store при перечитывании файла
+std::string calibration_file;
+std::filesystem::file_time_type calibration_mtime;
+std::shared_ptr<const CalibrationTable> calibration = std::make_shared<CalibrationTable>();
+
+// Сырые (до калибровки) значения, если включено их хранение
+std::unique_ptr<SampleStore> raw_store;
+
+// Настройки фильтров выбросов
+FilterConfig filter_config;
+
+// Схемы многополевых записей и сами записи по столбцам
+SchemaConfig schema_config;
+std::unique_ptr<RecordStore> record_store;
+
+// Непрерывные агрегаты из конфигурации
+std::vector<std::unique_ptr<AggregateState>> aggregates;
+
+// Группы каналов для потоковых корреляций
+std::vector<std::unique_ptr<CorrelationGroup>> correlation_groups;
+
+// Последние принятые значения каналов (в памяти процесса или, с --latest-shm, в разделяемой памяти)
+LatestBoard latest_board;
+
+// Получатель сообщений (принятые строки, отбраковка, ошибки записи); без него сообщения отбрасываются
+templog_message_fn message_fn = nullptr;
+void* message_user = nullptr;
+int message_level = TEMPLOG_INFO; // Сообщения ниже этого уровня не формируются
+
+// Нужно ли формировать сообщение уровня level
+bool reporting(int level) {
+    return message_fn && level >= message_level;
+}
+
+void report(int level, const std::string& message) {
+    if (reporting(level)) {
+        message_fn(message_user, level, message.c_str());
+    }
+}
+
+// Функция для преобразования любого типа в строку
+template<class T>
+std::string to_string(const T& v) {
+    std::ostringstream ss;
+    ss << v;
+    return ss.str();
+}
+
+// Время в формате лога "YYYY-MM-DD HH:MM:SS.MS", местное
+// (в формате фиксированной ширины - UTC с ведущими нулями)
+std::string formatLogTime(int64_t time_ms) {
+    if (fixed_width_format) {
+        return formatTimestamp(time_ms);
+    }
+
+    std::tm tm = localTime((std::time_t)(time_ms / 1000));
+    std::ostringstream oss;
+    oss << tm.tm_year + 1900 << "-" << tm.tm_mon + 1 << "-" << tm.tm_mday << " "
+        << tm.tm_hour << ":" << tm.tm_min << ":" << tm.tm_sec << "."
+        << time_ms % 1000;
+    return oss.str();
+}
+
+// Имя лога канала: для канала 0 - "<base>.log", для остальных - "<base>_<канал>.log"
+std::string channelLogName(const std::string& base, uint32_t channel) {
+    if (channel == 0) {
+        return base + ".log";
+    }
+    return base + "_" + to_string(channel) + ".log";
+}
+
+// Парсинг строки времени в структуру tm
+bool parseTime(const std::string& time_str, std::tm& tm) {
+    if (time_str.size() < 19) return false;
+
+    std::istringstream ss(time_str);
+    char delimiter;
+    ss >> tm.tm_year >> delimiter >> tm.tm_mon >> delimiter >> tm.tm_mday
+       >> tm.tm_hour >> delimiter >> tm.tm_min >> delimiter >> tm.tm_sec;
+
+    if (ss.fail()) return false;
+
+    tm.tm_year -= 1900;
+    tm.tm_mon -= 1;
+
+    return true;
+}
+
+// Запись в лог (в память) с временем записи time_ms
+void writeToLog(const std::string& message, MemoryLog& log_memory, int64_t time_ms) {
+    std::string value = message;
+    if (fixed_width_format) {
+        value = formatValue(std::stod(message));
+    }
+
+    std::lock_guard<std::mutex> lock(log_mutex);
+    log_memory.entries.push_back(formatLogTime(time_ms) + ": " + value);
+    log_memory.unsynced++;
+}
+
+// Сводки текущих (ещё не закрытых) блоков логов фиксированной ширины;
+// сводка дописывается в "<log>.stats", когда в логе начинается следующий блок
+std::map<std::string, BlockStats> open_block_stats;
+
+// Сводка последнего блока лога, который в этом запуске ещё не дописывался:
+// строки от начала блока до конца файла
+BlockStats loadOpenBlockStats(const std::string& log_file_name, uint64_t file_size) {
+    BlockStats stats;
+    uint64_t lines = file_size / FIXED_LINE_SIZE;
+    if (lines == 0) {
+        return stats;
+    }
+    stats.offset = (lines - 1) / index_every * index_every * FIXED_LINE_SIZE;
+    std::ifstream logFile(log_file_name, std::ios::binary);
+    logFile.seekg(stats.offset);
+    char buf[FIXED_LINE_SIZE];
+    while (logFile.read(buf, FIXED_LINE_SIZE)) {
+        int64_t time_ms = 0;
+        double value = 0.0;
+        if (parseFixedLine(buf, FIXED_LINE_SIZE, time_ms, value)) {
+            stats.Add(time_ms, value);
+        }
+    }
+    return stats;
+}
+
+// Вид строк лога: "время: значение" (с --fixed-width - фиксированной ширины,
+// с индексом и сводками блоков) или произвольный текст после времени
+enum LogLayout {
+    LOG_VALUES,
+    LOG_TEXT
+};
+
+// Дописать строки в лог на диске;
+// для значений в формате фиксированной ширины дополняются разреженный индекс и сводки блоков
+void appendLogLines(const std::vector<std::string>& lines, const std::string& log_file_name, LogLayout layout) {
+    if (lines.empty()) {
+        return;
+    }
+
+    std::ofstream logFile(log_file_name, std::ios::app);
+    if (!logFile.is_open()) {
+        report(TEMPLOG_WARNING, "Failed to open log file: " + log_file_name);
+        return;
+    }
+
+    std::ofstream indexFile;
+    std::ofstream statsFile;
+    logFile.seekp(0, std::ios::end);
+    uint64_t offset = (uint64_t)logFile.tellp();
+
+    bool indexed = fixed_width_format && layout == LOG_VALUES;
+    BlockStats* block = nullptr;
+    if (indexed) {
+        auto it = open_block_stats.find(log_file_name);
+        if (it == open_block_stats.end()) {
+            it = open_block_stats.emplace(log_file_name, loadOpenBlockStats(log_file_name, offset)).first;
+        }
+        block = &it->second;
+    }
+
+    for (const auto& line : lines) {
+        int64_t time_ms = 0;
+        if (indexed && (offset / FIXED_LINE_SIZE) % index_every == 0) {
+            if (parseTimestamp(line, time_ms)) {
+                if (!indexFile.is_open()) {
+                    indexFile.open(indexFileName(log_file_name), std::ios::app);
+                }
+                appendIndexEntry(indexFile, IndexEntry{time_ms, offset});
+                // Закрылся предыдущий блок
+                if (block->count > 0) {
+                    if (!statsFile.is_open()) {
+                        statsFile.open(statsFileName(log_file_name), std::ios::app);
+                    }
+                    appendBlockStats(statsFile, *block);
+                }
+                *block = BlockStats();
+                block->offset = offset;
+            }
+        }
+        double value = 0.0;
+        if (block && parseFixedLine(line.data(), line.size(), time_ms, value)) {
+            block->Add(time_ms, value);
+        }
+        logFile << line << '\n';
+        offset += line.size() + 1;
+    }
+}
+
+// Запись качества бакета роллапа: "<время>: n=<в среднем> rejected=... calibrated=... coverage=<доля>".
+// Исправленный бакет записывается ещё раз с итоговыми счётчиками.
+void writeQualityLog(const RollupBucket& bucket, int64_t bucket_ms, const GapIndex& gaps, MemoryLog& log_memory) {
+    std::string line = formatLogTime(bucket.start_ms) + ": n=" + to_string(bucket.partial.count);
+    for (int f = 0; f < QUALITY_FLAG_COUNT; f++) {
+        line += std::string(" ") + QUALITY_FLAG_NAMES[f] + "=" + to_string(bucket.partial.flag_counts[f]);
+    }
+    line += " coverage=" + to_string(gaps.Coverage(bucket.start_ms, bucket.start_ms + bucket_ms));
+
+    std::lock_guard<std::mutex> lock(log_mutex);
+    log_memory.entries.push_back(line);
+    log_memory.unsynced++;
+}
+
+// Синхронизация лога с диском: дописываются только новые записи
+void syncLogToDisk(MemoryLog& log_memory, const std::string& log_file_name, LogLayout layout) {
+    std::lock_guard<std::mutex> lock(log_mutex);
+    std::vector<std::string> lines(log_memory.entries.end() - log_memory.unsynced, log_memory.entries.end());
+    appendLogLines(lines, log_file_name, layout);
+    log_memory.unsynced = 0;
+}
+
+// Синхронизация отсчётов канала из хранилища с диском в порядке времени.
+// Пишутся отсчёты не новее horizon_ms (более свежие ещё могут дополниться опоздавшими)
+// и только с (flags & flags_mask) == flags_value.
+void syncSamplesToDisk(SampleStore& store, uint32_t channel, ChannelState& state, const std::string& log_base,
+                       int64_t horizon_ms, uint8_t flags_mask = 0, uint8_t flags_value = 0) {
+    auto synced = state.synced_until_ms.emplace(log_base, std::numeric_limits<int64_t>::min()).first;
+    if (horizon_ms <= synced->second) {
+        return;
+    }
+
+    std::vector<std::string> lines;
+    store.Read(channel, synced->second + 1, horizon_ms, [&](const Sample& sample) {
+        if ((sample.flags & flags_mask) != flags_value) {
+            return;
+        }
+        std::string value = fixed_width_format ? formatValue(sample.value) : to_string(sample.value);
+        lines.push_back(formatLogTime(sample.time_ms) + ": " + value);
+    });
+    appendLogLines(lines, channelLogName(log_base, channel), LOG_VALUES);
+    synced->second = horizon_ms;
+}
+
+// Текст поля записи для лога: целые - без дробной части, в формате
+// фиксированной ширины - ровно VALUE_WIDTH символов
+std::string recordFieldText(const FieldSpec& field, double value) {
+    std::string text;
+    if (field.type == FIELD_INT && !std::isnan(value)) {
+        text = to_string(recordInt(value));
+        // Не влезает в ширину поля - как у вещественных, в экспоненциальной записи
+        if (fixed_width_format && text.size() > VALUE_WIDTH) {
+            text = formatValue(value);
+        }
+    } else {
+        text = fixed_width_format ? formatValue(value) : to_string(value);
+    }
+    if (fixed_width_format && text.size() < VALUE_WIDTH) {
+        text.insert(0, VALUE_WIDTH - text.size(), ' ');
+    }
+    return text;
+}
+
+// Синхронизация дополнительных полей многополевых записей канала с диском:
+// каждое поле - в свой лог "log_<поле>[_<канал>].log" в порядке времени
+void syncRecordsToDisk(uint32_t channel, ChannelState& state, int64_t horizon_ms) {
+    RecordSchema schema;
+    if (!record_store->Schema(channel, schema) || schema.fields.size() < 2) {
+        return;
+    }
+    auto synced = state.synced_until_ms.emplace("records", std::numeric_limits<int64_t>::min()).first;
+    if (horizon_ms <= synced->second) {
+        return;
+    }
+
+    std::vector<std::pair<int64_t, std::vector<double>>> rows;
+    record_store->Read(channel, synced->second + 1, horizon_ms, [&](int64_t time_ms, const double* values) {
+        rows.emplace_back(time_ms, std::vector<double>(values, values + schema.fields.size()));
+    });
+    std::stable_sort(rows.begin(), rows.end(), [](const auto& a, const auto& b) {
+        return a.first < b.first;
+    });
+    for (size_t f = 1; f < schema.fields.size(); f++) {
+        std::vector<std::string> lines;
+        for (const auto& row : rows) {
+            lines.push_back(formatLogTime(row.first) + ": " + recordFieldText(schema.fields[f], row.second[f]));
+        }
+        appendLogLines(lines, channelLogName("log_" + schema.fields[f].name, channel), LOG_VALUES);
+    }
+    synced->second = horizon_ms;
+}
+
+// Граница записанного на диск для лога канала
+int64_t syncedUntil(const ChannelState& state, const std::string& log_base) {
+    auto it = state.synced_until_ms.find(log_base);
+    return (it != state.synced_until_ms.end()) ? it->second : std::numeric_limits<int64_t>::min();
+}
+
+// Отсчёты, опоздавшие к записи своего времени на диск, дописываются в "<лог>.late"
+// (в порядке времени внутри одной синхронизации, без индекса): основной лог
+// упорядочен по времени и не дополняется задним числом. Роллапы такие отсчёты
+// учитывают исправлениями, так что по .late видно, откуда исправление взялось.
+void syncLateToDisk(uint32_t channel, ChannelState& state) {
+    if (state.late_samples.empty() && state.late_records.empty()) {
+        return;
+    }
+    std::stable_sort(state.late_samples.begin(), state.late_samples.end(), [](const auto& a, const auto& b) {
+        return a.time_ms < b.time_ms;
+    });
+    std::vector<std::string> accepted, rejected, raw;
+    for (const auto& sample : state.late_samples) {
+        std::string time = formatLogTime(sample.time_ms) + ": ";
+        std::string value = fixed_width_format ? formatValue(sample.value) : to_string(sample.value);
+        ((sample.flags & QUALITY_REJECTED) ? rejected : accepted).push_back(time + value);
+        if (raw_store) {
+            raw.push_back(time + (fixed_width_format ? formatValue(sample.raw) : to_string(sample.raw)));
+        }
+    }
+    appendLogLines(accepted, channelLogName("log_temp", channel) + ".late", LOG_TEXT);
+    appendLogLines(rejected, channelLogName("log_temp_rejected", channel) + ".late", LOG_TEXT);
+    appendLogLines(raw, channelLogName("log_temp_raw", channel) + ".late", LOG_TEXT);
+
+    RecordSchema schema;
+    if (!state.late_records.empty() && record_store->Schema(channel, schema)) {
+        std::stable_sort(state.late_records.begin(), state.late_records.end(), [](const auto& a, const auto& b) {
+            return a.first < b.first;
+        });
+        for (size_t f = 1; f < schema.fields.size(); f++) {
+            std::vector<std::string> lines;
+            for (const auto& row : state.late_records) {
+                if (f >= row.second.size()) {
+                    continue;
+                }
+                lines.push_back(formatLogTime(row.first) + ": " + recordFieldText(schema.fields[f], row.second[f]));
+            }
+            appendLogLines(lines, channelLogName("log_" + schema.fields[f].name, channel) + ".late", LOG_TEXT);
+        }
+    }
+
+    size_t count = state.late_samples.size();
+    metrics().Add(channelMetric("templog_late_written_total", channel), (double)count);
+    if (count > 0) {
+        report(TEMPLOG_WARNING, to_string(count) + " samples of channel " + to_string(channel) +
+                                " arrived after their time was written, appended to " +
+                                channelLogName("log_temp", channel) + ".late");
+    }
+    state.late_samples.clear();
+    state.late_records.clear();
+}
+
+// Перечитать файл калибровки, если он изменился; приём данных не останавливается.
+// Ошибки добавляются в errors; false - файл не прочитан, действует прежняя таблица
+bool reloadCalibration(std::string& errors) {
+    if (calibration_file.empty()) {
+        return true;
+    }
+    std::error_code ec;
+    auto mtime = std::filesystem::last_write_time(calibration_file, ec);
+    if (ec) {
+        // О пропавшем файле сообщается один раз, а не при каждой синхронизации
+        if (calibration_mtime != std::filesystem::file_time_type::min()) {
+            calibration_mtime = std::filesystem::file_time_type::min();
+            errors += "Failed to read calibration file: " + calibration_file + " (" + ec.message() + ")\n";
+        }
+        return false;
+    }
+    if (mtime == calibration_mtime) {
+        return true;
+    }
+    calibration_mtime = mtime;
+
+    auto table = CalibrationTable::Load(calibration_file, errors);
+    if (!table) {
+        return false;
+    }
+    std::atomic_store(&calibration, table);
+    report(TEMPLOG_INFO, "Calibration loaded from " + calibration_file);
+    return true;
+}
+
+// Очистка старых записей в логе (в памяти)
+void cleanOldEntries(MemoryLog& log_memory, int max_age_seconds) {
+    std::lock_guard<std::mutex> lock(log_mutex);
+    std::time_t now = std::time(nullptr);
+    while (!log_memory.entries.empty()) {
+        std::tm tm = {};
+        if (parseTime(log_memory.entries.front().substr(0, 19), tm)) {
+            std::time_t entry_time = fixed_width_format ? utcTimeToEpoch(tm) : std::mktime(&tm);
+            if (now - entry_time < max_age_seconds) {
+                break;
+            }
+        }
+        log_memory.entries.pop_front();
+    }
+    if (log_memory.unsynced > log_memory.entries.size()) {
+        log_memory.unsynced = log_memory.entries.size();
+    }
+}
+
+// Запись бакета в логи качества, средних по времени и интегралов.
+// Исправленный бакет записывается в них ещё раз с итоговыми значениями.
+void writeBucketDetails(const RollupBucket& bucket, RollupTier& tier, const GapIndex& gaps) {
+    writeQualityLog(bucket, tier.rollup.BucketMs(), gaps, tier.quality_memory);
+    if (bucket.partial.count > 0 || bucket.partial.covered_ms > 0) {
+        writeToLog(to_string(bucket.partial.TimeWeightedAverage()), tier.twa_memory, bucket.start_ms);
+    }
+    if (bucket.partial.covered_ms > 0) {
+        double integral = step_integral ? bucket.partial.step_integral : bucket.partial.integral;
+        writeToLog(to_string(integral / (3600.0 * 1000.0)), tier.integral_memory, bucket.start_ms);
+    }
+}
+
+// Запись аномалии: "<время>: <вид> value=<среднее> expected=<норма> z=<оценка>"
+void writeAnomalyLog(int64_t time_ms, double value, const AnomalyScore& score, MemoryLog& log_memory) {
+    std::string line = formatLogTime(time_ms) + ": " + anomalyKindName(score.kind) + " value=" + to_string(value) +
+                       " expected=" + to_string(score.expected) + " z=" + to_string(score.z);
+
+    std::lock_guard<std::mutex> lock(log_mutex);
+    log_memory.entries.push_back(line);
+    log_memory.unsynced++;
+}
+
+// Файл состояния модели прогноза канала: "forecast[_<канал>].state"
+std::string forecastStateName(uint32_t channel) {
+    return (channel == 0) ? std::string("forecast.state") : "forecast_" + to_string(channel) + ".state";
+}
+
+// Файл состояния поиска аномалий канала: "anomaly[_<канал>].state"
+std::string anomalyStateName(uint32_t channel) {
+    return (channel == 0) ? std::string("anomaly.state") : "anomaly_" + to_string(channel) + ".state";
+}
+
+// Обновление модели прогноза закрытыми бакетами и проверка правил предупреждений.
+// Правило срабатывает, когда прогноз в пределах его горизонта выходит за границу,
+// и снимается, когда перестаёт выходить.
+void updateForecast(uint32_t channel, ChannelState& state) {
+    if (!state.forecast_loaded) {
+        if (!state.forecast.Load(forecastStateName(channel)) || state.forecast.BucketMs() != forecast_bucket_ms) {
+            state.forecast = HoltWinters(forecast_bucket_ms);
+        }
+        state.breach_predicted.assign(forecast_alerts.size(), 0);
+        state.forecast_loaded = true;
+    }
+    auto buckets = state.forecast_rollup.TakeFinalized();
+    for (const auto& bucket : buckets) {
+        if (bucket.partial.count > 0) {
+            state.forecast.Add(bucket.start_ms, bucket.partial.Average());
+        }
+    }
+    if (buckets.empty() || !state.forecast.Ready()) {
+        return;
+    }
+
+    for (size_t r = 0; r < forecast_alerts.size(); r++) {
+        const ForecastAlertRule& rule = forecast_alerts[r];
+        if (!rule.Matches(channel)) {
+            continue;
+        }
+        bool found = false;
+        int64_t breach_ms = 0;
+        Forecast breach;
+        int64_t steps = std::max<int64_t>(1, (rule.horizon_ms + forecast_bucket_ms - 1) / forecast_bucket_ms);
+        state.forecast.Project(steps, [&](int64_t start_ms, const Forecast& forecast) {
+            found = rule.Breached(forecast.value);
+            breach_ms = start_ms;
+            breach = forecast;
+            return !found;
+        });
+        if (found == (state.breach_predicted[r] != 0)) {
+            continue;
+        }
+        state.breach_predicted[r] = found;
+        std::string line = formatLogTime(state.forecast.LastBucket()) + ": " + (rule.above ? "above " : "below ") +
+                           to_string(rule.limit);
+        if (found) {
+            line += " predicted at " + formatLogTime(breach_ms) + " forecast=" + to_string(breach.value) +
+                    " [" + to_string(breach.low) + ", " + to_string(breach.high) + "]";
+        } else {
+            line += " cleared";
+        }
+        std::lock_guard<std::mutex> lock(log_mutex);
+        state.forecast_alert_memory.entries.push_back(line);
+        state.forecast_alert_memory.unsynced++;
+    }
+}
+
+// Корреляции пар группы за последний закрытый бакет статистики и средняя
+// корреляция каждого канала с соседями по группе (низкая - повод проверить датчик)
+void writeCorrelationMetrics(const CorrelationGroupDefinition& definition, const MomentsBucket& bucket) {
+    size_t k = definition.channels.size();
+    if (bucket.pairs.size() != pairCount(k)) {
+        return;
+    }
+    std::string group = "group=\"" + definition.name + "\"";
+    for (size_t i = 0; i < k; i++) {
+        double sum = 0.0;
+        size_t count = 0;
+        for (size_t j = 0; j < k; j++) {
+            if (j == i) {
+                continue;
+            }
+            double correlation = bucket.pairs[pairIndex(i, j, k)].Correlation();
+            if (std::isnan(correlation)) {
+                continue;
+            }
+            if (j > i) {
+                metrics().Set("templog_correlation{" + group + ",a=\"" + to_string(definition.channels[i]) +
+                              "\",b=\"" + to_string(definition.channels[j]) + "\"}", correlation);
+            }
+            sum += correlation;
+            count++;
+        }
+        if (count > 0) {
+            metrics().Set("templog_neighbour_correlation{" + group + ",channel=\"" +
+                          to_string(definition.channels[i]) + "\"}", sum / count);
+        }
+    }
+}
+
+// Перенос закрытых и исправленных бакетов роллапа в логи в памяти.
+// Запись бакета помечается временем его начала.
+void flushRollup(RollupTier& tier, const GapIndex& gaps, int max_age_seconds) {
+    for (const auto& bucket : tier.rollup.TakeFinalized()) {
+        if (bucket.partial.count > 0) {
+            writeToLog(to_string(bucket.partial.Average()), tier.memory, bucket.start_ms);
+        }
+        if (tier.detailed) {
+            writeBucketDetails(bucket, tier, gaps);
+        }
+        // Базовая линия учится только на закрытых бакетах: исправления в неё не попадают
+        if (tier.anomaly && bucket.partial.count > 0) {
+            AnomalyScore score = tier.anomaly->Observe(bucket.start_ms, bucket.partial.Average());
+            if (score.kind != ANOMALY_NONE) {
+                writeAnomalyLog(bucket.start_ms, bucket.partial.Average(), score, tier.anomaly_memory);
+            }
+        }
+    }
+    for (const auto& bucket : tier.rollup.TakeCorrections()) {
+        if (bucket.partial.count > 0) {
+            writeToLog(to_string(bucket.partial.Average()), tier.fix_memory, bucket.start_ms);
+        }
+        if (tier.detailed) {
+            writeBucketDetails(bucket, tier, gaps);
+        }
+    }
+    cleanOldEntries(tier.memory, max_age_seconds); // Очистка старых записей
+    cleanOldEntries(tier.fix_memory, max_age_seconds);
+    cleanOldEntries(tier.quality_memory, max_age_seconds);
+    cleanOldEntries(tier.twa_memory, max_age_seconds);
+    cleanOldEntries(tier.integral_memory, max_age_seconds);
+    cleanOldEntries(tier.anomaly_memory, max_age_seconds);
+}
+
+// Проверка на наличие нулевых байтов в строке
+bool containsNullBytes(const char* data, size_t size) {
+    return std::memchr(data, '\x00', size) != nullptr;
+}
+
+// Разобранная строка от устройства
+struct ParsedLine {
+    uint32_t channel = 0;
+    double value = 0.0;
+    double fields[RECORD_MAX_FIELDS]; // Все поля многополевой записи (fields[0] == value)
+    size_t field_count = 0;
+    bool has_device_time = false; // Устройство прислало своё время
+    int64_t device_ms = 0;
+};
+
+// Проверка, что [begin, end) - непустая последовательность цифр
+bool isDigits(const std::string& str, size_t begin, size_t end) {
+    if (begin >= end) {
+        return false;
+    }
+    for (size_t i = begin; i < end; i++) {
+        if (!isdigit(str[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Разбор строки "[<канал>:]<значение>[@<время устройства в мс>]";
+// для канала со схемой записей значение - поля схемы через запятую
+bool parseLine(const std::string& line, ParsedLine& parsed) {
+    parsed = ParsedLine();
+    size_t value_pos = 0;
+    size_t value_end = line.size();
+
+    size_t colon_pos = line.find(':');
+    if (colon_pos != std::string::npos) {
+        if (!isDigits(line, 0, colon_pos)) {
+            return false;
+        }
+        parsed.channel = (uint32_t)std::strtoul(line.c_str(), nullptr, 10);
+        value_pos = colon_pos + 1;
+    }
+
+    size_t at_pos = line.find('@', value_pos);
+    if (at_pos != std::string::npos) {
+        if (!isDigits(line, at_pos + 1, line.size())) {
+            return false;
+        }
+        parsed.has_device_time = true;
+        parsed.device_ms = std::strtoll(line.c_str() + at_pos + 1, nullptr, 10);
+        value_end = at_pos;
+    }
+
+    const RecordSchema* schema = schema_config.For(parsed.channel);
+    if (schema) {
+        if (!parseFields(line.c_str() + value_pos, line.c_str() + value_end, *schema, parsed.fields)) {
+            return false;
+        }
+        parsed.field_count = schema->fields.size();
+        parsed.value = parsed.fields[0];
+        return true;
+    }
+
+    // Валидация данных
+    if (value_pos == value_end) {
+        return false;
+    }
+    for (size_t i = value_pos; i < value_end; i++) {
+        char ch = line[i];
+        if (!isdigit(ch) && ch != '.' && ch != '-') {
+            return false;
+        }
+    }
+    char* end = nullptr;
+    parsed.value = std::strtod(line.c_str() + value_pos, &end);
+    return end == line.c_str() + value_end;
+}
+
+// Разбор одного чтения в пачку: строки, каналы и время в часах хоста
+void parseRead(const char* data, size_t size, int64_t now_ms, IngestBatch& batch) {
+    batch.Clear();
+    std::string line;
+    const char* end = data + size;
+    for (const char* begin = data; begin < end; ) {
+        const char* newline = static_cast<const char*>(std::memchr(begin, '\n', end - begin));
+        const char* line_end = newline ? newline : end;
+        line.assign(begin, line_end);
+        begin = line_end + 1;
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+        ParsedLine parsed;
+        if (!parseLine(line, parsed)) {
+            continue;
+        }
+        if (reporting(TEMPLOG_INFO)) {
+            report(TEMPLOG_INFO, "Got: " + line);
+        }
+        // Время устройства переводится в часы хоста по оценке расхождения
+        int64_t time_ms = now_ms;
+        if (parsed.has_device_time) {
+            ClockSync& clock = channels[parsed.channel].clock;
+            clock.Update(parsed.device_ms, now_ms);
+            time_ms = clock.ToHost(parsed.device_ms);
+        }
+        batch.channels.push_back(parsed.channel);
+        batch.times.push_back(time_ms);
+        batch.raw.push_back(parsed.value);
+        batch.flags.push_back(parsed.has_device_time ? QUALITY_DEVICE_TIME : 0);
+        batch.field_begin.push_back(batch.fields.size());
+        if (parsed.field_count > 1) {
+            batch.fields.insert(batch.fields.end(), parsed.fields + 1, parsed.fields + parsed.field_count);
+        }
+    }
+}
+
+// Калибровка пачки целиком
+void calibrateBatch(IngestBatch& batch) {
+    std::shared_ptr<const CalibrationTable> table = std::atomic_load(&calibration);
+    batch.values.resize(batch.Size());
+    table->Apply(batch.channels.data(), batch.raw.data(), batch.values.data(), batch.Size());
+    if (table->Empty()) {
+        return;
+    }
+    for (size_t i = 0; i < batch.Size(); i++) {
+        if (table->Has(batch.channels[i])) {
+            batch.flags[i] |= QUALITY_CALIBRATED;
+        }
+    }
+}
+
+// Перенос готовых бакетов непрерывных агрегатов в логи в памяти
+void flushAggregate(AggregateState& state) {
+    state.aggregate.Flush([&](size_t function, int64_t start_ms, double value, bool correction) {
+        writeToLog(to_string(value), correction ? state.fix_memory[function] : state.memory[function], start_ms);
+    });
+    for (size_t f = 0; f < state.memory.size(); f++) {
+        cleanOldEntries(state.memory[f], MAX_TIME_HOUR);
+        cleanOldEntries(state.fix_memory[f], MAX_TIME_HOUR);
+    }
+}
+
+// Лог функции агрегата: "log_agg_<агрегат>_<функция>[_fix].log" (':' в функции заменяется на '_')
+std::string aggregateLogName(const AggregateDefinition& definition, size_t function, bool correction) {
+    std::string name = "log_agg_" + definition.name + "_" + definition.functions[function].name;
+    std::replace(name.begin(), name.end(), ':', '_');
+    return name + (correction ? "_fix" : "") + ".log";
+}
+
+// Отбраковка выбросов: отсчёты не удаляются, а помечаются QUALITY_REJECTED
+void filterBatch(IngestBatch& batch) {
+    for (size_t i = 0; i < batch.Size(); i++) {
+        ChannelState& state = channels[batch.channels[i]];
+        if (!state.filter_ready) {
+            const FilterSettings* settings = filter_config.For(batch.channels[i]);
+            if (settings) {
+                state.filter.reset(new SampleFilter(*settings));
+            }
+            state.filter_ready = true;
+        }
+        if (state.filter && !state.filter->Accept(batch.values[i])) {
+            batch.flags[i] |= QUALITY_REJECTED;
+            report(TEMPLOG_INFO, "Rejected: " + to_string(batch.channels[i]) + ":" + to_string(batch.values[i]));
+            metrics().Add(channelMetric("templog_rejected_total", batch.channels[i]), 1);
+        }
+    }
+}
+
+// Запись пачки в роллапы и хранилище (отбракованные отсчёты в средние роллапов не входят,
+// а только в счётчики флагов; опоздавшие к закрытому часовому бакету помечаются QUALITY_LATE,
+// первый отсчёт после пробела - QUALITY_GAP)
+void storeBatch(IngestBatch& batch) {
+    for (size_t i = 0; i < batch.Size(); i++) {
+        uint32_t channel = batch.channels[i];
+        ChannelState& state = channels[channel];
+        // Базовая линия аномалий продолжается с сохранённой, а не учится заново
+        if (!state.anomaly_loaded) {
+            state.hour.anomaly->Load(anomalyStateName(channel));
+            state.anomaly_loaded = true;
+        }
+        if (!state.gaps_ready) {
+            if (fixed_width_format) {
+                state.gaps.Resume(logTailTimes(channelLogName("log_temp", channel)));
+            }
+            state.gaps_ready = true;
+        }
+        if (state.gaps.Observe(batch.times[i])) {
+            batch.flags[i] |= QUALITY_GAP;
+        }
+        if (state.hour.rollup.Add(batch.times[i], batch.values[i], batch.flags[i]) == EventTimeRollup::ADD_CORRECTION) {
+            batch.flags[i] |= QUALITY_LATE;
+        }
+        state.day.rollup.Add(batch.times[i], batch.values[i], batch.flags[i]);
+        state.forecast_rollup.Add(batch.times[i], batch.values[i], batch.flags[i]);
+        if (!state.aggregates_ready) {
+            for (const auto& aggregate : aggregates) {
+                if (aggregate->aggregate.Definition().Matches(channel)) {
+                    state.aggregates.push_back(aggregate.get());
+                }
+            }
+            state.aggregates_ready = true;
+        }
+        for (AggregateState* aggregate : state.aggregates) {
+            aggregate->aggregate.Add(channel, batch.times[i], batch.values[i], batch.flags[i]);
+        }
+        if (!state.correlations_ready) {
+            for (const auto& group : correlation_groups) {
+                int index = group->IndexOf(channel);
+                if (index >= 0) {
+                    state.correlations.emplace_back(group.get(), index);
+                }
+            }
+            state.correlations_ready = true;
+        }
+        for (const auto& correlation : state.correlations) {
+            correlation.first->Add(correlation.second, batch.times[i], batch.values[i], batch.flags[i]);
+        }
+
+        sample_store->Insert(Sample{batch.times[i], channel, batch.values[i], batch.flags[i]}); // Запись в память
+        if (!(batch.flags[i] & QUALITY_REJECTED)) {
+            latest_board.Update(channel, batch.times[i], batch.values[i], batch.flags[i]);
+        }
+        if (raw_store) {
+            raw_store->Insert(Sample{batch.times[i], channel, batch.raw[i], batch.flags[i]});
+        }
+        if (batch.times[i] <= syncedUntil(state, "log_temp")) {
+            state.late_samples.push_back(LateSample{batch.times[i], batch.values[i], batch.raw[i], batch.flags[i]});
+        }
+
+        // Многополевая запись целиком (отбракованное основное значение - NaN)
+        // и роллапы дополнительных полей
+        size_t field_count = batch.FieldCount(i);
+        if (field_count > 0) {
+            const RecordSchema* schema = schema_config.For(channel);
+            double record[RECORD_MAX_FIELDS];
+            record[0] = (batch.flags[i] & QUALITY_REJECTED) ? std::nan("") : batch.values[i];
+            std::copy(batch.fields.begin() + batch.field_begin[i],
+                      batch.fields.begin() + batch.field_begin[i] + field_count, record + 1);
+            record_store->Append(channel, *schema, batch.times[i], record);
+            if (batch.times[i] <= syncedUntil(state, "records")) {
+                state.late_records.emplace_back(batch.times[i], std::vector<double>(record, record + field_count + 1));
+            }
+
+            while (state.field_hour.size() < field_count) {
+                state.field_hour.emplace_back(HOUR, MAX_TIME_HOUR);
+                state.field_day.emplace_back(DAY, MAX_TIME_DAY);
+                state.field_hour.back().detailed = false;
+                state.field_day.back().detailed = false;
+            }
+            for (size_t f = 0; f < field_count; f++) {
+                state.field_hour[f].rollup.Add(batch.times[i], record[f + 1]);
+                state.field_day[f].rollup.Add(batch.times[i], record[f + 1]);
+            }
+        }
+    }
+}
+
+// Настройка ключами командной строки; описания ошибок добавляются в errors,
+// предупреждения загрузчиков конфигураций уходят в сообщения
+bool configure(int argc, const char* const* argv, std::string& errors) {
+    // Агрегаты и группы корреляций создаются после разбора всех ключей:
+    // --allowed-lateness действует на них независимо от порядка ключей
+    std::vector<AggregateDefinition> aggregate_definitions;
+    std::vector<CorrelationGroupDefinition> group_definitions;
+    for (int i = 0; i < argc; i++) {
+        std::string arg = argv[i];
+        std::string warnings;
+        if (arg == "--fixed-width") {
+            fixed_width_format = true;
+        } else if (arg == "--index-every" && i + 1 < argc) {
+            index_every = std::max(1, std::atoi(argv[++i]));
+        } else if (arg == "--allowed-lateness" && i + 1 < argc) {
+            allowed_lateness_ms = (int64_t)(std::atof(argv[++i]) * 1000);
+        } else if (arg == "--expected-period" && i + 1 < argc) {
+            expected_period_ms = (int64_t)(std::atof(argv[++i]) * 1000);
+        } else if (arg == "--max-integral-gap" && i + 1 < argc) {
+            integral_max_gap_ms = (int64_t)(std::atof(argv[++i]) * 1000);
+        } else if (arg == "--step-integral") {
+            step_integral = true;
+        } else if (arg == "--calibration" && i + 1 < argc) {
+            calibration_file = argv[++i];
+            calibration_mtime = std::filesystem::file_time_type();
+            if (!reloadCalibration(warnings)) {
+                errors += warnings;
+                return false;
+            }
+        } else if (arg == "--filters" && i + 1 < argc) {
+            if (!filter_config.Load(argv[++i], warnings)) {
+                errors += warnings;
+                return false;
+            }
+        } else if (arg == "--schema" && i + 1 < argc) {
+            if (!schema_config.Load(argv[++i], warnings)) {
+                errors += warnings;
+                return false;
+            }
+        } else if (arg == "--aggregates" && i + 1 < argc) {
+            if (!loadAggregates(argv[++i], aggregate_definitions, warnings)) {
+                errors += warnings;
+                return false;
+            }
+        } else if (arg == "--forecast-bucket" && i + 1 < argc) {
+            forecast_bucket_ms = std::max<int64_t>(1000, (int64_t)(std::atof(argv[++i]) * 1000));
+        } else if (arg == "--forecast-alerts" && i + 1 < argc) {
+            if (!loadForecastAlerts(argv[++i], forecast_alerts, warnings)) {
+                errors += warnings;
+                return false;
+            }
+        } else if (arg == "--correlation" && i + 1 < argc) {
+            if (!loadCorrelationGroups(argv[++i], group_definitions, warnings)) {
+                errors += warnings;
+                return false;
+            }
+        } else if (arg == "--latest-shm" && i + 1 < argc) {
+            if (!latest_board.CreateShared(argv[++i], errors)) {
+                return false;
+            }
+        } else if (arg == "--keep-raw") {
+            raw_store.reset(new SampleStore());
+        } else {
+            errors += "Unknown option '" + arg + "'\n";
+            return false;
+        }
+        if (!warnings.empty()) {
+            report(TEMPLOG_WARNING, warnings);
+        }
+    }
+
+    for (const auto& definition : aggregate_definitions) {
+        aggregates.emplace_back(new AggregateState(definition));
+    }
+    for (const auto& group : group_definitions) {
+        correlation_groups.emplace_back(new CorrelationGroup(group, allowed_lateness_ms));
+    }
+    return true;
+}
+
+// Обработка разобранной пачки: калибровка, фильтры, запись и очистка старых отсчётов
+void ingestBatch(IngestBatch& batch, int64_t now_ms) {
+    calibrateBatch(batch);
+    filterBatch(batch);
+    storeBatch(batch);
+    // Очистка старых записей
+    sample_store->DropBefore(now_ms - (int64_t)MAX_TIME_DEFAULT * 1000);
+    if (raw_store) {
+        raw_store->DropBefore(now_ms - (int64_t)MAX_TIME_DEFAULT * 1000);
+    }
+    record_store->DropBefore(now_ms - (int64_t)MAX_TIME_DEFAULT * 1000);
+}
+
+// Средние за час и за день: бакеты закрываются, когда водяной знак канала
+// проходит их конец; молчащие каналы продвигаются по часам хоста
+void advanceRollups(int64_t now_ms) {
+    for (auto& entry : channels) {
+        ChannelState& state = entry.second;
+        state.hour.rollup.AdvanceWatermark(now_ms - allowed_lateness_ms);
+        state.day.rollup.AdvanceWatermark(now_ms - allowed_lateness_ms);
+        state.gaps.Silence(now_ms);
+        flushRollup(state.hour, state.gaps, MAX_TIME_HOUR);
+        flushRollup(state.day, state.gaps, MAX_TIME_DAY);
+        for (size_t f = 0; f < state.field_hour.size(); f++) {
+            state.field_hour[f].rollup.AdvanceWatermark(now_ms - allowed_lateness_ms);
+            state.field_day[f].rollup.AdvanceWatermark(now_ms - allowed_lateness_ms);
+            flushRollup(state.field_hour[f], state.gaps, MAX_TIME_HOUR);
+            flushRollup(state.field_day[f], state.gaps, MAX_TIME_DAY);
+        }
+        state.gaps.DropBefore(now_ms - (int64_t)MAX_TIME_DAY * 1000);
+        state.forecast_rollup.AdvanceWatermark(now_ms - allowed_lateness_ms);
+        updateForecast(entry.first, state);
+        cleanOldEntries(state.forecast_alert_memory, MAX_TIME_HOUR);
+    }
+
+    for (auto& aggregate : aggregates) {
+        aggregate->aggregate.AdvanceWatermark(now_ms - allowed_lateness_ms);
+        flushAggregate(*aggregate);
+    }
+    for (auto& group : correlation_groups) {
+        group->AdvanceWatermark(now_ms - allowed_lateness_ms);
+    }
+}
+
+// Закрытие всех открытых бакетов при закрытии дескриптора: часовые и дневные
+// роллапы, непрерывные агрегаты и корреляции пишутся с тем, что успело прийти,
+// иначе последний час и день (а при разовой обработке файла - весь хвост) теряются.
+// Бакеты модели прогноза не закрываются: неполный бакет исказил бы её состояние.
+void finalizeRollups() {
+    const int64_t end_ms = std::numeric_limits<int64_t>::max();
+    for (auto& entry : channels) {
+        ChannelState& state = entry.second;
+        state.hour.rollup.AdvanceWatermark(end_ms);
+        state.day.rollup.AdvanceWatermark(end_ms);
+        flushRollup(state.hour, state.gaps, MAX_TIME_HOUR);
+        flushRollup(state.day, state.gaps, MAX_TIME_DAY);
+        for (size_t f = 0; f < state.field_hour.size(); f++) {
+            state.field_hour[f].rollup.AdvanceWatermark(end_ms);
+            state.field_day[f].rollup.AdvanceWatermark(end_ms);
+            flushRollup(state.field_hour[f], state.gaps, MAX_TIME_HOUR);
+            flushRollup(state.field_day[f], state.gaps, MAX_TIME_DAY);
+        }
+    }
+    for (auto& aggregate : aggregates) {
+        aggregate->aggregate.AdvanceWatermark(end_ms);
+        flushAggregate(*aggregate);
+    }
+    for (auto& group : correlation_groups) {
+        group->AdvanceWatermark(end_ms);
+    }
+}
+
+// Синхронизация логов и метрик с диском; отсчёты пишутся не новее horizon_ms
+void syncAllToDisk(int64_t horizon_ms) {
+    for (auto& entry : channels) {
+        ChannelState& state = entry.second;
+        syncSamplesToDisk(*sample_store, entry.first, state, "log_temp", horizon_ms, QUALITY_REJECTED, 0);
+        syncSamplesToDisk(*sample_store, entry.first, state, "log_temp_rejected", horizon_ms,
+                          QUALITY_REJECTED, QUALITY_REJECTED);
+        if (raw_store) {
+            syncSamplesToDisk(*raw_store, entry.first, state, "log_temp_raw", horizon_ms);
+        }
+        syncLogToDisk(state.hour.memory, channelLogName("log_avg_temp_hour", entry.first), LOG_VALUES);
+        syncLogToDisk(state.hour.fix_memory, channelLogName("log_avg_temp_hour_fix", entry.first), LOG_VALUES);
+        syncLogToDisk(state.hour.quality_memory, channelLogName("log_quality_hour", entry.first), LOG_TEXT);
+        syncLogToDisk(state.hour.twa_memory, channelLogName("log_twa_temp_hour", entry.first), LOG_VALUES);
+        syncLogToDisk(state.hour.integral_memory, channelLogName("log_degree_hours_hour", entry.first), LOG_VALUES);
+        syncLogToDisk(state.hour.anomaly_memory, channelLogName("log_anomaly_hour", entry.first), LOG_TEXT);
+        syncLogToDisk(state.forecast_alert_memory, channelLogName("log_forecast_alert", entry.first), LOG_TEXT);
+        syncLogToDisk(state.day.memory, channelLogName("log_avg_temp_day", entry.first), LOG_VALUES);
+        syncLogToDisk(state.day.fix_memory, channelLogName("log_avg_temp_day_fix", entry.first), LOG_VALUES);
+        syncLogToDisk(state.day.quality_memory, channelLogName("log_quality_day", entry.first), LOG_TEXT);
+        syncLogToDisk(state.day.twa_memory, channelLogName("log_twa_temp_day", entry.first), LOG_VALUES);
+        syncLogToDisk(state.day.integral_memory, channelLogName("log_degree_hours_day", entry.first), LOG_VALUES);
+        syncRecordsToDisk(entry.first, state, horizon_ms);
+        syncLateToDisk(entry.first, state);
+        RecordSchema schema;
+        if (record_store->Schema(entry.first, schema)) {
+            for (size_t f = 0; f < state.field_hour.size() && f + 1 < schema.fields.size(); f++) {
+                std::string name = "log_avg_" + schema.fields[f + 1].name;
+                syncLogToDisk(state.field_hour[f].memory, channelLogName(name + "_hour", entry.first), LOG_VALUES);
+                syncLogToDisk(state.field_hour[f].fix_memory, channelLogName(name + "_hour_fix", entry.first), LOG_VALUES);
+                syncLogToDisk(state.field_day[f].memory, channelLogName(name + "_day", entry.first), LOG_VALUES);
+                syncLogToDisk(state.field_day[f].fix_memory, channelLogName(name + "_day_fix", entry.first), LOG_VALUES);
+            }
+        }
+        appendGaps(gapFileName(channelLogName("log_temp", entry.first)), state.gaps.TakeClosed());
+        GapInterval open_gap;
+        metrics().Set(channelMetric("templog_gap_open", entry.first), state.gaps.OpenGap(open_gap) ? 1 : 0);
+        const AnomalyDetector& anomaly = *state.hour.anomaly;
+        if (anomaly.Last().scored) {
+            metrics().Set(channelMetric("templog_anomaly_z", entry.first), anomaly.Last().z);
+        }
+        metrics().Set(channelMetric("templog_cusum_high", entry.first), anomaly.CusumHigh());
+        metrics().Set(channelMetric("templog_cusum_low", entry.first), anomaly.CusumLow());
+        metrics().Set(channelMetric("templog_anomalies_total", entry.first), (double)anomaly.Detected());
+        if (state.forecast.Ready()) {
+            Forecast next;
+            state.forecast.ProjectAt(forecast_bucket_ms, next);
+            metrics().Set(channelMetric("templog_forecast_next", entry.first), next.value);
+        }
+        if (state.anomaly_loaded) {
+            anomaly.Save(anomalyStateName(entry.first));
+        }
+        if (state.forecast_loaded) {
+            state.forecast.Save(forecastStateName(entry.first));
+        }
+        bool breach = std::find(state.breach_predicted.begin(), state.breach_predicted.end(), 1) !=
+                      state.breach_predicted.end();
+        metrics().Set(channelMetric("templog_predicted_breach", entry.first), breach ? 1 : 0);
+        if (state.clock.Samples() > 0) {
+            metrics().Set(channelMetric("templog_clock_skew_ppm", entry.first), state.clock.SkewPpm());
+            metrics().Set(channelMetric("templog_clock_offset_ms", entry.first), state.clock.OffsetMs());
+        }
+    }
+    for (auto& aggregate : aggregates) {
+        const AggregateDefinition& definition = aggregate->aggregate.Definition();
+        for (size_t f = 0; f < definition.functions.size(); f++) {
+            syncLogToDisk(aggregate->memory[f], aggregateLogName(definition, f, false), LOG_VALUES);
+            syncLogToDisk(aggregate->fix_memory[f], aggregateLogName(definition, f, true), LOG_VALUES);
+        }
+    }
+    for (auto& group : correlation_groups) {
+        const CorrelationGroupDefinition& definition = group->Definition();
+        appendMoments(momentsFileName(definition.name), definition.channels, group->TakeClosed());
+        writeCorrelationMetrics(definition, group->Last());
+    }
+    metrics().Set("templog_record_bytes", (double)record_store->MemoryUsage());
+    metrics().WriteToFile("metrics.prom");
+    std::string warnings;
+    reloadCalibration(warnings);
+    if (!warnings.empty()) {
+        report(TEMPLOG_WARNING, warnings);
+    }
+}
+
+// Вернуть состояние ядра к начальному (при закрытии дескриптора)
+void resetState() {
+    fixed_width_format = false;
+    index_every = INDEX_EVERY_DEFAULT;
+    allowed_lateness_ms = ALLOWED_LATENESS_MS_DEFAULT;
+    expected_period_ms = 0;
+    integral_max_gap_ms = INTEGRAL_MAX_GAP_MS_DEFAULT;
+    step_integral = false;
+    forecast_bucket_ms = FORECAST_BUCKET_MS_DEFAULT;
+    forecast_alerts.clear();
+    aggregates.clear();
+    correlation_groups.clear();
+    channels.clear();
+    open_block_stats.clear();
+    calibration_file.clear();
+    calibration_mtime = std::filesystem::file_time_type();
+    std::atomic_store(&calibration, std::shared_ptr<const CalibrationTable>(std::make_shared<CalibrationTable>()));
+    filter_config = FilterConfig();
+    schema_config = SchemaConfig();
+    sample_store.reset();
+    raw_store.reset();
+    record_store.reset();
+    latest_board.Reset();
+    message_fn = nullptr;
+    message_user = nullptr;
+    message_level = TEMPLOG_INFO;
+}
+
+// Столбцы результата запроса, на которые указывает templog_span
+struct SpanColumns {
+    std::vector<int64_t> times;
+    std::vector<double> values;
+    std::vector<uint8_t> flags;
+};
+
+void fillSpan(SpanColumns* columns, templog_span* out) {
+    out->times = columns->times.data();
+    out->values = columns->values.data();
+    out->flags = columns->flags.empty() ? nullptr : columns->flags.data();
+    out->size = columns->times.size();
+    out->owner = columns;
+}
+
+void fillSummary(const Partial& partial, templog_summary* out) {
+    *out = templog_summary();
+    out->count = partial.count;
+    if (partial.count > 0) {
+        out->sum = partial.sum;
+        out->min = partial.min;
+        out->max = partial.max;
+        out->avg = partial.Average();
+    }
+}
+
+} // namespace
+
+// Дескриптор: все вызовы с ним, кроме запросов к логам на диске, сериализуются;
+// мьютекс рекурсивный, чтобы обработчики подписок могли читать данные
+struct templog {
+    std::recursive_mutex mutex;
+    std::mutex error_mutex; // Ошибку пишут и запросы, идущие без мьютекса дескриптора
+    std::string error;
+    int counter_sync = 0;
+    int next_subscription = 0;
+    std::map<int, std::pair<templog_samples_fn, void*>> subscriptions;
+    IngestBatch batch;
+    std::vector<templog_sample> published;
+    BlockCache cache{BLOCK_CACHE_DEFAULT_MB * 1024 * 1024}; // Блоки логов на диске для templog_read_log
+    QueryScheduler scheduler; // Последним: рабочие потоки останавливаются первыми
+};
+
+namespace {
+
+std::atomic<bool> handle_open(false);
+
+void setError(templog* log, const std::string& error) {
+    std::lock_guard<std::mutex> lock(log->error_mutex);
+    log->error = error;
+}
+
+// Вызов функции ядра: исключения не должны пересекать границу C ABI
+template<class F>
+int guarded(templog* log, F f) {
+    if (!log) {
+        return TEMPLOG_ERROR;
+    }
+    std::lock_guard<std::recursive_mutex> lock(log->mutex);
+    try {
+        return f();
+    } catch (const std::exception& e) {
+        setError(log, e.what());
+        return TEMPLOG_ERROR;
+    }
+}
+
+// Запрос к логам на диске: на рабочем потоке планировщика, без мьютекса дескриптора.
+// f(control) возвращает результат вызова; прерванный запрос - код по причине.
+template<class F>
+int scheduled(templog* log, const templog_query_options* options, F f) {
+    if (!log) {
+        return TEMPLOG_ERROR;
+    }
+    QueryBudget budget;
+    int64_t wait_ms = QUERY_WAIT_MS_DEFAULT;
+    uint32_t tag = 0;
+    if (options) {
+        budget.cpu_ms = std::max<int64_t>(0, options->cpu_ms);
+        budget.memory_bytes = (size_t)options->memory_mb * 1024 * 1024;
+        if (options->wait_ms > 0) {
+            wait_ms = options->wait_ms;
+        }
+        tag = options->tag;
+    }
+    int result = TEMPLOG_ERROR;
+    QueryStatus status = log->scheduler.Run(tag, budget, wait_ms, [&](QueryControl& control) {
+        try {
+            result = f(control);
+        } catch (const std::exception& e) {
+            setError(log, e.what());
+            result = TEMPLOG_ERROR;
+        }
+    });
+    if (status == QUERY_DONE) {
+        return result;
+    }
+    setError(log, std::string("Query ") + queryStatusName(status));
+    switch (status) {
+    case QUERY_REJECTED: return TEMPLOG_BUSY;
+    case QUERY_CANCELLED: return TEMPLOG_CANCELLED;
+    default: return TEMPLOG_BUDGET;
+    }
+}
+
+// Запрос на языке запросов через планировщик; строки выдаются emit(plan, row)
+// в потоке вызова, а не на рабочем потоке запросов
+template<class F>
+int queryRows(templog* log, const char* text, const templog_query_options* options, F emit) {
+    if (!log) {
+        return TEMPLOG_ERROR;
+    }
+    QueryPlan plan;
+    std::string error;
+    if (!parseQuery(text, plan, error)) {
+        setError(log, "Query error: " + error);
+        return TEMPLOG_ERROR;
+    }
+    std::vector<QueryRow> rows;
+    int result = scheduled(log, options, [&](QueryControl& control) {
+        rows = runQuery(plan, &log->cache, nullptr, &control);
+        return control.Status() == QUERY_DONE ? TEMPLOG_OK : TEMPLOG_ERROR;
+    });
+    if (result != TEMPLOG_OK) {
+        return result;
+    }
+    for (const auto& row : rows) {
+        emit(plan, row);
+    }
+    return (int)rows.size();
+}
+
+// Разослать пачку подписчикам (копия списка: обработчик может отписаться)
+void publishBatch(templog* log) {
+    if (log->subscriptions.empty() || log->batch.Size() == 0) {
+        return;
+    }
+    const IngestBatch& batch = log->batch;
+    log->published.resize(batch.Size());
+    for (size_t i = 0; i < batch.Size(); i++) {
+        templog_sample& sample = log->published[i];
+        sample.time_ms = batch.times[i];
+        sample.value = batch.values[i];
+        sample.raw = batch.raw[i];
+        sample.channel = batch.channels[i];
+        sample.flags = batch.flags[i];
+    }
+    auto subscriptions = log->subscriptions;
+    for (const auto& subscription : subscriptions) {
+        subscription.second.first(subscription.second.second, log->published.data(), log->published.size());
+    }
+}
+
+} // namespace
+
+extern "C" {
+
+uint32_t templog_abi_version(void) {
+    return TEMPLOG_ABI_VERSION;
+}
+
+int64_t templog_time_ms(void) {
+    return currentTimeMs();
+}
+
+templog* templog_open(void) {
+    if (handle_open.exchange(true)) {
+        return nullptr;
+    }
+    sample_store.reset(new SampleStore());
+    record_store.reset(new RecordStore());
+    return new templog();
+}
+
+void templog_close(templog* log) {
+    if (!log) {
+        return;
+    }
+    {
+        std::lock_guard<std::recursive_mutex> lock(log->mutex);
+        try {
+            if (!channels.empty()) {
+                for (auto& entry : channels) {
+                    entry.second.gaps.FlushOpen();
+                }
+                finalizeRollups();
+                syncAllToDisk(std::numeric_limits<int64_t>::max());
+            }
+        } catch (const std::exception&) {
+        }
+        resetState();
+    }
+    delete log;
+    handle_open = false;
+}
+
+const char* templog_last_error(templog* log) {
+    if (!log) {
+        return "";
+    }
+    // Копия: строку дескриптора может в это время перезаписать запрос из другого потока
+    thread_local std::string error;
+    std::lock_guard<std::mutex> lock(log->error_mutex);
+    error = log->error;
+    return error.c_str();
+}
+
+void templog_set_message_handler(templog* log, templog_message_fn fn, void* user) {
+    guarded(log, [&]() {
+        message_fn = fn;
+        message_user = user;
+        return TEMPLOG_OK;
+    });
+}
+
+void templog_set_message_level(templog* log, int level) {
+    guarded(log, [&]() {
+        message_level = level;
+        return TEMPLOG_OK;
+    });
+}
+
+int templog_configure(templog* log, int argc, const char* const* argv) {
+    return guarded(log, [&]() {
+        std::string errors;
+        if (!configure(argc, argv, errors)) {
+            setError(log, errors);
+            return TEMPLOG_ERROR;
+        }
+        return TEMPLOG_OK;
+    });
+}
+
+int templog_ingest(templog* log, const char* data, size_t size, int64_t now_ms) {
+    return guarded(log, [&]() {
+        if (size == 0 || containsNullBytes(data, size)) {
+            return 0;
+        }
+        {
+            // Подписчики могут делать запросы, поэтому рассылка - уже вне участка приёма
+            IngestScope scope(log->scheduler);
+            parseRead(data, size, now_ms, log->batch);
+            ingestBatch(log->batch, now_ms);
+        }
+        publishBatch(log);
+        return (int)log->batch.Size();
+    });
+}
+
+int templog_ingest_samples(templog* log, const templog_sample* samples, size_t count) {
+    return guarded(log, [&]() {
+        if (count == 0) {
+            return 0;
+        }
+        IngestBatch& batch = log->batch;
+        {
+            IngestScope scope(log->scheduler);
+            batch.Clear();
+            // Срок хранения отсчитывается от самого позднего отсчёта пачки, а не от часов
+            // хоста: повтор исторических данных не удаляется сразу как устаревший
+            int64_t max_time_ms = std::numeric_limits<int64_t>::min();
+            for (size_t i = 0; i < count; i++) {
+                batch.channels.push_back(samples[i].channel);
+                batch.times.push_back(samples[i].time_ms);
+                batch.raw.push_back(samples[i].raw);
+                batch.flags.push_back((uint8_t)samples[i].flags);
+                batch.field_begin.push_back(0);
+                max_time_ms = std::max(max_time_ms, samples[i].time_ms);
+            }
+            ingestBatch(batch, max_time_ms);
+        }
+        publishBatch(log);
+        return (int)batch.Size();
+    });
+}
+
+int templog_poll(templog* log, int64_t now_ms) {
+    return guarded(log, [&]() {
+        IngestScope scope(log->scheduler);
+        advanceRollups(now_ms);
+        // Синхронизация логов с диском каждую минуту (при опросе раз в 10 секунд)
+        if (++log->counter_sync % 6 == 0) {
+            syncAllToDisk(now_ms - allowed_lateness_ms);
+        }
+        return TEMPLOG_OK;
+    });
+}
+
+int templog_sync(templog* log, int64_t now_ms) {
+    return guarded(log, [&]() {
+        IngestScope scope(log->scheduler);
+        syncAllToDisk(now_ms - allowed_lateness_ms);
+        return TEMPLOG_OK;
+    });
+}
+
+int templog_subscribe(templog* log, templog_samples_fn fn, void* user) {
+    return guarded(log, [&]() {
+        if (!fn) {
+            setError(log, "Empty subscription callback");
+            return TEMPLOG_ERROR;
+        }
+        int id = log->next_subscription++;
+        log->subscriptions[id] = std::make_pair(fn, user);
+        return id;
+    });
+}
+
+int templog_unsubscribe(templog* log, int subscription) {
+    return guarded(log, [&]() {
+        return log->subscriptions.erase(subscription) ? TEMPLOG_OK : TEMPLOG_ERROR;
+    });
+}
+
+int templog_read(templog* log, uint32_t channel, int64_t from_ms, int64_t to_ms, templog_span* out) {
+    return guarded(log, [&]() {
+        std::unique_ptr<SpanColumns> columns(new SpanColumns());
+        sample_store->Read(channel, from_ms, to_ms, [&](const Sample& sample) {
+            columns->times.push_back(sample.time_ms);
+            columns->values.push_back(sample.value);
+            columns->flags.push_back(sample.flags);
+        });
+        fillSpan(columns.release(), out);
+        return TEMPLOG_OK;
+    });
+}
+
+int templog_aggregate(templog* log, uint32_t channel, int64_t from_ms, int64_t to_ms, templog_summary* out) {
+    return guarded(log, [&]() {
+        fillSummary(sample_store->Aggregate(channel, from_ms, to_ms), out);
+        return TEMPLOG_OK;
+    });
+}
+
+int templog_read_log(templog* log, const char* file_name, int64_t from_ms, int64_t to_ms, templog_span* out) {
+    return scheduled(log, nullptr, [&](QueryControl& control) {
+        HistoryLog history(file_name, &log->cache);
+        if (!history.IsOpen()) {
+            setError(log, std::string("Failed to open log: ") + file_name);
+            return TEMPLOG_ERROR;
+        }
+        std::unique_ptr<SpanColumns> columns(new SpanColumns());
+        bool done = history.ReadRange(from_ms, to_ms, [&](int64_t time_ms, double value) {
+            columns->times.push_back(time_ms);
+            columns->values.push_back(value);
+        }, [&](size_t bytes) { return control.Checkpoint(bytes); });
+        if (!done) {
+            return TEMPLOG_ERROR;
+        }
+        fillSpan(columns.release(), out);
+        return TEMPLOG_OK;
+    });
+}
+
+int templog_aggregate_log(templog* log, const char* file_name, int64_t from_ms, int64_t to_ms,
+                          templog_summary* out) {
+    return scheduled(log, nullptr, [&](QueryControl& control) {
+        HistoryLog history(file_name, &log->cache);
+        if (!history.IsOpen()) {
+            setError(log, std::string("Failed to open log: ") + file_name);
+            return TEMPLOG_ERROR;
+        }
+        Partial partial;
+        if (!history.Aggregate(from_ms, to_ms, partial, [&](size_t bytes) { return control.Checkpoint(bytes); })) {
+            return TEMPLOG_ERROR;
+        }
+        fillSummary(partial, out);
+        return TEMPLOG_OK;
+    });
+}
+
+int templog_query(templog* log, const char* text, templog_row_fn fn, void* user) {
+    return templog_query_ex(log, text, nullptr, fn, user);
+}
+
+int templog_query_ex(templog* log, const char* text, const templog_query_options* options,
+                     templog_row_fn fn, void* user) {
+    std::vector<double> values;
+    return queryRows(log, text, options, [&](const QueryPlan& plan, const QueryRow& row) {
+        values.resize(plan.aggregates.size());
+        for (size_t c = 0; c < values.size(); c++) {
+            values[c] = queryValue(plan.aggregates[c], row);
+        }
+        if (fn) {
+            fn(user, row.bucket_ms, row.channel, values.data(), values.size());
+        }
+    });
+}
+
+int templog_query_approx(templog* log, const char* text, const templog_query_options* options,
+                         templog_error_row_fn fn, void* user) {
+    std::vector<double> values, errors;
+    return queryRows(log, text, options, [&](const QueryPlan& plan, const QueryRow& row) {
+        values.resize(plan.aggregates.size());
+        errors.resize(plan.aggregates.size());
+        for (size_t c = 0; c < values.size(); c++) {
+            values[c] = queryValue(plan.aggregates[c], row);
+            errors[c] = queryError(plan.aggregates[c], row);
+        }
+        if (fn) {
+            fn(user, row.bucket_ms, row.channel, values.data(), errors.data(), values.size());
+        }
+    });
+}
+
+int templog_cancel(templog* log, uint32_t tag) {
+    return log && log->scheduler.Cancel(tag) ? TEMPLOG_OK : TEMPLOG_ERROR;
+}
+
+size_t templog_latest(templog* log, int64_t now_ms, templog_latest_value* out, size_t capacity) {
+    // Без мьютекса дескриптора: табло читается, не дожидаясь приёма и перенастройки
+    // (размещение табло не освобождается, пока открыт дескриптор)
+    if (!log) {
+        return 0;
+    }
+    thread_local std::vector<LatestValue> snapshot;
+    latest_board.Snapshot(snapshot);
+    for (size_t i = 0; i < snapshot.size() && i < capacity; i++) {
+        out[i].channel = snapshot[i].channel;
+        out[i].flags = snapshot[i].flags;
+        out[i].time_ms = snapshot[i].time_ms;
+        out[i].age_ms = now_ms - snapshot[i].time_ms;
+        out[i].value = snapshot[i].value;
+        out[i].sequence = snapshot[i].sequence;
+    }
+    return snapshot.size();
+}
+
+void templog_span_free(templog_span* span) {
+    if (!span) {
+        return;
+    }
+    delete static_cast<SpanColumns*>(span->owner);
+    *span = templog_span();
+}
+
+}
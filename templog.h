@@ -0,0 +1,212 @@
+#pragma once
+
+/*
+ * Встраиваемая библиотека приёма и хранения отсчётов с C ABI.
+ *
+ * Ядро - разбор строк устройства, калибровка, фильтры, хранилище отсчётов,
+ * роллапы и логи на диске - работает в процессе приложения; исполняемый файл
+ * main - тонкий клиент, который читает последовательный порт, stdin, FIFO или
+ * файл (input_source.hpp) и вызывает те же функции. Приложение получает
+ * отсчёты сразу после приёма (подписка) и читает их из памяти или из логов на
+ * диске без разбора текста на своей стороне.
+ *
+ * Все типы - простые структуры C с полями фиксированной ширины, объекты
+ * библиотеки скрыты за непрозрачным указателем. Вызовы с одним дескриптором
+ * сериализуются внутри библиотеки, так что их можно делать из разных потоков.
+ * Логи пишутся в текущий каталог под фиксированными именами, поэтому в процессе
+ * может быть открыт только один дескриптор.
+ *
+ * Запросы к логам на диске (templog_read_log, templog_aggregate_log,
+ * templog_query) не берут мьютекс дескриптора: они выполняются на рабочих
+ * потоках запросов с пониженным приоритетом процессора и ввода-вывода,
+ * кусками по блоку лога, и пропускают вперёд приём и запись логов, так что
+ * задержка приёма не зависит от нагрузки запросами.
+ *
+ * Порядок работы:
+ *   templog* log = templog_open();
+ *   templog_configure(log, argc, argv);        // те же ключи, что у main
+ *   templog_ingest(log, data, size, templog_time_ms());  // каждое чтение
+ *   templog_poll(log, templog_time_ms());      // периодически (main - раз в 10 с)
+ *   templog_close(log);
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Версия ABI: меняется при несовместимом изменении структур или функций */
+#define TEMPLOG_ABI_VERSION 1
+
+/* Коды возврата */
+#define TEMPLOG_OK 0
+#define TEMPLOG_ERROR (-1)
+#define TEMPLOG_BUSY (-2)       /* запрос отклонён: все рабочие потоки запросов заняты */
+#define TEMPLOG_CANCELLED (-3)  /* запрос отменён templog_cancel */
+#define TEMPLOG_BUDGET (-4)     /* запрос превысил бюджет процессора или памяти */
+
+/* Уровни сообщений */
+#define TEMPLOG_INFO 0
+#define TEMPLOG_WARNING 1
+
+/* Экспортируемые функции (остальные символы библиотеки скрыты) */
+#if defined(__GNUC__)
+#define TEMPLOG_API __attribute__((visibility("default")))
+#else
+#define TEMPLOG_API
+#endif
+
+typedef struct templog templog;
+
+/* Отсчёт: время в часах хоста (мс от эпохи), значение после калибровки,
+   значение от устройства и флаги качества (см. quality.hpp) */
+typedef struct templog_sample {
+    int64_t time_ms;
+    double value;
+    double raw;
+    uint32_t channel;
+    uint32_t flags;
+} templog_sample;
+
+/* Результат запроса: столбцы одинаковой длины в памяти библиотеки.
+   flags - NULL для логов на диске. Освобождается templog_span_free. */
+typedef struct templog_span {
+    const int64_t* times;
+    const double* values;
+    const uint8_t* flags;
+    size_t size;
+    void* owner;
+} templog_span;
+
+/* Агрегат диапазона (без отбракованных отсчётов); при count == 0 остальные поля - 0 */
+typedef struct templog_summary {
+    uint64_t count;
+    double sum;
+    double min;
+    double max;
+    double avg;
+} templog_summary;
+
+/* Последнее значение канала; age_ms - давность на момент чтения */
+typedef struct templog_latest_value {
+    uint32_t channel;
+    uint32_t flags;
+    int64_t time_ms;
+    int64_t age_ms;
+    double value;
+    uint64_t sequence;
+} templog_latest_value;
+
+/* Ограничения запроса (0 в поле - значение по умолчанию: без бюджета, ожидание 5 с) */
+typedef struct templog_query_options {
+    int64_t cpu_ms;       /* процессорное время запроса */
+    uint64_t memory_mb;   /* объём разобранных блоков логов */
+    int64_t wait_ms;      /* ожидание свободного рабочего потока, затем TEMPLOG_BUSY */
+    uint32_t tag;         /* метка для templog_cancel (0 - без метки) */
+} templog_query_options;
+
+/* Сообщения библиотеки (принятые строки, отбраковка, ошибки записи) */
+typedef void (*templog_message_fn)(void* user, int level, const char* message);
+
+/* Подписка: пачка отсчётов одного приёма с итоговыми флагами.
+   Вызывается в потоке приёма; из обработчика можно вызывать функции чтения. */
+typedef void (*templog_samples_fn)(void* user, const templog_sample* samples, size_t count);
+
+/* Строка результата запроса: бакет (0 без группировки по времени), канал (0 без группировки
+   по каналам) и значения агрегатов в порядке SELECT */
+typedef void (*templog_row_fn)(void* user, int64_t bucket_ms, uint32_t channel, const double* values, size_t count);
+
+/* Строка приближённого запроса: кроме значений - их погрешности (насколько точное
+   значение может отличаться от выданного; 0 - значение точное) */
+typedef void (*templog_error_row_fn)(void* user, int64_t bucket_ms, uint32_t channel, const double* values,
+                                     const double* errors, size_t count);
+
+TEMPLOG_API uint32_t templog_abi_version(void);
+
+/* Текущее время хоста в мс от эпохи */
+TEMPLOG_API int64_t templog_time_ms(void);
+
+/* NULL, если дескриптор в процессе уже открыт */
+TEMPLOG_API templog* templog_open(void);
+
+/* Закрыть все открытые бакеты (час, день, агрегаты, корреляции - с тем, что
+   успело прийти), записать на диск всё накопленное и освободить дескриптор */
+TEMPLOG_API void templog_close(templog* log);
+
+/* Описание последней ошибки дескриптора ("" - ошибок не было) */
+TEMPLOG_API const char* templog_last_error(templog* log);
+
+TEMPLOG_API void templog_set_message_handler(templog* log, templog_message_fn fn, void* user);
+
+/* Сообщения ниже level не формируются (TEMPLOG_WARNING - без строки на каждый отсчёт) */
+TEMPLOG_API void templog_set_message_level(templog* log, int level);
+
+/* Настройка ключами командной строки main ("--fixed-width", "--filters <файл>", ...);
+   вызывается до приёма данных */
+TEMPLOG_API int templog_configure(templog* log, int argc, const char* const* argv);
+
+/* Приём одного чтения: строки "[<канал>:]<значение>[@<время устройства>]" (последняя -
+   и без перевода строки; чтение с нулевыми байтами пропускается).
+   Возвращает число принятых отсчётов или TEMPLOG_ERROR. */
+TEMPLOG_API int templog_ingest(templog* log, const char* data, size_t size, int64_t now_ms);
+
+/* Приём готовых отсчётов (time_ms, channel, raw и flags; value вычисляется калибровкой).
+   Устаревшие отсчёты в памяти отсчитываются от самого позднего time_ms пачки. */
+TEMPLOG_API int templog_ingest_samples(templog* log, const templog_sample* samples, size_t count);
+
+/* Закрытие бакетов роллапов по часам хоста; каждый шестой вызов пишет логи на диск */
+TEMPLOG_API int templog_poll(templog* log, int64_t now_ms);
+
+/* Немедленная запись логов на диск */
+TEMPLOG_API int templog_sync(templog* log, int64_t now_ms);
+
+/* Возвращает номер подписки для templog_unsubscribe или TEMPLOG_ERROR */
+TEMPLOG_API int templog_subscribe(templog* log, templog_samples_fn fn, void* user);
+TEMPLOG_API int templog_unsubscribe(templog* log, int subscription);
+
+/* Отсчёты канала в [from_ms, to_ms] из памяти (последние сутки) в порядке времени */
+TEMPLOG_API int templog_read(templog* log, uint32_t channel, int64_t from_ms, int64_t to_ms,
+                             templog_span* out);
+
+/* Агрегат канала в [from_ms, to_ms] по отсчётам в памяти */
+TEMPLOG_API int templog_aggregate(templog* log, uint32_t channel, int64_t from_ms, int64_t to_ms,
+                                  templog_summary* out);
+
+/* Отсчёты лога фиксированной ширины на диске в [from_ms, to_ms] (через кэш блоков дескриптора) */
+TEMPLOG_API int templog_read_log(templog* log, const char* file_name, int64_t from_ms, int64_t to_ms,
+                                 templog_span* out);
+
+/* Агрегат лога на диске по сводкам блоков */
+TEMPLOG_API int templog_aggregate_log(templog* log, const char* file_name, int64_t from_ms, int64_t to_ms,
+                                      templog_summary* out);
+
+TEMPLOG_API void templog_span_free(templog_span* span);
+
+/* Запрос к логам текущего каталога на языке запросов (см. query_lang.hpp), например
+   "SELECT avg(value), max(value) FROM channels WHERE value > -50 GROUP BY time(1h), channel".
+   Возвращает число строк или TEMPLOG_ERROR (описание ошибки разбора - templog_last_error). */
+TEMPLOG_API int templog_query(templog* log, const char* text, templog_row_fn fn, void* user);
+
+/* То же с бюджетами и меткой; options может быть NULL. Кроме TEMPLOG_ERROR
+   возвращает TEMPLOG_BUSY, TEMPLOG_CANCELLED или TEMPLOG_BUDGET (строки не выдаются). */
+TEMPLOG_API int templog_query_ex(templog* log, const char* text, const templog_query_options* options,
+                                 templog_row_fn fn, void* user);
+
+/* Запрос с погрешностями строк, например "SELECT avg(value) FROM channels GROUP BY time(1d)
+   APPROXIMATE ERROR 1% TIMEOUT 100ms": ответ по сводкам блоков с уточнением (см. query_lang.hpp) */
+TEMPLOG_API int templog_query_approx(templog* log, const char* text, const templog_query_options* options,
+                                     templog_error_row_fn fn, void* user);
+
+/* Отменить выполняемые и ждущие запросы с меткой tag (из любого потока).
+   TEMPLOG_ERROR - таких запросов нет. */
+TEMPLOG_API int templog_cancel(templog* log, uint32_t tag);
+
+/* Снимок последних значений всех каналов (не ждёт приёма, можно вызывать из любого потока).
+   Заполняет не больше capacity элементов и возвращает число каналов на табло. */
+TEMPLOG_API size_t templog_latest(templog* log, int64_t now_ms, templog_latest_value* out, size_t capacity);
+
+#ifdef __cplusplus
+}
+#endif
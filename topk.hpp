@@ -0,0 +1,152 @@
+#pragma once
+
+// Ранжирующие запросы по логам каналов: K каналов с наибольшим (или
+// наименьшим) средним, минимумом или максимумом за диапазон.
+//
+// Лучшие K держатся в ограниченной куче, в корне которой - худший из
+// отобранных. Перед точным подсчётом канала по сводкам блоков его лога
+// берутся границы значений: среднее, минимум и максимум лежат между
+// минимумом и максимумом затронутых блоков. Если граница не лучше K-го
+// места, канал отсекается без разбора лога. Рассчитано на логи роллапов:
+// их блоки - заранее посчитанные бакеты, так что запрос по всему парку
+// каналов читает в основном сводки.
+//
+// Каналы делятся на шарды по потокам, у каждого потока своя куча; порог
+// отсечения общий, так что шард отсекает каналы и по результатам соседей.
+// В конце кучи шардов сливаются.
+
+#include "history.hpp"
+#include <queue>
+#include <atomic>
+#include <thread>
+#include <string>
+#include <vector>
+#include <limits>
+#include <cstdint>
+#include <algorithm>
+
+enum RankBy {
+    RANK_AVG,
+    RANK_MIN,
+    RANK_MAX
+};
+
+inline bool parseRankBy(const std::string& text, RankBy& by) {
+    if (text == "avg")
+        by = RANK_AVG;
+    else if (text == "min")
+        by = RANK_MIN;
+    else if (text == "max")
+        by = RANK_MAX;
+    else
+        return false;
+    return true;
+}
+
+struct RankQuery {
+    size_t k = 10;
+    RankBy by = RANK_AVG;
+    bool bottom = false; // Наименьшие значения вместо наибольших
+    size_t threads = 1;
+};
+
+struct RankedLog {
+    std::string file_name;
+    double value;
+    uint64_t count;
+};
+
+// Счётчики запроса: сколько логов посчитано точно и сколько отсечено по сводкам
+struct RankStats {
+    size_t scanned = 0;
+    size_t pruned = 0;
+    size_t missing = 0; // Не удалось открыть
+};
+
+// K лучших логов за [from_ms, to_ms], от лучшего к худшему.
+// Логи без отсчётов в диапазоне в ответ не попадают.
+inline std::vector<RankedLog> rankLogs(const std::vector<std::string>& files, int64_t from_ms, int64_t to_ms,
+                                       const RankQuery& query, BlockCache* cache, RankStats* stats = nullptr) {
+    // Счёт: чем больше, тем лучше (для bottom - значение с обратным знаком)
+    auto score = [&](double value) {
+        return query.bottom ? -value : value;
+    };
+    auto worse = [&](const RankedLog& a, const RankedLog& b) {
+        return score(a.value) > score(b.value);
+    };
+    typedef std::priority_queue<RankedLog, std::vector<RankedLog>, decltype(worse)> Heap;
+
+    size_t shard_count = std::max<size_t>(1, std::min(query.threads, files.size()));
+    std::vector<Heap> heaps(shard_count, Heap(worse));
+    std::vector<RankStats> shard_stats(shard_count);
+    // Счёт K-го места в лучшей из куч шардов: канал, который его не превосходит, не нужен
+    std::atomic<double> threshold(-std::numeric_limits<double>::infinity());
+
+    auto raiseThreshold = [&](double value) {
+        double current = threshold.load();
+        while (value > current && !threshold.compare_exchange_weak(current, value)) {}
+    };
+
+    auto runShard = [&](size_t shard) {
+        Heap& heap = heaps[shard];
+        RankStats& counters = shard_stats[shard];
+        for (size_t i = shard; i < files.size(); i += shard_count) {
+            HistoryLog log(files[i], cache);
+            if (!log.IsOpen()) {
+                counters.missing++;
+                continue;
+            }
+            if (query.k == 0)
+                continue;
+            double min = 0.0, max = 0.0;
+            if (log.Bounds(from_ms, to_ms, min, max)) {
+                double bound = query.bottom ? -min : max;
+                bool full = heap.size() == query.k;
+                if (bound <= threshold.load() || (full && bound <= score(heap.top().value))) {
+                    counters.pruned++;
+                    continue;
+                }
+            }
+            counters.scanned++;
+            Partial partial = log.Aggregate(from_ms, to_ms);
+            if (partial.count == 0)
+                continue;
+            double value = partial.Average();
+            if (query.by == RANK_MIN)
+                value = partial.min;
+            else if (query.by == RANK_MAX)
+                value = partial.max;
+            heap.push(RankedLog{files[i], value, partial.count});
+            if (heap.size() > query.k)
+                heap.pop();
+            if (heap.size() == query.k)
+                raiseThreshold(score(heap.top().value));
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (size_t shard = 1; shard < shard_count; shard++)
+        workers.emplace_back(runShard, shard);
+    runShard(0);
+    for (auto& worker : workers)
+        worker.join();
+
+    std::vector<RankedLog> result;
+    for (size_t shard = 0; shard < shard_count; shard++) {
+        for (; !heaps[shard].empty(); heaps[shard].pop())
+            result.push_back(heaps[shard].top());
+        if (stats) {
+            stats->scanned += shard_stats[shard].scanned;
+            stats->pruned += shard_stats[shard].pruned;
+            stats->missing += shard_stats[shard].missing;
+        }
+    }
+    std::sort(result.begin(), result.end(), [&](const RankedLog& a, const RankedLog& b) {
+        if (score(a.value) != score(b.value))
+            return score(a.value) > score(b.value);
+        return a.file_name < b.file_name;
+    });
+    if (result.size() > query.k)
+        result.resize(query.k);
+    return result;
+}